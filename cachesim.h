@@ -0,0 +1,321 @@
+// Trace-driven cache and TLB simulator, for machines where the hardware
+// counters cpr3/cpr4 rely on are missing (VMs, containers).
+//
+// Kernels mark their memory accesses with CACHESIM_LOAD(p, bytes) and
+// CACHESIM_STORE(p, bytes). Those expand to nothing unless the program is
+// built with -DCACHESIM; then they feed the CacheSim attached to the calling
+// thread (CACHESIM_ATTACH), if any. The simulator runs every access through
+// a configurable stack of set-associative LRU levels, each missing level
+// passing the line on to the next, plus any TLBs on the side, and counts
+// misses per named array (CacheSim::name) and per level. It also records the
+// LRU reuse distance of every access, in distinct lines touched since the
+// previous access to the same line, which says which cache size would have
+// turned it into a hit.
+//
+// The hierarchy comes from CACHESIM_CONFIG, comma-separated
+// name:size:ways:line entries, sizes taking K/M/G; levels whose name starts
+// with "TLB" are TLBs, with the page size as their line. The default is a
+// typical x86 core: L1 32K 8-way, L2 1M 16-way, L3 32M 16-way, 64 entry
+// 4-way L1 dTLB and 1536 entry 12-way L2 TLB, 4K pages.
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define CACHESIM_DEFAULT_CONFIG "L1:32K:8:64,L2:1M:16:64,L3:32M:16:64,TLB1:256K:4:4K,TLB2:6M:12:4K"
+
+// One set-associative LRU level
+class CacheLevel {
+public:
+    CacheLevel(const std::string& name, size_t size, int ways, size_t line) : name(name), ways(ways), line(line) {
+        if (ways <= 0 || line == 0 || (line & (line - 1)) || size < line * ways)
+            throw std::invalid_argument("bad cache level " + name);
+        sets = size / (line * ways);
+        tags.assign(sets * ways, ~(uint64_t)0);
+        stamps.assign(sets * ways, 0);
+        tlb = name.compare(0, 3, "TLB") == 0;
+    }
+
+    // true on a hit; a miss brings the line in, evicting the set's LRU way
+    bool access(uintptr_t addr) {
+        uint64_t tag = addr / line;
+        size_t base = (tag % sets) * ways;
+        ++clock;
+        size_t victim = base;
+        for (size_t w = base; w < base + ways; ++w) {
+            if (tags[w] == tag) {
+                stamps[w] = clock;
+                return true;
+            }
+            if (stamps[w] < stamps[victim]) victim = w;
+        }
+        tags[victim] = tag;
+        stamps[victim] = clock;
+        return false;
+    }
+
+    std::string name;
+    int ways;
+    size_t line, sets;
+    bool tlb;
+
+private:
+    std::vector<uint64_t> tags, stamps;
+    uint64_t clock = 0;
+};
+
+// LRU stack distances by Bennett-Kruskal: a Fenwick tree over access times
+// marks the latest access of every line, so the distinct lines since a
+// line's previous access are the marks after it
+class ReuseDistance {
+public:
+    // distance in distinct lines, or -1 for the first access to the line
+    long long access(uint64_t line) {
+        if (now == marks.size()) compact();
+        long long distance = -1;
+        auto it = last.find(line);
+        if (it != last.end()) {
+            distance = prefix(now) - prefix(it->second + 1);
+            add(it->second, -1);
+            it->second = now;
+        } else {
+            last.emplace(line, now);
+        }
+        add(now, 1);
+        ++now;
+        return distance;
+    }
+
+private:
+    void add(size_t i, int v) {
+        for (++i; i <= marks.size(); i += i & (~i + 1)) marks[i - 1] += v;
+    }
+
+    // marks at times [0, i)
+    long long prefix(size_t i) const {
+        long long s = 0;
+        for (; i > 0; i -= i & (~i + 1)) s += marks[i - 1];
+        return s;
+    }
+
+    // Renumber the live times 0.. in order, leaving room to grow
+    void compact() {
+        std::vector<std::pair<size_t, uint64_t>> order;
+        order.reserve(last.size());
+        for (const auto& l : last) order.push_back(std::make_pair(l.second, l.first));
+        std::sort(order.begin(), order.end());
+        marks.assign(std::max<size_t>(1 << 20, order.size() * 4), 0);
+        for (size_t t = 0; t < order.size(); ++t) {
+            last[order[t].second] = t;
+            add(t, 1);
+        }
+        now = order.size();
+    }
+
+    std::vector<int> marks;
+    std::unordered_map<uint64_t, size_t> last;
+    size_t now = 0;
+};
+
+class CacheSim {
+public:
+    explicit CacheSim(const char* config = NULL) {
+        if (!config) config = getenv("CACHESIM_CONFIG");
+        if (!config || !*config) config = CACHESIM_DEFAULT_CONFIG;
+        std::string spec(config);
+        size_t pos = 0;
+        while (pos <= spec.size()) {
+            size_t end = spec.find(',', pos);
+            if (end == std::string::npos) end = spec.size();
+            parseLevel(spec.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        if (levels.empty()) throw std::invalid_argument("no cache levels in CACHESIM_CONFIG");
+        other = Stats(levels.size());
+        line = levels[0].line;
+        for (const CacheLevel& l : levels) {
+            if (!l.tlb) {
+                line = l.line;
+                break;
+            }
+        }
+    }
+
+    // Attribute accesses in [base, base + bytes) to name; naming a range
+    // again under the same name moves it (e.g. a stack buffer per call)
+    void name(const char* array, const void* base, size_t bytes) { name(array, (uintptr_t)base, bytes); }
+
+    void name(const char* array, uintptr_t b, size_t bytes) {
+        for (Range& r : ranges) {
+            if (r.name == array) {
+                r.begin = b;
+                r.end = b + bytes;
+                return;
+            }
+        }
+        ranges.push_back(Range{array, b, b + bytes, (int)stats.size()});
+        stats.push_back(Stats(levels.size()));
+    }
+
+    void access(const void* p, size_t bytes, bool store) {
+        uintptr_t first = (uintptr_t)p / line, last = ((uintptr_t)p + bytes - 1) / line;
+        for (uintptr_t l = first; l <= last; ++l) accessLine(l * line, store);
+    }
+
+    // Per array and level: accesses, miss rates, reuse-distance percentiles
+    std::string report() const {
+        std::string out;
+        char buf[256];
+        snprintf(buf, sizeof buf, "%-8s %12s %8s", "array", "line refs", "stores");
+        out += buf;
+        for (const CacheLevel& l : levels) {
+            snprintf(buf, sizeof buf, " %9s", (l.name + " miss").c_str());
+            out += buf;
+        }
+        snprintf(buf, sizeof buf, " %10s %10s %10s\n", "cold", "reuse p50", "reuse p90");
+        out += buf;
+        std::vector<int> order;
+        for (size_t i = 0; i < ranges.size(); ++i) order.push_back(ranges[i].stat);
+        order.push_back(-1);  // everything else
+        for (int s : order) {
+            const Stats& st = s < 0 ? other : stats[s];
+            if (st.refs == 0) continue;
+            snprintf(buf, sizeof buf, "%-8s %12llu %8llu", s < 0 ? "other" : nameOf(s).c_str(),
+                     (unsigned long long)st.refs, (unsigned long long)st.stores);
+            out += buf;
+            for (size_t l = 0; l < levels.size(); ++l) {
+                snprintf(buf, sizeof buf, " %8.2f%%", 100.0 * st.misses[l] / st.refs);
+                out += buf;
+            }
+            snprintf(buf, sizeof buf, " %10llu %10s %10s\n", (unsigned long long)st.cold,
+                     percentile(st, 0.5).c_str(), percentile(st, 0.9).c_str());
+            out += buf;
+        }
+        return out;
+    }
+
+private:
+    struct Range {
+        std::string name;
+        uintptr_t begin, end;
+        int stat;
+    };
+
+    struct Stats {
+        explicit Stats(size_t levels) : misses(levels, 0), distance(64, 0) {}
+        uint64_t refs = 0, stores = 0, cold = 0;
+        std::vector<uint64_t> misses;
+        std::vector<uint64_t> distance;  // bucket b: distances in [2^b - 1, 2^(b+1) - 1)
+    };
+
+    void parseLevel(const std::string& entry) {
+        if (entry.empty()) return;
+        std::vector<std::string> f;
+        size_t pos = 0;
+        while (true) {
+            size_t end = entry.find(':', pos);
+            f.push_back(entry.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+            if (end == std::string::npos) break;
+            pos = end + 1;
+        }
+        if (f.size() != 4) throw std::invalid_argument("cache level must be name:size:ways:line, got " + entry);
+        levels.emplace_back(f[0], parseSize(f[1]), atoi(f[2].c_str()), parseSize(f[3]));
+    }
+
+    static size_t parseSize(const std::string& s) {
+        char* end;
+        double v = strtod(s.c_str(), &end);
+        switch (*end) {
+        case 'K': case 'k': v *= 1024; break;
+        case 'M': case 'm': v *= 1024 * 1024; break;
+        case 'G': case 'g': v *= 1024.0 * 1024 * 1024; break;
+        }
+        return (size_t)v;
+    }
+
+    void accessLine(uintptr_t addr, bool store) {
+        Stats* st = &other;
+        for (const Range& r : ranges) {
+            if (addr + line > r.begin && addr < r.end) {
+                st = &stats[r.stat];
+                break;
+            }
+        }
+        ++st->refs;
+        if (store) ++st->stores;
+        bool missed = true;  // a cache level only sees what the one above missed
+        for (size_t l = 0; l < levels.size(); ++l) {
+            if (levels[l].tlb) {
+                if (!levels[l].access(addr)) ++st->misses[l];
+            } else if (missed) {
+                missed = !levels[l].access(addr);
+                if (missed) ++st->misses[l];
+            }
+        }
+        long long d = reuse.access(addr / line);
+        if (d < 0) {
+            ++st->cold;
+        } else {
+            int b = 0;
+            while (b < 63 && (2ull << b) - 1 <= (unsigned long long)d) ++b;
+            ++st->distance[b];
+        }
+    }
+
+    // Upper bound of the bucket holding the given fraction of reuses, in bytes
+    std::string percentile(const Stats& st, double q) const {
+        uint64_t total = st.refs - st.cold, seen = 0;
+        if (total == 0) return "-";
+        for (size_t b = 0; b < st.distance.size(); ++b) {
+            seen += st.distance[b];
+            if (seen >= q * total) {
+                double bytes = (double)((2ull << b) - 1) * line;
+                char buf[32];
+                if (bytes < 1024) snprintf(buf, sizeof buf, "%.0fB", bytes);
+                else if (bytes < 1024 * 1024) snprintf(buf, sizeof buf, "%.0fK", bytes / 1024);
+                else snprintf(buf, sizeof buf, "%.0fM", bytes / (1024 * 1024));
+                return buf;
+            }
+        }
+        return "-";
+    }
+
+    std::string nameOf(int stat) const {
+        for (const Range& r : ranges) {
+            if (r.stat == stat) return r.name;
+        }
+        return "?";
+    }
+
+    std::vector<CacheLevel> levels;
+    size_t line;
+    std::vector<Range> ranges;
+    std::vector<Stats> stats;
+    Stats other{0};
+    ReuseDistance reuse;
+};
+
+#ifdef CACHESIM
+inline thread_local CacheSim* cachesim_current = NULL;
+#define CACHESIM_ATTACH(sim) (cachesim_current = (sim))
+#define CACHESIM_NAME(array, p, bytes) \
+    do { if (cachesim_current) cachesim_current->name((array), (uintptr_t)(p), (bytes)); } while (0)
+#define CACHESIM_LOAD(p, bytes) \
+    do { if (cachesim_current) cachesim_current->access((p), (bytes), false); } while (0)
+#define CACHESIM_STORE(p, bytes) \
+    do { if (cachesim_current) cachesim_current->access((p), (bytes), true); } while (0)
+#else
+#define CACHESIM_ATTACH(sim) ((void)0)
+#define CACHESIM_NAME(array, p, bytes) ((void)0)
+#define CACHESIM_LOAD(p, bytes) ((void)0)
+#define CACHESIM_STORE(p, bytes) ((void)0)
+#endif
+
+#endif
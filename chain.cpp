@@ -0,0 +1,93 @@
+//compile with g++ -O2 -march=native -pthread chain.cpp -o chain
+//usage: chain [-t threads] [-b block] [-r runs] d0 d1 ... dn
+//Multiplies n random matrices, matrix i being d(i) x d(i+1), once in the
+//order chosen by the planner and once left to right, both on the same pool,
+//and prints the plans, predicted and measured times and the difference.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <unistd.h>
+#include "chain.h"
+
+static void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [-t threads] [-b block] [-r runs] d0 d1 ... dn\n"
+              << "example: " << prog << " 1000 20 1000 20 1000\n";
+}
+
+// Function to time runs of the chain's current plan, keeping the best
+static double timeRuns(MatrixChain& chain, double* out, int runs) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        chain.run(out);
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int bs = 64;
+    int runs = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:b:r:h")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'b': bs = atoi(optarg); break;
+        case 'r': runs = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    std::vector<int> dims;
+    for (int i = optind; i < argc; ++i) dims.push_back(atoi(argv[i]));
+    if (threads <= 0 || bs <= 0 || runs <= 0 || dims.size() < 2 ||
+        std::any_of(dims.begin(), dims.end(), [](int d) { return d <= 0; })) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    std::vector<double*> operands;
+    ThreadPool pool(threads);
+    MatrixChain chain(pool, bs);
+    for (size_t i = 0; i + 1 < dims.size(); ++i) {
+        size_t elems = (size_t)dims[i] * dims[i + 1];
+        operands.push_back(alloc_matrix(elems));
+        for (size_t e = 0; e < elems; ++e) operands.back()[e] = (rand() % 2001 - 1000) * 1e-3;
+        chain.add(dims[i], dims[i + 1], operands.back());
+    }
+    size_t outElems = (size_t)chain.rows() * chain.cols();
+    double* planned = alloc_matrix(outElems);
+    double* byHand = alloc_matrix(outElems);
+
+    std::string order = chain.plan();
+    double predictedPlanned = chain.plannedSeconds();
+    double measuredPlanned = timeRuns(chain, planned, runs);
+
+    std::string naive = chain.plan(false);
+    double predictedNaive = chain.plannedSeconds();
+    double measuredNaive = timeRuns(chain, byHand, runs);
+
+    double diff = 0.0, scale = 0.0;
+    for (size_t e = 0; e < outElems; ++e) {
+        diff = std::max(diff, std::fabs(planned[e] - byHand[e]));
+        scale = std::max(scale, std::fabs(byHand[e]));
+    }
+    printf("%-12s %-40s %12s %12s\n", "order", "plan", "predicted s", "measured s");
+    printf("%-12s %-40s %12.5f %12.5f\n", "planned", order.c_str(), predictedPlanned, measuredPlanned);
+    printf("%-12s %-40s %12.5f %12.5f\n", "left-right", naive.c_str(), predictedNaive, measuredNaive);
+    printf("speed-up %.2fx on %d threads, relative difference %.2e\n", measuredNaive / measuredPlanned, threads,
+           scale > 0 ? diff / scale : diff);
+
+    for (double* op : operands) free_matrix(op);
+    free_matrix(planned);
+    free_matrix(byHand);
+    return 0;
+}
@@ -0,0 +1,268 @@
+// Matrix-chain products M0 * M1 * ... * Mn-1 of row-major matrices with
+// mismatched shapes. plan() picks the parenthesisation by dynamic
+// programming on estimated time: flops divided by the kernel throughput
+// measured for the product's smallest dimension (skinny products run well
+// below peak, so pure flop counting picks badly between close plans).
+// run() executes the plan on a ThreadPool: each product is split into tiles
+// of C, and products whose operands are ready run at the same time, so
+// independent sub-chains proceed in parallel. Intermediates live in an
+// arena laid out once per plan and kept across runs.
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "dgemm.h"
+#include "matalloc.h"
+#include "threadpool.h"
+
+// Kernel throughput (GFLOP/s) against the smallest of M, N, K, measured once
+struct ChainThroughput {
+    std::vector<int> dims;
+    std::vector<double> gflops;
+
+    explicit ChainThroughput(int bs) {
+        const int big = 192;
+        double* A = alloc_matrix((size_t)big * big);
+        double* B = alloc_matrix((size_t)big * big);
+        double* C = alloc_matrix((size_t)big * big);
+        for (int d : {1, 4, 16, 64, big}) {
+            // the small dimension as K, M and N in turn, keep the slowest
+            double worst = 1e30;
+            for (int which = 0; which < 3; ++which) {
+                int M = which == 0 ? d : big, N = which == 1 ? d : big, K = which == 2 ? d : big;
+                int reps = std::max(1, (int)(4e6 / (2.0 * M * N * K)));
+                auto start = std::chrono::steady_clock::now();
+                for (int r = 0; r < reps; ++r) dgemm_rect(M, N, K, A, K, B, N, C, N, bs);
+                double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                worst = std::min(worst, 2.0 * M * N * K * reps / s * 1e-9);
+            }
+            dims.push_back(d);
+            gflops.push_back(worst);
+        }
+        free_matrix(A);
+        free_matrix(B);
+        free_matrix(C);
+    }
+
+    // Log-linear interpolation between the measured points
+    double at(int d) const {
+        if (d <= dims.front()) return gflops.front();
+        for (size_t i = 1; i < dims.size(); ++i) {
+            if (d <= dims[i]) {
+                double t = std::log((double)d / dims[i - 1]) / std::log((double)dims[i] / dims[i - 1]);
+                return gflops[i - 1] + t * (gflops[i] - gflops[i - 1]);
+            }
+        }
+        return gflops.back();
+    }
+};
+
+class MatrixChain {
+public:
+    MatrixChain(ThreadPool& pool, int bs = 64) : pool(pool), bs(bs) {}
+
+    ~MatrixChain() { free_matrix(arena); }
+
+    MatrixChain(const MatrixChain&) = delete;
+    MatrixChain& operator=(const MatrixChain&) = delete;
+
+    // Append an operand; its rows must equal the previous operand's columns
+    void add(int rows, int cols, double* data) {
+        if (!operands.empty() && operands.back().cols != rows) throw std::invalid_argument("chain shapes do not match");
+        operands.push_back(Operand{rows, cols, data});
+        nodes.clear();
+    }
+
+    int rows() const { return operands.front().rows; }
+    int cols() const { return operands.back().cols; }
+
+    // Choose the order; returns it as e.g. "((M0 M1) (M2 M3))". With
+    // optimise false the chain is taken left to right, as written by hand
+    std::string plan(bool optimise = true) {
+        const int n = (int)operands.size();
+        if (n == 0) throw std::invalid_argument("empty chain");
+        if (!throughput) throughput.reset(new ChainThroughput(bs));
+        // dims[i] x dims[i+1] is the shape of operand i
+        std::vector<int> dims;
+        for (const Operand& op : operands) dims.push_back(op.rows);
+        dims.push_back(operands.back().cols);
+
+        std::vector<std::vector<double>> cost(n, std::vector<double>(n, 0.0));
+        std::vector<std::vector<int>> split(n, std::vector<int>(n, -1));
+        for (int len = 2; len <= n; ++len) {
+            for (int i = 0; i + len - 1 < n; ++i) {
+                int j = i + len - 1;
+                cost[i][j] = 1e300;
+                for (int k = optimise ? i : j - 1; k < j; ++k) {
+                    double c = cost[i][k] + cost[k + 1][j] + productSeconds(dims[i], dims[k + 1], dims[j + 1]);
+                    if (c < cost[i][j]) {
+                        cost[i][j] = c;
+                        split[i][j] = k;
+                    }
+                }
+            }
+        }
+        predicted = cost[0][n - 1];
+
+        nodes.clear();
+        build(0, n - 1, split, -1);
+        layoutArena();
+        return describe(0);
+    }
+
+    // Predicted seconds of the last plan
+    double plannedSeconds() const { return predicted; }
+
+    // out := M0 * ... * Mn-1, rows() x cols(), row-major
+    void run(double* out) {
+        if (nodes.empty()) plan();
+        if (operands.size() == 1) {
+            std::copy(operands[0].data, operands[0].data + (size_t)rows() * cols(), out);
+            return;
+        }
+        nodes[0].data = out;
+        for (Node& node : nodes) node.pending = node.childProducts;
+        std::future<void> done = (finished = std::make_shared<std::promise<void>>())->get_future();
+        failed = false;
+        error = nullptr;
+        active = 1;  // held while the first products are queued
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].leaf < 0 && nodes[i].childProducts == 0) start((int)i);
+        }
+        release();
+        done.get();
+    }
+
+private:
+    struct Operand {
+        int rows, cols;
+        double* data;
+    };
+
+    // Plan tree, root at 0. Leaves point at operands; products at arena
+    // buffers (the root at the caller's output)
+    struct Node {
+        int leaf;              // operand index, or -1 for a product
+        int left, right, parent;
+        int rows, cols;
+        size_t offset;         // into the arena, for products other than the root
+        double* data;
+        int childProducts;     // children that are products
+        std::atomic<int> pending{0};
+        std::atomic<int> tilesLeft{0};
+        Node(int leaf, int rows, int cols, int parent)
+            : leaf(leaf), left(-1), right(-1), parent(parent), rows(rows), cols(cols), offset(0), data(NULL),
+              childProducts(0) {}
+        Node(const Node& o)
+            : leaf(o.leaf), left(o.left), right(o.right), parent(o.parent), rows(o.rows), cols(o.cols),
+              offset(o.offset), data(o.data), childProducts(o.childProducts) {}
+    };
+
+    double productSeconds(int M, int K, int N) const {
+        return 2.0 * M * N * K / (throughput->at(std::min(M, std::min(N, K))) * 1e9);
+    }
+
+    int build(int i, int j, const std::vector<std::vector<int>>& split, int parent) {
+        int id = (int)nodes.size();
+        if (i == j) {
+            nodes.emplace_back(i, operands[i].rows, operands[i].cols, parent);
+            nodes[id].data = operands[i].data;
+            return id;
+        }
+        nodes.emplace_back(-1, operands[i].rows, operands[j].cols, parent);
+        int k = split[i][j];
+        int l = build(i, k, split, id);
+        int r = build(k + 1, j, split, id);
+        nodes[id].left = l;
+        nodes[id].right = r;
+        nodes[id].childProducts = (nodes[l].leaf < 0) + (nodes[r].leaf < 0);
+        return id;
+    }
+
+    // Sub-products may run concurrently, so each gets its own range; the
+    // arena only grows, and is reused as is by later runs of any plan that fits
+    void layoutArena() {
+        size_t need = 0;
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            if (nodes[i].leaf >= 0) continue;
+            nodes[i].offset = need;
+            need += ((size_t)nodes[i].rows * nodes[i].cols + 7) / 8 * 8;  // keep 64-byte alignment
+        }
+        if (need > arenaElems) {
+            free_matrix(arena);
+            arena = need ? alloc_matrix(need) : NULL;
+            arenaElems = need;
+        }
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            if (nodes[i].leaf < 0) nodes[i].data = arena + nodes[i].offset;
+        }
+    }
+
+    std::string describe(int id) const {
+        const Node& node = nodes[id];
+        if (node.leaf >= 0) return "M" + std::to_string(node.leaf);
+        return "(" + describe(node.left) + " " + describe(node.right) + ")";
+    }
+
+    // Drop one hold on the run. The last one, after the root on success or
+    // once the products already queued have drained after a failure, completes
+    // the run. That is the final touch of *this: the promise is held through a
+    // local copy, since run() may return, and the chain go, as soon as it is set
+    void release() {
+        if (--active != 0) return;
+        std::shared_ptr<std::promise<void>> done = finished;
+        if (failed) done->set_exception(error);
+        else done->set_value();
+    }
+
+    // Queue the tiles of one product; the last tile to finish releases the parent
+    void start(int id) {
+        Node& node = nodes[id];
+        const Node& a = nodes[node.left];
+        const Node& b = nodes[node.right];
+        const int tile = bs * TILE_BLOCKS;
+        const int tileRows = (node.rows + tile - 1) / tile, tileCols = (node.cols + tile - 1) / tile;
+        node.tilesLeft = tileRows * tileCols;
+        ++active;
+        pool.submit(tileRows * tileCols, [this, id, &node, &a, &b, tile, tileCols](int t) {
+            int i0 = (t / tileCols) * tile, i1 = std::min(node.rows, i0 + tile);
+            int j0 = (t % tileCols) * tile, j1 = std::min(node.cols, j0 + tile);
+            try {
+                for (int i = i0; i < i1; ++i) std::fill(node.data + (size_t)i * node.cols + j0, node.data + (size_t)i * node.cols + j1, 0.0);
+                dgemm_rect(i1 - i0, j1 - j0, a.cols, a.data + (size_t)i0 * a.cols, a.cols, b.data + j0, b.cols,
+                           node.data + (size_t)i0 * node.cols + j0, node.cols, bs);
+            } catch (...) {
+                bool expected = false;
+                if (failed.compare_exchange_strong(expected, true)) error = std::current_exception();
+            }
+            if (--node.tilesLeft == 0) {
+                // after a failure the parent never starts
+                if (!failed && node.parent >= 0 && --nodes[node.parent].pending == 0) start(node.parent);
+                release();
+            }
+        });
+    }
+
+    ThreadPool& pool;
+    int bs;
+    std::vector<Operand> operands;
+    std::vector<Node> nodes;
+    std::unique_ptr<ChainThroughput> throughput;
+    double predicted = 0.0;
+    double* arena = NULL;
+    size_t arenaElems = 0;
+    std::shared_ptr<std::promise<void>> finished;
+    std::atomic<int> active{0};         // products queued and not yet finished, plus run()'s hold
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;           // first tile exception of the run, set by whoever set failed
+};
+
+#endif
@@ -0,0 +1,187 @@
+// 2D convolution on the packed kernel (dgemm.h) by implicit im2col: the
+// patch matrix is never built. Where an explicit lowering copies every input
+// pixel R * S times into a (C * R * S) x (P * Q) matrix and multiplies that,
+// here the packing step gathers the patches of 4 output positions straight
+// from the input tensor into the micro-panel format pack_a/pack_b produce,
+// one K chunk at a time, with zeros for the padding. Only those panels and
+// the packed weights exist besides the tensors themselves.
+//
+// Tensors are row-major:
+//   CONV_NCHW  input N x C x H x W, weights K x C x R x S (OIHW), output N x K x P x Q
+//   CONV_NHWC  input N x H x W x C, weights K x R x S x C (OHWI), output N x P x Q x K
+// Either way the weights are a K x (C*R*S) row-major matrix and one image
+// of output is a product with the patch matrix; only which operand is the
+// kernel's row side changes. The weights are packed once per call and
+// shared; tasks are one image's tiles of bs * TILE_BLOCKS output positions.
+// Output is overwritten, not accumulated into.
+#ifndef CONV_H
+#define CONV_H
+
+#include <algorithm>
+#include <vector>
+#include "dgemm.h"
+#include "matalloc.h"
+#include "threadpool.h"
+
+enum ConvLayout { CONV_NCHW, CONV_NHWC };
+
+struct ConvShape {
+    int N, C, H, W;  // input images, channels, height, width
+    int K, R, S;     // filters, filter height, filter width
+    int strideH = 1, strideW = 1;
+    int padH = 0, padW = 0;
+    int dilH = 1, dilW = 1;
+
+    int P() const { return (H + 2 * padH - dilH * (R - 1) - 1) / strideH + 1; }
+    int Q() const { return (W + 2 * padW - dilW * (S - 1) - 1) / strideW + 1; }
+    int reduction() const { return C * R * S; }  // the GEMM's K
+    double flops() const { return 2.0 * N * K * P() * Q() * reduction(); }
+};
+
+// Depth of the K chunks the patches are gathered in
+inline int CONV_KC = 256;
+
+// Pack rows k0.. of the K x CRS weights as 4-filter panels, CONV_KC deep
+// chunks one after another (chunk at k0 * K4, panel f at f * kk in it);
+// filters past K are zero
+inline double* conv_pack_weights(const ConvShape& s, const double* Wt, int& K4) {
+    int crs = s.reduction();
+    K4 = (s.K + 3) & ~3;
+    double* WW = alloc_matrix(std::max<size_t>(1, (size_t)K4 * crs));
+    for (int k0 = 0; k0 < crs; k0 += CONV_KC) {
+        int kk = std::min(CONV_KC, crs - k0);
+        double* chunk = WW + (size_t)k0 * K4;
+        for (int f = 0; f < K4; f += 4)
+            for (int k = 0; k < kk; ++k)
+                for (int l = 0; l < 4; ++l)
+                    chunk[(size_t)f * kk + 4 * k + l] = f + l < s.K ? Wt[(size_t)(f + l) * crs + k0 + k] : 0.0;
+    }
+    return WW;
+}
+
+// Gather reduction rows k0 .. k0 + kk of the patch matrix for output
+// positions p0 .. p0 + 4 of one image into a panel: 4 values per row, zero
+// for padding and for positions past the end. A row is (c, r, s) for NCHW
+// and (r, s, c) for NHWC; both are walked incrementally
+inline void conv_gather(const ConvShape& s, ConvLayout layout, const double* X, int p0, int k0, int kk, double* dst) {
+    int PQ = s.P() * s.Q();
+    int ih0[4], iw0[4];
+    bool live[4];
+    for (int l = 0; l < 4; ++l) {
+        int p = p0 + l;
+        live[l] = p < PQ;
+        ih0[l] = live[l] ? (p / s.Q()) * s.strideH - s.padH : 0;
+        iw0[l] = live[l] ? (p % s.Q()) * s.strideW - s.padW : 0;
+    }
+    if (layout == CONV_NCHW) {
+        int c = k0 / (s.R * s.S), r = (k0 / s.S) % s.R, q = k0 % s.S;
+        for (int k = 0; k < kk; ++k) {
+            const double* plane = X + (size_t)c * s.H * s.W;
+            for (int l = 0; l < 4; ++l) {
+                int ih = ih0[l] + r * s.dilH, iw = iw0[l] + q * s.dilW;
+                bool in = live[l] && ih >= 0 && ih < s.H && iw >= 0 && iw < s.W;
+                dst[4 * k + l] = in ? plane[(size_t)ih * s.W + iw] : 0.0;
+            }
+            if (++q == s.S) {
+                q = 0;
+                if (++r == s.R) {
+                    r = 0;
+                    ++c;
+                }
+            }
+        }
+        return;
+    }
+    // NHWC: channels are contiguous, so copy a run of them per (r, s) and position
+    int k = 0;
+    while (k < kk) {
+        int rs = (k0 + k) / s.C, c0 = (k0 + k) % s.C;
+        int r = rs / s.S, q = rs % s.S;
+        int run = std::min(s.C - c0, kk - k);
+        for (int l = 0; l < 4; ++l) {
+            int ih = ih0[l] + r * s.dilH, iw = iw0[l] + q * s.dilW;
+            double* d = dst + 4 * k + l;
+            if (live[l] && ih >= 0 && ih < s.H && iw >= 0 && iw < s.W) {
+                const double* src = X + ((size_t)ih * s.W + iw) * s.C + c0;
+                for (int c = 0; c < run; ++c) d[4 * c] = src[c];
+            } else {
+                for (int c = 0; c < run; ++c) d[4 * c] = 0.0;
+            }
+        }
+        k += run;
+    }
+}
+
+// One 4 x 4 tile of the product, straight into the output when it lies
+// wholly inside, else through a scratch tile; the first K chunk overwrites
+static inline void conv_tile(int ldc, int kk, double* rowPanel, double* colPanel, double* C, int rows, int cols,
+                             bool first) {
+    if (rows == 4 && cols == 4) {
+        sse_4x4(ldc, kk, rowPanel, colPanel, C, first);
+        return;
+    }
+    double tile[16];
+    sse_4x4(4, kk, rowPanel, colPanel, tile, true);
+    for (int j = 0; j < cols; ++j)
+        for (int i = 0; i < rows; ++i) C[(size_t)j * ldc + i] = (first ? 0.0 : C[(size_t)j * ldc + i]) + tile[4 * j + i];
+}
+
+// Output positions p0 .. p1 of image n. NCHW output is K x PQ row-major,
+// i.e. column-major PQ x K: positions are the kernel's rows. NHWC output is
+// PQ x K row-major, column-major K x PQ: filters are the rows
+inline void conv_positions(const ConvShape& s, ConvLayout layout, const double* X, double* WW, int K4, double* Y,
+                           int p0, int p1, int bs) {
+    int crs = s.reduction(), PQ = s.P() * s.Q();
+    thread_local std::vector<double> patches;
+    if (patches.size() < (size_t)bs * CONV_KC) patches.resize((size_t)bs * CONV_KC);
+    for (int pb = p0; pb < p1; pb += bs) {
+        int np = std::min(bs, p1 - pb);
+        int np4 = (np + 3) & ~3;
+        for (int k0 = 0; k0 < crs; k0 += CONV_KC) {
+            int kk = std::min(CONV_KC, crs - k0);
+            TRACE_BEGIN("gather");
+            for (int p = 0; p < np4; p += 4) conv_gather(s, layout, X, pb + p, k0, kk, &patches[(size_t)p * kk]);
+            TRACE_END("gather");
+            TRACE_SCOPE("kernel");
+            double* chunk = WW + (size_t)k0 * K4;
+            for (int p = 0; p < np4; p += 4) {
+                int rows = std::min(4, pb + np - (pb + p));
+                for (int f = 0; f < K4; f += 4) {
+                    int cols = std::min(4, s.K - f);
+                    if (layout == CONV_NCHW)
+                        conv_tile(PQ, kk, &patches[(size_t)p * kk], chunk + (size_t)f * kk,
+                                  Y + (size_t)f * PQ + pb + p, rows, cols, k0 == 0);
+                    else
+                        conv_tile(s.K, kk, chunk + (size_t)f * kk, &patches[(size_t)p * kk],
+                                  Y + (size_t)(pb + p) * s.K + f, cols, rows, k0 == 0);
+                }
+            }
+        }
+    }
+}
+
+// Y := conv(X, Wt) for the whole batch, tiles of output positions on the pool
+inline void conv2d_implicit(ThreadPool& pool, const ConvShape& s, ConvLayout layout, const double* X,
+                            const double* Wt, double* Y, int bs) {
+    bs = (bs + 3) & ~3;
+    int K4;
+    double* WW = conv_pack_weights(s, Wt, K4);
+    int PQ = s.P() * s.Q();
+    int tile = bs * TILE_BLOCKS;
+    int tiles = (PQ + tile - 1) / tile;
+    size_t in = (size_t)s.C * s.H * s.W, out = (size_t)s.K * PQ;
+    pool.submit(s.N * tiles, [&](int t) {
+        int n = t / tiles, p0 = (t % tiles) * tile;
+        conv_positions(s, layout, X + n * in, WW, K4, Y + n * out, p0, std::min(PQ, p0 + tile), bs);
+    }).get();
+    free_matrix(WW);
+}
+
+// Bytes the implicit path allocates besides the tensors: the packed weights
+// and a patch buffer per thread
+inline size_t conv_implicit_bytes(const ConvShape& s, int bs, int threads) {
+    bs = (bs + 3) & ~3;
+    return sizeof(double) * ((size_t)((s.K + 3) & ~3) * s.reduction() + (size_t)threads * bs * CONV_KC);
+}
+
+#endif
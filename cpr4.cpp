@@ -0,0 +1,1874 @@
+//compile with g++ -O2 cpr4.cpp -o cpr4
+//usage: cpr4 [-i interval_ms] [-o file] [-f csv|bin] [-s] [-F freq] [-w scan_ms] [-p pid | process_name]
+//       cpr4 [-i interval_ms] [-o file] [-f csv|bin] [-s] [-F freq] [-w scan_ms] -- command [args...]
+//       cpr4 -a [-i refresh_ms] [-F freq] [-d seconds] [-g cgroup] [name_filter]
+//       cpr4 -c [-F freq] [-p pid | process_name | -- command [args...]]
+//build the target with -g to get source lines in the hotspot table
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <cxxabi.h>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+// Structure to hold process information
+struct ProcessInfo {
+    pid_t pid;
+    std::string name;
+};
+
+// Counters read at every interval; hardware ones may be missing in VMs/containers
+enum CounterId {
+    CNT_CYCLES,
+    CNT_INSTRUCTIONS,
+    CNT_CACHE_REFS,
+    CNT_CACHE_MISSES,
+    CNT_MINOR_FAULTS,
+    CNT_MAJOR_FAULTS,
+    CNT_COUNT
+};
+
+struct CounterDesc {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const CounterDesc counterDescs[CNT_COUNT] = {
+    {"cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache_refs",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"minor_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN},
+    {"major_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+};
+
+// One fd per counter per monitored thread, plus /proc fallbacks
+struct CounterGroup {
+    std::vector<pid_t> tids;
+    std::vector<int> fds[CNT_COUNT];
+    bool available[CNT_COUNT];
+    bool procFaults;  // page faults come from /proc/<pid>/stat instead of perf
+    int statFd;
+    int statmFd;
+};
+
+// Memory figures of the latest working-set scan, in kB; activeKb is what was
+// touched between that scan and the one before, so it needs two scans
+struct WorkingSet {
+    uint64_t pssKb;
+    uint64_t anonKb;
+    uint64_t thpKb;      // anonymous memory in transparent huge pages
+    uint64_t hugetlbKb;
+    uint64_t swapKb;
+    uint64_t activeKb;
+    uint64_t scans;
+};
+
+// One row of the time series: deltas over the interval ending at tNs
+struct IntervalSample {
+    uint64_t tNs;
+    uint64_t delta[CNT_COUNT];
+    uint64_t rssKb;
+    uint32_t threads;
+    WorkingSet ws;  // zero unless -w
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+static long perf_event_open(perf_event_attr* attr, pid_t pid, int cpu, int groupFd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, groupFd, flags);
+}
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Function to read a small /proc file through an already open descriptor
+static bool readProcFile(int fd, char* buf, size_t size) {
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    if (len <= 0) {
+        return false;
+    }
+    buf[len] = '\0';
+    return true;
+}
+
+// Function to list all running processes
+std::vector<ProcessInfo> listProcesses() {
+    std::vector<ProcessInfo> processes;
+    DIR* proc = opendir("/proc");
+    if (proc == NULL) {
+        std::cerr << "opendir(/proc) failed: " << strerror(errno) << std::endl;
+        return processes;
+    }
+
+    while (dirent* entry = readdir(proc)) {
+        char* end;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0) {
+            continue;
+        }
+        std::ifstream comm(std::string("/proc/") + entry->d_name + "/comm");
+        ProcessInfo pi;
+        pi.pid = (pid_t)pid;
+        if (!std::getline(comm, pi.name)) {
+            continue;
+        }
+        processes.push_back(pi);
+    }
+
+    closedir(proc);
+    std::sort(processes.begin(), processes.end(),
+              [](const ProcessInfo& a, const ProcessInfo& b) { return a.pid < b.pid; });
+    return processes;
+}
+
+// Function to list the threads of a process
+std::vector<pid_t> listThreads(pid_t pid) {
+    std::vector<pid_t> tids;
+    std::string path = "/proc/" + std::to_string(pid) + "/task";
+    DIR* task = opendir(path.c_str());
+    if (task == NULL) {
+        return tids;
+    }
+    while (dirent* entry = readdir(task)) {
+        long tid = strtol(entry->d_name, NULL, 10);
+        if (tid > 0) {
+            tids.push_back((pid_t)tid);
+        }
+    }
+    closedir(task);
+    return tids;
+}
+
+// Function to check if a process is still running (zombies count as exited)
+bool isProcessRunning(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    std::ifstream stat(path);
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return false;
+    }
+    size_t paren = line.rfind(')');
+    return paren != std::string::npos && paren + 2 < line.size() && line[paren + 2] != 'Z';
+}
+
+// Function to start a command stopped before exec; the returned pipe fd releases it
+pid_t launchProcess(char** argv, int& goFd) {
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        std::cerr << "pipe failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    if (pid == 0) {
+        // Wait until the parent has attached the counters, then exec
+        close(pipeFds[1]);
+        char go;
+        if (read(pipeFds[0], &go, 1) != 1) {
+            _exit(127);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "execvp(%s) failed: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(pipeFds[0]);
+    goFd = pipeFds[1];
+    return pid;
+}
+
+// Function to open the counter set on every thread of a process.
+// For a launched process the counters stay disabled until its exec so the
+// profiler's own fork/wait is not counted, and inherit covers every thread it spawns.
+bool openCounters(CounterGroup& group, pid_t pid, bool launched) {
+    group.tids = launched ? std::vector<pid_t>{pid} : listThreads(pid);
+    if (group.tids.empty()) {
+        std::cerr << "No threads found for PID " << pid << std::endl;
+        return false;
+    }
+
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        group.available[c] = true;
+        for (pid_t tid : group.tids) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = counterDescs[c].type;
+            attr.config = counterDescs[c].config;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1;  // threads created after attach are folded into the parent count
+            attr.disabled = launched;
+            attr.enable_on_exec = launched;
+
+            int fd = (int)perf_event_open(&attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+            if (fd < 0) {
+                if (errno == ESRCH) {
+                    continue;  // thread exited while we were attaching
+                }
+                std::cerr << "Counter " << counterDescs[c].name << " unavailable: " << strerror(errno) << std::endl;
+                group.available[c] = false;
+                break;
+            }
+            group.fds[c].push_back(fd);
+        }
+        if (!group.available[c]) {
+            for (int fd : group.fds[c]) {
+                close(fd);
+            }
+            group.fds[c].clear();
+        }
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    group.statFd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    group.statmFd = open(path, O_RDONLY | O_CLOEXEC);
+
+    group.procFaults = !group.available[CNT_MINOR_FAULTS] || !group.available[CNT_MAJOR_FAULTS];
+    if (group.procFaults) {
+        std::cout << "Falling back to /proc/" << pid << "/stat for page faults\n";
+        group.available[CNT_MINOR_FAULTS] = group.available[CNT_MAJOR_FAULTS] = group.statFd >= 0;
+    }
+    return true;
+}
+
+void closeCounters(CounterGroup& group) {
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        for (int fd : group.fds[c]) {
+            close(fd);
+        }
+        group.fds[c].clear();
+    }
+    if (group.statFd >= 0) close(group.statFd);
+    if (group.statmFd >= 0) close(group.statmFd);
+    group.statFd = group.statmFd = -1;
+}
+
+// Function to read cumulative counter values, scaled for multiplexing
+bool readCounters(const CounterGroup& group, uint64_t values[CNT_COUNT], uint64_t& rssKb, uint32_t& threads) {
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        values[c] = 0;
+        for (int fd : group.fds[c]) {
+            uint64_t buf[3];
+            if (read(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+                continue;
+            }
+            if (buf[2] != 0 && buf[2] < buf[1]) {
+                buf[0] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+            }
+            values[c] += buf[0];
+        }
+    }
+
+    char text[1024];
+    threads = 0;
+    if (group.statFd >= 0 && readProcFile(group.statFd, text, sizeof(text))) {
+        // minflt, majflt and num_threads are fields 10, 12 and 20; skip past "(comm)" first
+        const char* p = strrchr(text, ')');
+        unsigned long long minflt = 0, majflt = 0;
+        unsigned int numThreads = 0;
+        if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %llu %*u %llu %*u %*u %*u %*d %*d %*d %*d %u",
+                                &minflt, &majflt, &numThreads) != 3) {
+            return false;
+        }
+        if (group.procFaults) {
+            values[CNT_MINOR_FAULTS] = minflt;
+            values[CNT_MAJOR_FAULTS] = majflt;
+        }
+        threads = numThreads;
+    } else if (group.procFaults) {
+        return false;
+    }
+
+    rssKb = 0;
+    if (group.statmFd >= 0 && readProcFile(group.statmFd, text, sizeof(text))) {
+        unsigned long long pages = 0;
+        if (sscanf(text, "%*u %llu", &pages) == 1) {
+            rssKb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Working-set tracking: smaps_rollup gives resident, anonymous, huge-page and
+// swapped memory; the pages actually touched between two scans come from idle
+// page tracking (pagemap frames marked in /sys/kernel/mm/page_idle/bitmap) when
+// the kernel and our privileges allow it, else from clear_refs and Referenced.
+// Both clear accessed bits of the target, which its reclaim sees as well.
+// ---------------------------------------------------------------------------
+
+enum WsMethod {
+    WS_IDLE_BITMAP,  // mark every resident frame idle, count those touched since
+    WS_REFERENCED,   // clear the accessed bits, read Referenced back
+    WS_ROLLUP        // smaps_rollup only, no active working set
+};
+
+static const char* const wsMethodNames[] = {"idle page bitmap", "clear_refs + Referenced", "smaps_rollup only"};
+
+struct WorkingSetTracker {
+    pid_t pid;
+    WsMethod method;
+    int idleFd;
+    std::vector<uint64_t> pfns;    // idle method: frames marked at the last scan, sorted
+    std::vector<uint32_t> pages;   // pages each frame stands for (a THP head covers its tails)
+    bool armed;                    // the last scan marked or cleared something
+    uint64_t scanNs;               // time spent scanning, all scans
+    WorkingSet last;
+};
+
+// Function to choose the working-set method for a process
+void openWorkingSet(WorkingSetTracker& ws, pid_t pid) {
+    ws.pid = pid;
+    ws.armed = false;
+    ws.scanNs = 0;
+    ws.last = WorkingSet();
+    ws.idleFd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR | O_CLOEXEC);
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+    if (ws.idleFd >= 0) {
+        ws.method = WS_IDLE_BITMAP;
+    } else if (access(path, W_OK) == 0) {
+        ws.method = WS_REFERENCED;
+    } else {
+        ws.method = WS_ROLLUP;
+    }
+}
+
+void closeWorkingSet(WorkingSetTracker& ws) {
+    if (ws.idleFd >= 0) close(ws.idleFd);
+    ws.idleFd = -1;
+}
+
+// Function to pick "Key:  value kB" out of smaps_rollup
+static uint64_t rollupField(const char* text, const char* key) {
+    size_t len = strlen(key);
+    for (const char* p = strstr(text, key); p != NULL; p = strstr(p + 1, key)) {
+        if (p != text && p[-1] == '\n' && p[len] == ':') {
+            return strtoull(p + len + 1, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+// Function to collect the frames of every resident page of a process, sorted;
+// false when pagemap hides them (frame numbers need CAP_SYS_ADMIN)
+static bool residentFrames(pid_t pid, std::vector<uint64_t>& pfns) {
+    pfns.clear();
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    std::ifstream maps(path);
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (!maps || fd < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint64_t> entries(4096);
+    bool hidden = false;
+    std::string line;
+    while (std::getline(maps, line)) {
+        unsigned long long begin, end;
+        if (sscanf(line.c_str(), "%llx-%llx", &begin, &end) != 2 || line.find("[vsyscall]") != std::string::npos) {
+            continue;
+        }
+        for (uint64_t page = begin / pageSize; page < end / pageSize;) {
+            size_t n = std::min<uint64_t>(entries.size(), end / pageSize - page);
+            ssize_t len = pread(fd, entries.data(), n * sizeof(uint64_t), page * sizeof(uint64_t));
+            if (len <= 0) {
+                break;  // the mapping went away under us
+            }
+            for (size_t e = 0; e < (size_t)len / sizeof(uint64_t); ++e) {
+                if (!(entries[e] >> 63)) continue;  // not present
+                uint64_t pfn = entries[e] & ((1ull << 55) - 1);
+                if (pfn == 0) hidden = true;
+                else pfns.push_back(pfn);
+            }
+            page += len / sizeof(uint64_t);
+        }
+    }
+    close(fd);
+    std::sort(pfns.begin(), pfns.end());
+    pfns.erase(std::unique(pfns.begin(), pfns.end()), pfns.end());
+    return !hidden || !pfns.empty();
+}
+
+// Function to set (mark) or read the idle bits of sorted frames, one pread or
+// pwrite per run of nearby bitmap words; idle[i] receives frame i's bit
+static bool idleBits(int fd, const std::vector<uint64_t>& pfns, bool mark, std::vector<char>* idle) {
+    std::vector<uint64_t> words, values;
+    if (idle) idle->assign(pfns.size(), 0);
+    size_t i = 0;
+    while (i < pfns.size()) {
+        uint64_t first = pfns[i] / 64;
+        size_t runStart = i;
+        words.clear();
+        // Small gaps are bridged: writing zero bits changes nothing
+        while (i < pfns.size() && pfns[i] / 64 < first + 512 && pfns[i] / 64 <= first + words.size() + 8) {
+            size_t w = pfns[i] / 64 - first;
+            if (w >= words.size()) words.resize(w + 1, 0);
+            words[w] |= 1ull << (pfns[i] % 64);
+            ++i;
+        }
+        size_t bytes = words.size() * sizeof(uint64_t);
+        off_t offset = (off_t)(first * sizeof(uint64_t));
+        if (mark) {
+            if (pwrite(fd, words.data(), bytes, offset) != (ssize_t)bytes) return false;
+            continue;
+        }
+        values.assign(words.size(), 0);
+        if (pread(fd, values.data(), bytes, offset) != (ssize_t)bytes) return false;
+        if (idle) {
+            for (size_t f = runStart; f < i; ++f) {
+                (*idle)[f] = (values[pfns[f] / 64 - first] >> (pfns[f] % 64)) & 1;
+            }
+        }
+    }
+    return true;
+}
+
+// Function to count the pages touched since the last scan and mark the
+// resident ones idle for the next; frames that do not read back idle straight
+// after marking (THP tails, hugetlb and other non-LRU pages) are folded into
+// the frame before them, which is their head for a THP
+static bool scanIdlePages(WorkingSetTracker& ws, uint64_t& touchedPages) {
+    std::vector<char> idle;
+    touchedPages = 0;
+    if (ws.armed && idleBits(ws.idleFd, ws.pfns, false, &idle)) {
+        // a frame freed since the last scan reads as touched too
+        for (size_t f = 0; f < ws.pfns.size(); ++f) {
+            if (!idle[f]) touchedPages += ws.pages[f];
+        }
+    }
+    ws.armed = false;
+    std::vector<uint64_t> pfns;
+    if (!residentFrames(ws.pid, pfns) || !idleBits(ws.idleFd, pfns, true, NULL) ||
+        !idleBits(ws.idleFd, pfns, false, &idle)) {
+        return false;
+    }
+    ws.pfns.clear();
+    ws.pages.clear();
+    bool chained = false;  // the previous frame is tracked or folded into a tracked one
+    for (size_t f = 0; f < pfns.size(); ++f) {
+        if (idle[f]) {
+            ws.pfns.push_back(pfns[f]);
+            ws.pages.push_back(1);
+            chained = true;
+        } else if (chained && pfns[f] == pfns[f - 1] + 1) {
+            ++ws.pages.back();
+        } else {
+            chained = false;  // untrackable on its own
+        }
+    }
+    ws.armed = true;
+    return true;
+}
+
+// Function to take one working-set reading into ws.last
+bool scanWorkingSet(WorkingSetTracker& ws) {
+    uint64_t start = nowNs();
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", ws.pid);
+    // Opened per scan: the file binds to the address space it was opened on,
+    // and a launched target only gets its own at exec
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    char text[4096];
+    bool ok = fd >= 0 && readProcFile(fd, text, sizeof(text));
+    if (fd >= 0) close(fd);
+    if (!ok) {
+        return false;
+    }
+    WorkingSet& s = ws.last;
+    s.pssKb = rollupField(text, "Pss");
+    s.anonKb = rollupField(text, "Anonymous");
+    s.thpKb = rollupField(text, "AnonHugePages");
+    s.hugetlbKb = rollupField(text, "Shared_Hugetlb") + rollupField(text, "Private_Hugetlb");
+    s.swapKb = rollupField(text, "Swap");
+    ++s.scans;
+
+    if (ws.method == WS_IDLE_BITMAP) {
+        bool wasArmed = ws.armed;
+        uint64_t touched = 0;
+        if (!scanIdlePages(ws, touched)) {
+            std::cerr << "Idle page tracking failed, falling back to clear_refs\n";
+            ws.method = WS_REFERENCED;
+            ws.armed = false;
+        } else if (wasArmed) {
+            s.activeKb = touched * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+    }
+    if (ws.method == WS_REFERENCED) {
+        if (ws.armed) {
+            s.activeKb = rollupField(text, "Referenced");
+        }
+        snprintf(path, sizeof(path), "/proc/%d/clear_refs", ws.pid);
+        int clearFd = open(path, O_WRONLY | O_CLOEXEC);
+        ws.armed = clearFd >= 0 && write(clearFd, "1", 1) == 1;
+        if (clearFd >= 0) close(clearFd);
+    }
+    ws.scanNs += nowNs() - start;
+    return true;
+}
+
+// Function to write the time series as CSV
+bool writeCsv(const std::string& path, const CounterGroup& group, const std::vector<IntervalSample>& samples,
+              bool workingSet) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == NULL) {
+        std::cerr << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    fprintf(out, "time_ms");
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        fprintf(out, ",%s", counterDescs[c].name);
+    }
+    fprintf(out, ",ipc,rss_kb,threads");
+    if (workingSet) {
+        fprintf(out, ",pss_kb,anon_kb,thp_kb,hugetlb_kb,swap_kb,active_kb");
+    }
+    fprintf(out, "\n");
+    for (const IntervalSample& s : samples) {
+        fprintf(out, "%.3f", s.tNs / 1e6);
+        for (int c = 0; c < CNT_COUNT; ++c) {
+            if (group.available[c]) {
+                fprintf(out, ",%llu", (unsigned long long)s.delta[c]);
+            } else {
+                fprintf(out, ",");
+            }
+        }
+        if (group.available[CNT_CYCLES] && group.available[CNT_INSTRUCTIONS] && s.delta[CNT_CYCLES] != 0) {
+            fprintf(out, ",%.4f", (double)s.delta[CNT_INSTRUCTIONS] / s.delta[CNT_CYCLES]);
+        } else {
+            fprintf(out, ",");
+        }
+        fprintf(out, ",%llu,%u", (unsigned long long)s.rssKb, s.threads);
+        if (workingSet) {
+            fprintf(out, ",%llu,%llu,%llu,%llu,%llu,", (unsigned long long)s.ws.pssKb, (unsigned long long)s.ws.anonKb,
+                    (unsigned long long)s.ws.thpKb, (unsigned long long)s.ws.hugetlbKb,
+                    (unsigned long long)s.ws.swapKb);
+            if (s.ws.scans >= 2) fprintf(out, "%llu", (unsigned long long)s.ws.activeKb);
+        }
+        fprintf(out, "\n");
+    }
+    fclose(out);
+    return true;
+}
+
+// Function to write the time series in a compact binary form:
+// "CPR4" magic, u32 version, u32 counter count, u32 availability mask, u32 working-set flag,
+// u64 sample count, then NUL-terminated counter names, then per sample u64 t_ns, u64 deltas[count],
+// u64 rss_kb, u32 threads and u64 pss, anon, thp, hugetlb, swap, active kB and scan count
+bool writeBinary(const std::string& path, const CounterGroup& group, const std::vector<IntervalSample>& samples,
+                 bool workingSet) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (out == NULL) {
+        std::cerr << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    uint32_t header[4] = {3, CNT_COUNT, 0, workingSet};
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        if (group.available[c]) header[2] |= 1u << c;
+    }
+    uint64_t count = samples.size();
+    fwrite("CPR4", 1, 4, out);
+    fwrite(header, sizeof(header), 1, out);
+    fwrite(&count, sizeof(count), 1, out);
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        fwrite(counterDescs[c].name, 1, strlen(counterDescs[c].name) + 1, out);
+    }
+    for (const IntervalSample& s : samples) {
+        fwrite(&s.tNs, sizeof(s.tNs), 1, out);
+        fwrite(s.delta, sizeof(s.delta), 1, out);
+        fwrite(&s.rssKb, sizeof(s.rssKb), 1, out);
+        fwrite(&s.threads, sizeof(s.threads), 1, out);
+        fwrite(&s.ws, sizeof(s.ws), 1, out);
+    }
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+// Nearest-rank percentile of an unsorted series
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(p / 100.0 * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+static void printRateRow(const char* label, const std::vector<double>& rates) {
+    printf("  %-18s p50 %14.1f  p90 %14.1f  p99 %14.1f  max %14.1f\n", label,
+           percentile(rates, 50), percentile(rates, 90), percentile(rates, 99), percentile(rates, 100));
+}
+
+// Function to print totals, overall rates and per-interval percentiles
+void printSummary(const CounterGroup& group, const std::vector<IntervalSample>& samples, double runtime) {
+    uint64_t totals[CNT_COUNT] = {0};
+    uint64_t peakRss = 0;
+    uint32_t peakThreads = 0;
+    for (const IntervalSample& s : samples) {
+        for (int c = 0; c < CNT_COUNT; ++c) totals[c] += s.delta[c];
+        peakRss = std::max(peakRss, s.rssKb);
+        peakThreads = std::max(peakThreads, s.threads);
+    }
+
+    printf("Runtime: %.3f seconds, %zu intervals\n", runtime, samples.size());
+    for (int c = 0; c < CNT_COUNT; ++c) {
+        if (!group.available[c]) {
+            printf("  %-14s n/a\n", counterDescs[c].name);
+            continue;
+        }
+        printf("  %-14s %16llu  (%.1f/s)\n", counterDescs[c].name, (unsigned long long)totals[c],
+               runtime > 0 ? totals[c] / runtime : 0.0);
+    }
+    if (group.available[CNT_CYCLES] && group.available[CNT_INSTRUCTIONS] && totals[CNT_CYCLES]) {
+        printf("  IPC            %16.3f\n", (double)totals[CNT_INSTRUCTIONS] / totals[CNT_CYCLES]);
+    }
+    if (group.available[CNT_CACHE_REFS] && group.available[CNT_CACHE_MISSES] && totals[CNT_CACHE_REFS]) {
+        printf("  miss ratio     %15.2f%%\n", 100.0 * totals[CNT_CACHE_MISSES] / totals[CNT_CACHE_REFS]);
+    }
+    printf("  peak RSS       %13llu kB\n", (unsigned long long)peakRss);
+    printf("  peak threads   %16u\n", peakThreads);
+
+    if (samples.size() < 2) {
+        return;
+    }
+    std::vector<double> missRate, faultRate, ipc, rss;
+    uint64_t prevT = 0;
+    for (const IntervalSample& s : samples) {
+        double dt = (s.tNs - prevT) / 1e9;
+        prevT = s.tNs;
+        if (dt <= 0) continue;
+        missRate.push_back(s.delta[CNT_CACHE_MISSES] / dt);
+        faultRate.push_back((s.delta[CNT_MINOR_FAULTS] + s.delta[CNT_MAJOR_FAULTS]) / dt);
+        if (s.delta[CNT_CYCLES] != 0) ipc.push_back((double)s.delta[CNT_INSTRUCTIONS] / s.delta[CNT_CYCLES]);
+        rss.push_back((double)s.rssKb);
+    }
+    printf("Per-interval distribution:\n");
+    if (group.available[CNT_CACHE_MISSES]) printRateRow("cache misses/s", missRate);
+    if (group.available[CNT_MINOR_FAULTS]) printRateRow("page faults/s", faultRate);
+    if (!ipc.empty()) printRateRow("IPC", ipc);
+    printRateRow("RSS kB", rss);
+}
+
+// Function to print the working-set summary: sizes, huge-page coverage and fault rates
+void printWorkingSet(const WorkingSetTracker& ws, const CounterGroup& group, const std::vector<IntervalSample>& samples,
+                     long scanMs) {
+    uint64_t scans = samples.empty() ? 0 : samples.back().ws.scans;
+    printf("Working set (%s, every %ld ms, %llu scans, %.2f ms per scan):\n", wsMethodNames[ws.method], scanMs,
+           (unsigned long long)scans, scans ? ws.scanNs / 1e6 / scans : 0.0);
+    if (scans == 0) {
+        return;
+    }
+    // One entry per scan: the samples in between repeat the last scan, and
+    // counting them would weight each scan by how many intervals it covered.
+    // Fault rates are taken over the whole time since the previous scan
+    std::vector<double> active, rss, pss, anon, thpShare, minor, major;
+    uint64_t peakHugetlb = 0, peakSwap = 0;
+    uint64_t prevScanT = 0, prevScans = 0;
+    double minorFaults = 0, majorFaults = 0;
+    for (const IntervalSample& s : samples) {
+        minorFaults += s.delta[CNT_MINOR_FAULTS];
+        majorFaults += s.delta[CNT_MAJOR_FAULTS];
+        if (s.ws.scans == prevScans) continue;
+        prevScans = s.ws.scans;
+        double dt = (s.tNs - prevScanT) / 1e9;
+        prevScanT = s.tNs;
+        if (s.ws.scans >= 2 && ws.method != WS_ROLLUP) active.push_back((double)s.ws.activeKb);
+        rss.push_back((double)s.rssKb);
+        pss.push_back((double)s.ws.pssKb);
+        anon.push_back((double)s.ws.anonKb);
+        if (s.ws.anonKb) thpShare.push_back(100.0 * s.ws.thpKb / s.ws.anonKb);
+        if (dt > 0) {
+            minor.push_back(minorFaults / dt);
+            major.push_back(majorFaults / dt);
+        }
+        minorFaults = majorFaults = 0;
+        peakHugetlb = std::max(peakHugetlb, s.ws.hugetlbKb);
+        peakSwap = std::max(peakSwap, s.ws.swapKb);
+    }
+    if (!active.empty()) printRateRow("active kB", active);
+    printRateRow("RSS kB", rss);
+    printRateRow("PSS kB", pss);
+    printRateRow("anonymous kB", anon);
+    if (!thpShare.empty()) printRateRow("THP % of anon", thpShare);
+    if (group.available[CNT_MINOR_FAULTS]) printRateRow("minor faults/s", minor);
+    if (group.available[CNT_MAJOR_FAULTS]) printRateRow("major faults/s", major);
+    printf("  peak hugetlb   %13llu kB\n", (unsigned long long)peakHugetlb);
+    printf("  peak swap      %13llu kB\n", (unsigned long long)peakSwap);
+}
+
+// ---------------------------------------------------------------------------
+// Hotspot sampling: overflow samples of cycles and cache misses are collected
+// through perf ring buffers and attributed to functions and source lines.
+// ---------------------------------------------------------------------------
+
+enum SampleEventId {
+    SMP_CYCLES,
+    SMP_CACHE_MISSES,
+    SMP_INSTRUCTIONS,
+    SMP_COUNT
+};
+
+// Primary event per slot and the software event used when the PMU is missing
+static const CounterDesc sampleDescs[SMP_COUNT][2] = {
+    {{"cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+     {"cpu-clock",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK}},
+    {{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+     {"page-faults",  PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}},
+    {{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+     {NULL, 0, 0}},
+};
+
+static const unsigned HOTSPOT_EVENTS = (1u << SMP_CYCLES) | (1u << SMP_CACHE_MISSES);
+static const unsigned SYSTEM_EVENTS = HOTSPOT_EVENTS | (1u << SMP_INSTRUCTIONS);
+
+static const uint64_t SAMPLE_TYPE = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP | PERF_SAMPLE_TID |
+                                    PERF_SAMPLE_ADDR | PERF_SAMPLE_PERIOD;
+
+// A ring buffer shared by both sample events of one CPU (launch) or one thread (attach)
+struct SampleRing {
+    perf_event_mmap_page* meta;
+    char* data;
+    size_t dataSize;
+    size_t mapSize;
+};
+
+// Executable mapping of the target, from PERF_RECORD_MMAP or /proc/<pid>/maps
+struct Mapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t pgoff;
+    std::string path;
+};
+
+// Weighted event counts of one process in system-wide mode
+struct PidStats {
+    uint64_t weight[SMP_COUNT];
+};
+
+// Load/store samples that hit one 64-byte line, weighted by sample period
+struct LineStats {
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t hitm = 0;
+    uint64_t remote = 0;
+    uint64_t latency = 0;
+    std::vector<std::pair<uint32_t, uint64_t>> tidWords;  // tid -> bitmap of 8-byte words touched
+    std::unordered_map<uint64_t, uint64_t> ips;
+};
+
+enum SampleMode {
+    MODE_HOTSPOT,  // aggregate by IP and data line for one target
+    MODE_PER_PID,  // system-wide: aggregate by PID
+    MODE_C2C       // load/store data-source samples aggregated by cache line
+};
+
+struct SampleSession {
+    SampleMode mode;
+    std::vector<int> fds;
+    std::vector<SampleRing> rings;
+    std::unordered_map<uint64_t, int> eventById;
+    const char* eventName[SMP_COUNT];
+    bool available[SMP_COUNT];
+    std::vector<Mapping> mappings;
+    std::unordered_map<uint64_t, uint64_t> ipWeight[SMP_COUNT];
+    std::unordered_map<uint64_t, uint64_t> dataLineWeight[SMP_COUNT];
+    uint64_t totalWeight[SMP_COUNT];
+    uint64_t samples[SMP_COUNT];
+    std::unordered_map<uint32_t, PidStats> pidWeight;
+    std::unordered_map<uint64_t, LineStats> lines;
+    uint64_t lost;
+};
+
+struct ElfSymbol {
+    uint64_t addr;
+    uint64_t size;
+    std::string name;
+};
+
+// Symbols and load segments of one object file, used to turn runtime IPs into names
+struct ElfImage {
+    bool valid;
+    std::vector<ElfSymbol> symbols;
+    std::vector<ElfSymbol> objects;
+    std::vector<Elf64_Phdr> loads;
+};
+
+static int openSampleEvent(const CounterDesc& desc, uint64_t freq, pid_t pid, int cpu, unsigned long flags,
+                           bool launched, bool wantMmap, bool& precise) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = desc.type;
+    attr.config = desc.config;
+    attr.freq = 1;
+    attr.sample_freq = freq;
+    attr.sample_type = SAMPLE_TYPE;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.mmap = wantMmap;
+    attr.inherit = launched;
+    attr.disabled = launched;
+    attr.enable_on_exec = launched;
+
+    // Precise (PEBS/IBS) samples carry the data address; fall back to plain IP samples
+    for (int level = 2; level >= 0; --level) {
+        attr.precise_ip = level;
+        int fd = (int)perf_event_open(&attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC | flags);
+        if (fd >= 0) {
+            precise = level > 0;
+            return fd;
+        }
+        if (errno != EINVAL && errno != EOPNOTSUPP) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// Function to build the (pid, cpu) pairs to sample. A launched target gets per-CPU
+// inherited events (per-task inherited events cannot be mmapped); an attached one
+// gets per-thread events, so threads created after attaching are not sampled.
+// pid -1 on every CPU is system-wide; with PERF_FLAG_PID_CGROUP pid is a cgroup fd.
+std::vector<std::pair<pid_t, int>> sampleTargets(pid_t pid, const std::vector<pid_t>& tids, bool perCpu) {
+    std::vector<std::pair<pid_t, int>> targets;
+    if (perCpu) {
+        int nCpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+        for (int cpu = 0; cpu < nCpus; ++cpu) targets.push_back({pid, cpu});
+    } else {
+        for (pid_t tid : tids) targets.push_back({tid, -1});
+    }
+    return targets;
+}
+
+// Function to size each ring: unprivileged users share perf_event_mlock_kb
+// (516 kB by default) across all of them
+static size_t ringDataPages(size_t rings) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t budgetBytes = geteuid() == 0 ? 64 * 1024 * 1024 : 512 * 1024;
+    size_t budgetPages = budgetBytes / pageSize / std::max<size_t>(rings, 1);
+    size_t dataPages = 1;
+    while (dataPages * 2 + 1 <= budgetPages && dataPages < 256) dataPages *= 2;
+    return dataPages;
+}
+
+// Function to give the first event of a target its own ring buffer and redirect
+// the target's other events into it
+static bool addToRing(SampleSession& session, int fd, int event, int& leader, size_t dataPages) {
+    uint64_t id = 0;
+    ioctl(fd, PERF_EVENT_IOC_ID, &id);
+    session.eventById[id] = event;
+    session.fds.push_back(fd);
+
+    if (leader >= 0) {
+        if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, leader) != 0) {
+            std::cerr << "PERF_EVENT_IOC_SET_OUTPUT failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t mapSize = (dataPages + 1) * pageSize;
+    void* mem = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "mmap of sample buffer failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    SampleRing ring;
+    ring.meta = (perf_event_mmap_page*)mem;
+    ring.data = (char*)mem + pageSize;
+    ring.dataSize = dataPages * pageSize;
+    ring.mapSize = mapSize;
+    session.rings.push_back(ring);
+    leader = fd;
+    return true;
+}
+
+// Function to open the sample events in eventMask and one ring buffer per target
+bool openSampling(SampleSession& session, const std::vector<std::pair<pid_t, int>>& targets,
+                  unsigned long flags, bool launched, uint64_t freq, unsigned eventMask) {
+    session.lost = 0;
+    size_t dataPages = ringDataPages(targets.size());
+
+    for (int e = 0; e < SMP_COUNT; ++e) {
+        session.available[e] = false;
+        session.eventName[e] = sampleDescs[e][0].name;
+        session.totalWeight[e] = session.samples[e] = 0;
+    }
+
+    for (const auto& target : targets) {
+        int leader = -1;
+        for (int e = 0; e < SMP_COUNT; ++e) {
+            if (!(eventMask & (1u << e))) continue;
+            int fd = -1;
+            bool precise = false;
+            for (int alt = 0; alt < 2 && fd < 0 && sampleDescs[e][alt].name != NULL; ++alt) {
+                if (session.available[e] && session.eventName[e] != sampleDescs[e][alt].name) {
+                    continue;  // keep every ring on the same event choice
+                }
+                fd = openSampleEvent(sampleDescs[e][alt], freq, target.first, target.second, flags,
+                                     launched, leader < 0, precise);
+                if (fd >= 0) session.eventName[e] = sampleDescs[e][alt].name;
+            }
+            if (fd < 0) {
+                if (errno == ESRCH) break;
+                if (errno == EACCES || errno == EPERM) {
+                    std::cerr << "Sampling " << sampleDescs[e][0].name << " not permitted: "
+                              << strerror(errno) << " (see /proc/sys/kernel/perf_event_paranoid)\n";
+                    return false;
+                }
+                continue;
+            }
+            if (!session.available[e] && precise) {
+                std::cout << "Sampling " << session.eventName[e] << " with precise data addresses\n";
+            }
+            session.available[e] = true;
+            if (!addToRing(session, fd, e, leader, dataPages)) {
+                return false;
+            }
+        }
+    }
+
+    if (!session.available[SMP_CYCLES] && !session.available[SMP_CACHE_MISSES]) {
+        std::cerr << "No sampling events available\n";
+        return false;
+    }
+    return true;
+}
+
+void closeSampling(SampleSession& session) {
+    for (const SampleRing& ring : session.rings) munmap(ring.meta, ring.mapSize);
+    for (int fd : session.fds) close(fd);
+    session.rings.clear();
+    session.fds.clear();
+}
+
+// Function to record the mappings of an attached process (executable ones unless withData)
+void readMappings(SampleSession& session, pid_t pid, bool withData) {
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        unsigned long long start, end, pgoff;
+        char perms[8];
+        int pathPos = 0;
+        if (sscanf(line.c_str(), "%llx-%llx %7s %llx %*s %*u %n", &start, &end, perms, &pgoff, &pathPos) < 4 ||
+            (perms[2] != 'x' && !withData) || pathPos == 0) {
+            continue;
+        }
+        session.mappings.push_back({start, end, pgoff, line.substr(pathPos)});
+    }
+}
+
+static void recordC2cSample(SampleSession& session, int e, const uint64_t* p);
+
+static void handleRecord(SampleSession& session, const perf_event_header* hdr) {
+    const uint64_t* p = (const uint64_t*)(hdr + 1);
+    if (hdr->type == PERF_RECORD_SAMPLE) {
+        uint64_t id = p[0], ip = p[1], addr = p[3], period = p[4];
+        auto it = session.eventById.find(id);
+        if (it == session.eventById.end()) return;
+        int e = it->second;
+        if (session.mode == MODE_PER_PID) {
+            uint32_t pid = (uint32_t)p[2];
+            if (pid != 0) session.pidWeight[pid].weight[e] += period;  // pid 0 is the idle task
+        } else if (session.mode == MODE_C2C) {
+            recordC2cSample(session, e, p);
+        } else {
+            session.ipWeight[e][ip] += period;
+            if (addr != 0) session.dataLineWeight[e][addr & ~63ull] += period;
+        }
+        session.totalWeight[e] += period;
+        session.samples[e]++;
+    } else if (hdr->type == PERF_RECORD_MMAP) {
+        // u32 pid, tid; u64 addr, len, pgoff; char filename[]
+        const char* body = (const char*)(hdr + 1);
+        uint64_t addr, len, pgoff;
+        memcpy(&addr, body + 8, 8);
+        memcpy(&len, body + 16, 8);
+        memcpy(&pgoff, body + 24, 8);
+        session.mappings.push_back({addr, addr + len, pgoff, std::string(body + 32)});
+    } else if (hdr->type == PERF_RECORD_LOST) {
+        session.lost += p[1];
+    }
+}
+
+// Function to consume every complete record currently in the ring buffers
+void drainSampling(SampleSession& session) {
+    std::vector<char> record;
+    for (SampleRing& ring : session.rings) {
+        uint64_t head = __atomic_load_n(&ring.meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring.meta->data_tail;
+        while (tail < head) {
+            size_t offset = tail % ring.dataSize;
+            perf_event_header hdr;
+            // Records can wrap around the end of the buffer, so copy them out piecewise
+            size_t first = std::min(sizeof(hdr), ring.dataSize - offset);
+            memcpy(&hdr, ring.data + offset, first);
+            memcpy((char*)&hdr + first, ring.data, sizeof(hdr) - first);
+            if (hdr.size == 0) break;
+            record.resize(hdr.size);
+            first = std::min((size_t)hdr.size, ring.dataSize - offset);
+            memcpy(record.data(), ring.data + offset, first);
+            memcpy(record.data() + first, ring.data, hdr.size - first);
+            handleRecord(session, (const perf_event_header*)record.data());
+            tail += hdr.size;
+        }
+        __atomic_store_n(&ring.meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+// Function to load function symbols and PT_LOAD segments of an ELF file
+bool loadElfImage(const std::string& path, ElfImage& image) {
+    image.valid = false;
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.size() < sizeof(Elf64_Ehdr) || memcmp(bytes.data(), ELFMAG, SELFMAG) != 0 ||
+        bytes[EI_CLASS] != ELFCLASS64) {
+        return false;
+    }
+    const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)bytes.data();
+    if (ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > bytes.size() ||
+        ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > bytes.size()) {
+        return false;
+    }
+    const Elf64_Phdr* phdrs = (const Elf64_Phdr*)(bytes.data() + ehdr->e_phoff);
+    for (int i = 0; i < ehdr->e_phnum; ++i) {
+        if (phdrs[i].p_type == PT_LOAD) image.loads.push_back(phdrs[i]);
+    }
+
+    // Prefer the full symbol table; stripped objects still have the dynamic one
+    const Elf64_Shdr* shdrs = (const Elf64_Shdr*)(bytes.data() + ehdr->e_shoff);
+    for (uint32_t wanted : {(uint32_t)SHT_SYMTAB, (uint32_t)SHT_DYNSYM}) {
+        for (int i = 0; i < ehdr->e_shnum && image.symbols.empty(); ++i) {
+            const Elf64_Shdr& sh = shdrs[i];
+            if (sh.sh_type != wanted || sh.sh_link >= ehdr->e_shnum) continue;
+            const Elf64_Shdr& strSh = shdrs[sh.sh_link];
+            if (sh.sh_offset + sh.sh_size > bytes.size() || strSh.sh_offset + strSh.sh_size > bytes.size()) continue;
+            const Elf64_Sym* syms = (const Elf64_Sym*)(bytes.data() + sh.sh_offset);
+            const char* strtab = bytes.data() + strSh.sh_offset;
+            for (size_t s = 0; s < sh.sh_size / sizeof(Elf64_Sym); ++s) {
+                int type = ELF64_ST_TYPE(syms[s].st_info);
+                if ((type != STT_FUNC && type != STT_OBJECT) || syms[s].st_value == 0 ||
+                    syms[s].st_name >= strSh.sh_size) {
+                    continue;
+                }
+                const char* name = strtab + syms[s].st_name;
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+                std::vector<ElfSymbol>& list = type == STT_FUNC ? image.symbols : image.objects;
+                list.push_back({syms[s].st_value, syms[s].st_size, status == 0 ? demangled : name});
+                free(demangled);
+            }
+        }
+    }
+    auto byAddr = [](const ElfSymbol& a, const ElfSymbol& b) { return a.addr < b.addr; };
+    std::sort(image.symbols.begin(), image.symbols.end(), byAddr);
+    std::sort(image.objects.begin(), image.objects.end(), byAddr);
+    image.valid = true;
+    return true;
+}
+
+static const ElfSymbol* findSymbol(const std::vector<ElfSymbol>& symbols, uint64_t vaddr) {
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), vaddr,
+                               [](uint64_t v, const ElfSymbol& s) { return v < s.addr; });
+    if (it == symbols.begin()) return NULL;
+    --it;
+    if (it->size != 0 && vaddr >= it->addr + it->size) return NULL;
+    return &*it;
+}
+
+// Function to turn a runtime address inside a file mapping into the link-time address
+static uint64_t toLinkAddress(const ElfImage& image, const Mapping& map, uint64_t addr) {
+    uint64_t offset = addr - map.start + map.pgoff;
+    for (const Elf64_Phdr& ph : image.loads) {
+        if (offset >= ph.p_offset && offset < ph.p_offset + ph.p_filesz) {
+            return offset - ph.p_offset + ph.p_vaddr;
+        }
+    }
+    return offset;
+}
+
+static const Mapping* findMapping(const SampleSession& session, uint64_t addr) {
+    // Later mappings win: the loader may remap a range after the first mmap
+    for (auto it = session.mappings.rbegin(); it != session.mappings.rend(); ++it) {
+        if (addr >= it->start && addr < it->end) return &*it;
+    }
+    return NULL;
+}
+
+// Function to describe a code address as "function  (object)"
+static std::string codeLocation(const SampleSession& session, uint64_t ip, std::map<std::string, ElfImage>& images) {
+    const Mapping* map = findMapping(session, ip);
+    if (map == NULL || map->path.empty() || map->path[0] == '[') {
+        return map ? map->path : "[unknown]";
+    }
+    ElfImage& image = images[map->path];
+    if (!image.valid && image.loads.empty()) loadElfImage(map->path, image);
+    const ElfSymbol* sym = findSymbol(image.symbols, toLinkAddress(image, *map, ip));
+    std::string object = map->path.substr(map->path.rfind('/') + 1);
+    return (sym ? sym->name : "[unknown]") + "  (" + object + ")";
+}
+
+// Function to run addr2line on a batch of addresses with an argv array, so
+// no shell ever sees the binary's path; returns its stdout or NULL
+static FILE* spawnAddr2line(const std::string& path, const std::vector<std::string>& addrs, pid_t& child) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return NULL;
+    }
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("addr2line"));
+    argv.push_back(const_cast<char*>("-e"));
+    argv.push_back(const_cast<char*>(path.c_str()));
+    for (const std::string& a : addrs) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(NULL);
+    child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (child == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) dup2(devNull, STDERR_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE* out = fdopen(fds[0], "r");
+    if (out == NULL) {
+        close(fds[0]);
+        waitpid(child, NULL, 0);
+    }
+    return out;
+}
+
+// Function to resolve file:line for a batch of link-time addresses with addr2line
+std::vector<std::string> resolveLines(const std::string& path, const std::vector<uint64_t>& vaddrs) {
+    std::vector<std::string> lines;
+    const size_t chunk = 256;
+    for (size_t base = 0; base < vaddrs.size(); base += chunk) {
+        std::vector<std::string> addrs;
+        size_t end = std::min(vaddrs.size(), base + chunk);
+        for (size_t i = base; i < end; ++i) {
+            char hex[24];
+            snprintf(hex, sizeof(hex), "%llx", (unsigned long long)vaddrs[i]);
+            addrs.push_back(hex);
+        }
+        pid_t child = -1;
+        FILE* pipe = spawnAddr2line(path, addrs, child);
+        char buf[4096];
+        size_t got = base;
+        while (pipe != NULL && got < end && fgets(buf, sizeof(buf), pipe)) {
+            std::string line(buf);
+            line = line.substr(0, line.find_first_of(" \n"));
+            size_t slash = line.rfind('/');
+            lines.push_back(slash == std::string::npos ? line : line.substr(slash + 1));
+            got++;
+        }
+        if (pipe != NULL) {
+            fclose(pipe);
+            waitpid(child, NULL, 0);
+        }
+        for (; got < end; ++got) lines.push_back("??:0");
+    }
+    return lines;
+}
+
+static void printTopTable(const char* title, std::unordered_map<std::string, uint64_t>& weights,
+                          uint64_t total, size_t limit) {
+    std::vector<std::pair<std::string, uint64_t>> rows(weights.begin(), weights.end());
+    std::sort(rows.begin(), rows.end(),
+              [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+                  return a.second > b.second;
+              });
+    printf("  %s\n", title);
+    for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+        printf("    %6.2f%%  %s\n", total ? 100.0 * rows[i].second / total : 0.0, rows[i].first.c_str());
+    }
+}
+
+// Function to print per-function and per-source-line hotspot tables for each event
+void printHotspots(SampleSession& session, size_t limit) {
+    std::map<std::string, ElfImage> images;
+    for (int e = 0; e < SMP_COUNT; ++e) {
+        if (!session.available[e]) continue;
+        printf("\nHotspots for %s (%llu samples, %llu events, %llu lost records):\n", session.eventName[e],
+               (unsigned long long)session.samples[e], (unsigned long long)session.totalWeight[e],
+               (unsigned long long)session.lost);
+
+        std::unordered_map<std::string, uint64_t> byFunction, byLine, byRegion;
+        std::map<std::string, std::vector<std::pair<uint64_t, uint64_t>>> lineQueries;  // path -> (vaddr, weight)
+        for (const auto& entry : session.ipWeight[e]) {
+            uint64_t ip = entry.first;
+            byFunction[codeLocation(session, ip, images)] += entry.second;
+            const Mapping* map = findMapping(session, ip);
+            if (map != NULL && !map->path.empty() && map->path[0] != '[') {
+                lineQueries[map->path].push_back({toLinkAddress(images[map->path], *map, ip), entry.second});
+            }
+        }
+        for (auto& query : lineQueries) {
+            // Symbolise only the heaviest addresses; the tail barely moves the table
+            auto& list = query.second;
+            std::sort(list.begin(), list.end(),
+                      [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
+                          return a.second > b.second;
+                      });
+            if (list.size() > 2048) list.resize(2048);
+            std::vector<uint64_t> vaddrs;
+            for (const auto& item : list) vaddrs.push_back(item.first);
+            std::vector<std::string> lines = resolveLines(query.first, vaddrs);
+            for (size_t i = 0; i < list.size(); ++i) byLine[lines[i]] += list[i].second;
+        }
+        for (const auto& entry : session.dataLineWeight[e]) {
+            const Mapping* map = findMapping(session, entry.first);
+            byRegion[map && !map->path.empty() ? map->path : "[anon]"] += entry.second;
+        }
+
+        printTopTable("Functions:", byFunction, session.totalWeight[e], limit);
+        printTopTable("Source lines:", byLine, session.totalWeight[e], limit);
+        if (!byRegion.empty()) {
+            printf("  %zu distinct data cache lines sampled\n", session.dataLineWeight[e].size());
+            printTopTable("Data regions:", byRegion, session.totalWeight[e], limit);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// c2c mode: precise load/store samples with data source are grouped by cache
+// line to find lines bounced between threads (HITM) and false sharing.
+// ---------------------------------------------------------------------------
+
+enum C2cEventId {
+    C2C_LOADS,
+    C2C_STORES
+};
+
+static const uint64_t C2C_SAMPLE_TYPE = SAMPLE_TYPE | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
+
+// Function to read a one-line sysfs file
+static std::string readSysfs(const std::string& path) {
+    std::ifstream file(path);
+    std::string text;
+    std::getline(file, text);
+    return text;
+}
+
+// Function to place a value into the config bits named by a sysfs format spec ("config1:0-15")
+static bool setFormatField(perf_event_attr& attr, const std::string& spec, uint64_t value) {
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos) return false;
+    std::string reg = spec.substr(0, colon);
+    __u64* target = reg == "config" ? &attr.config : reg == "config1" ? &attr.config1 :
+                       reg == "config2" ? &attr.config2 : NULL;
+    if (target == NULL) return false;
+    std::istringstream ranges(spec.substr(colon + 1));
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int lo = 0, hi = 0;
+        if (sscanf(range.c_str(), "%d-%d", &lo, &hi) != 2) hi = lo = atoi(range.c_str());
+        for (int bit = lo; bit <= hi; ++bit, value >>= 1) {
+            if (value & 1) *target |= 1ull << bit;
+        }
+    }
+    return true;
+}
+
+// Function to build a raw PMU event from its sysfs alias; on Intel mem-loads is
+// "event=0xcd,umask=0x1,ldlat=3" laid out according to .../format/<field>
+static bool sysfsEvent(const std::string& name, perf_event_attr& attr) {
+    for (const char* pmu : {"cpu", "cpu_core"}) {
+        std::string dir = std::string("/sys/bus/event_source/devices/") + pmu;
+        std::string alias = readSysfs(dir + "/events/" + name);
+        if (alias.empty()) continue;
+
+        attr.type = (uint32_t)strtoul(readSysfs(dir + "/type").c_str(), NULL, 10);
+        std::istringstream terms(alias);
+        std::string term;
+        while (std::getline(terms, term, ',')) {
+            size_t eq = term.find('=');
+            std::string field = term.substr(0, eq);
+            uint64_t value = eq == std::string::npos ? 1 : strtoull(term.c_str() + eq + 1, NULL, 0);
+            if (field == "ldlat") value = 30;  // only loads slower than an L1/L2 hit, as perf c2c does
+            if (!setFormatField(attr, readSysfs(dir + "/format/" + field), value)) return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Function to open mem-loads/mem-stores sampling with data source on every target
+bool openC2c(SampleSession& session, const std::vector<std::pair<pid_t, int>>& targets,
+             bool launched, uint64_t freq) {
+    const char* names[2] = {"mem-loads", "mem-stores"};
+    perf_event_attr attrs[2];
+    for (int e = 0; e < 2; ++e) {
+        memset(&attrs[e], 0, sizeof(attrs[e]));
+        attrs[e].size = sizeof(attrs[e]);
+        session.eventName[e] = names[e];
+        session.available[e] = sysfsEvent(names[e], attrs[e]);
+        attrs[e].freq = 1;
+        attrs[e].sample_freq = freq;
+        attrs[e].sample_type = C2C_SAMPLE_TYPE;
+        attrs[e].exclude_kernel = 1;
+        attrs[e].exclude_hv = 1;
+        attrs[e].inherit = launched;
+        attrs[e].disabled = launched;
+        attrs[e].enable_on_exec = launched;
+    }
+    session.available[SMP_INSTRUCTIONS] = false;
+    if (!session.available[C2C_LOADS] && !session.available[C2C_STORES]) {
+        std::cerr << "This CPU exposes no mem-loads/mem-stores events (Intel PEBS) for c2c sampling.\n"
+                  << "Use the instrumented write tracer instead: l2_b3 --trace-writes\n";
+        return false;
+    }
+
+    session.lost = 0;
+    size_t dataPages = ringDataPages(targets.size());
+    for (const auto& target : targets) {
+        int leader = -1;
+        for (int e = 0; e < 2; ++e) {
+            if (!session.available[e]) continue;
+            attrs[e].mmap = attrs[e].mmap_data = leader < 0;
+            int fd = -1;
+            for (int level = 3; level >= 1 && fd < 0; --level) {
+                attrs[e].precise_ip = level;
+                fd = (int)perf_event_open(&attrs[e], target.first, target.second, -1, PERF_FLAG_FD_CLOEXEC);
+            }
+            if (fd < 0) {
+                if (errno == ESRCH) break;
+                std::cerr << names[e] << " unavailable: " << strerror(errno) << std::endl;
+                session.available[e] = false;
+                continue;
+            }
+            if (!addToRing(session, fd, e, leader, dataPages)) return false;
+        }
+    }
+    return session.available[C2C_LOADS] || session.available[C2C_STORES];
+}
+
+static void recordC2cSample(SampleSession& session, int e, const uint64_t* p) {
+    uint64_t ip = p[1], addr = p[3], period = p[4], weight = p[5];
+    uint32_t tid = (uint32_t)(p[2] >> 32);
+    perf_mem_data_src src;
+    src.val = p[6];
+    if (addr == 0) return;
+
+    LineStats& line = session.lines[addr & ~63ull];
+    if (e == C2C_LOADS) {
+        line.loads += period;
+        line.latency += weight * period;
+    } else {
+        line.stores += period;
+    }
+    // HITM: the load was served from another core's modified copy of the line
+    if (src.mem_snoop & PERF_MEM_SNOOP_HITM) line.hitm += period;
+    if (src.mem_remote || (src.mem_lvl & (PERF_MEM_LVL_REM_CCE1 | PERF_MEM_LVL_REM_CCE2))) line.remote += period;
+
+    uint64_t word = 1ull << ((addr & 63) / 8);
+    bool seen = false;
+    for (auto& entry : line.tidWords) {
+        if (entry.first == tid) { entry.second |= word; seen = true; break; }
+    }
+    if (!seen) line.tidWords.push_back({tid, word});
+    line.ips[ip] += period;
+}
+
+// Function to name the data structure owning an address: first the objects file a
+// target may publish (/tmp/cpr4-<pid>.objects: "start size name" in hex), then ELF
+// data symbols of the mapped object, then the mapping itself
+static std::string dataOwner(SampleSession& session, uint64_t addr,
+                             const std::vector<ElfSymbol>& published, std::map<std::string, ElfImage>& images) {
+    for (const ElfSymbol& obj : published) {
+        if (addr >= obj.addr && addr < obj.addr + obj.size) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "+0x%llx", (unsigned long long)(addr - obj.addr));
+            return obj.name + buf;
+        }
+    }
+    for (auto it = session.mappings.rbegin(); it != session.mappings.rend(); ++it) {
+        if (addr < it->start || addr >= it->end) continue;
+        if (it->path.empty()) return "[anon]";
+        if (it->path[0] == '[') return it->path;
+        ElfImage& image = images[it->path];
+        if (!image.valid && image.loads.empty()) loadElfImage(it->path, image);
+        const ElfSymbol* sym = findSymbol(image.objects, toLinkAddress(image, *it, addr));
+        std::string object = it->path.substr(it->path.rfind('/') + 1);
+        return sym ? sym->name + " (" + object + ")" : object;
+    }
+    return "[unknown]";
+}
+
+// Function to print the most contended cache lines with their owners
+void printC2c(SampleSession& session, pid_t pid, size_t limit) {
+    std::vector<ElfSymbol> published;
+    std::ifstream objects("/tmp/cpr4-" + std::to_string(pid) + ".objects");
+    unsigned long long start, size;
+    std::string name;
+    while (objects >> std::hex >> start >> size >> name) published.push_back({start, size, name});
+
+    std::vector<std::pair<uint64_t, const LineStats*>> rows;
+    for (const auto& entry : session.lines) {
+        if (entry.second.tidWords.size() > 1 || entry.second.hitm > 0) rows.push_back({entry.first, &entry.second});
+    }
+    std::sort(rows.begin(), rows.end(),
+              [](const std::pair<uint64_t, const LineStats*>& a, const std::pair<uint64_t, const LineStats*>& b) {
+                  if (a.second->hitm != b.second->hitm) return a.second->hitm > b.second->hitm;
+                  return a.second->stores > b.second->stores;
+              });
+
+    std::map<std::string, ElfImage> images;
+    printf("\nShared cache lines (%zu of %zu sampled lines touched by several threads or hit in modified state, "
+           "%llu lost records):\n", rows.size(), session.lines.size(), (unsigned long long)session.lost);
+    printf("%18s %10s %10s %10s %10s %8s %4s  %-5s  %s\n", "line", "HITM", "remote", "loads", "stores",
+           "avg lat", "thr", "kind", "owner / hottest code");
+    for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+        const LineStats& line = *rows[i].second;
+        // False sharing: threads touch the line but never the same 8-byte word
+        bool overlap = false;
+        uint64_t seen = 0;
+        for (const auto& tw : line.tidWords) {
+            if (seen & tw.second) overlap = true;
+            seen |= tw.second;
+        }
+        uint64_t hotIp = 0, hotWeight = 0;
+        for (const auto& ip : line.ips) {
+            if (ip.second > hotWeight) { hotIp = ip.first; hotWeight = ip.second; }
+        }
+        printf("0x%016llx %10llu %10llu %10llu %10llu %8.0f %4zu  %-5s  %s\n", (unsigned long long)rows[i].first,
+               (unsigned long long)line.hitm, (unsigned long long)line.remote, (unsigned long long)line.loads,
+               (unsigned long long)line.stores, line.loads ? (double)line.latency / line.loads : 0.0,
+               line.tidWords.size(), line.tidWords.size() < 2 ? "" : overlap ? "true" : "false",
+               dataOwner(session, rows[i].first, published, images).c_str());
+        printf("%18s %s\n", "", codeLocation(session, hotIp, images).c_str());
+    }
+}
+
+// Function to look up a process name, cached because PIDs repeat every refresh
+static const std::string& processNameOf(uint32_t pid, std::unordered_map<uint32_t, std::string>& cache) {
+    auto it = cache.find(pid);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    std::ifstream comm("/proc/" + std::to_string(pid) + "/comm");
+    std::string name;
+    if (!std::getline(comm, name)) {
+        name = "[exited]";
+    }
+    return cache[pid] = name;
+}
+
+// Function to print one top-style table of per-PID rates over dt seconds
+static void printPidTable(const SampleSession& session, const std::unordered_map<uint32_t, PidStats>& weights,
+                          double dt, const std::string& nameFilter,
+                          std::unordered_map<uint32_t, std::string>& names, size_t limit) {
+    bool cycles = strcmp(session.eventName[SMP_CYCLES], "cycles") == 0;
+    bool misses = strcmp(session.eventName[SMP_CACHE_MISSES], "cache-misses") == 0;
+    bool ipc = cycles && session.available[SMP_INSTRUCTIONS];
+
+    std::vector<std::pair<uint32_t, PidStats>> rows;
+    for (const auto& entry : weights) {
+        if (!nameFilter.empty() && strcasestr(processNameOf(entry.first, names).c_str(), nameFilter.c_str()) == NULL) {
+            continue;
+        }
+        rows.push_back(entry);
+    }
+    // Noisy neighbours first: order by cache misses, then by CPU time
+    std::sort(rows.begin(), rows.end(),
+              [](const std::pair<uint32_t, PidStats>& a, const std::pair<uint32_t, PidStats>& b) {
+                  if (a.second.weight[SMP_CACHE_MISSES] != b.second.weight[SMP_CACHE_MISSES])
+                      return a.second.weight[SMP_CACHE_MISSES] > b.second.weight[SMP_CACHE_MISSES];
+                  return a.second.weight[SMP_CYCLES] > b.second.weight[SMP_CYCLES];
+              });
+
+    printf("%8s  %-16s %12s %7s %14s %10s\n", "PID", "NAME", cycles ? "Mcycles/s" : "CPU%",
+           ipc ? "IPC" : "", misses ? "misses/s" : "faults/s", misses ? "MB/s" : "");
+    for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+        const uint64_t* w = rows[i].second.weight;
+        printf("%8u  %-16.16s", rows[i].first, processNameOf(rows[i].first, names).c_str());
+        if (cycles) {
+            printf(" %12.1f", w[SMP_CYCLES] / dt / 1e6);
+        } else {
+            printf(" %12.1f", w[SMP_CYCLES] / dt / 1e9 * 100.0);  // cpu-clock weights are nanoseconds
+        }
+        if (ipc && w[SMP_CYCLES] != 0) {
+            printf(" %7.2f", (double)w[SMP_INSTRUCTIONS] / w[SMP_CYCLES]);
+        } else {
+            printf(" %7s", "");
+        }
+        printf(" %14.0f", w[SMP_CACHE_MISSES] / dt);
+        if (misses) {
+            // Every last-level miss fills one 64-byte line from memory
+            printf(" %10.1f", w[SMP_CACHE_MISSES] * 64.0 / dt / (1 << 20));
+        }
+        printf("\n");
+    }
+}
+
+// Function to run the system-wide per-PID view until Ctrl+C or the duration elapses
+int runSystemWide(long refreshMs, uint64_t freq, double durationSec, const std::string& cgroup,
+                  const std::string& nameFilter) {
+    pid_t target = -1;
+    unsigned long flags = 0;
+    int cgroupFd = -1;
+    if (!cgroup.empty()) {
+        // Let the kernel do the cgroup filtering: pid becomes a cgroup directory fd
+        std::string path = cgroup[0] == '/' ? cgroup : "/sys/fs/cgroup/" + cgroup;
+        cgroupFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (cgroupFd < 0) {
+            std::cerr << "Cannot open cgroup " << path << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        target = cgroupFd;
+        flags = PERF_FLAG_PID_CGROUP;
+    }
+
+    SampleSession session;
+    session.mode = MODE_PER_PID;
+    if (!openSampling(session, sampleTargets(target, std::vector<pid_t>(), true), flags, false, freq,
+                      SYSTEM_EVENTS)) {
+        std::cerr << "System-wide sampling needs perf_event_paranoid <= 0 or CAP_PERFMON\n";
+        closeSampling(session);
+        if (cgroupFd >= 0) close(cgroupFd);
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    bool tty = isatty(STDOUT_FILENO);
+    std::unordered_map<uint32_t, std::string> names;
+    std::unordered_map<uint32_t, PidStats> totals;
+
+    uint64_t startNs = nowNs();
+    uint64_t lastRefresh = startNs;
+    while (!stopRequested) {
+        // Drain often so busy CPUs do not overflow their rings between refreshes
+        usleep(10000);
+        drainSampling(session);
+        uint64_t now = nowNs();
+        if (durationSec > 0 && (now - startNs) / 1e9 >= durationSec) {
+            break;
+        }
+        if (now - lastRefresh < (uint64_t)refreshMs * 1000000ull) {
+            continue;
+        }
+        double dt = (now - lastRefresh) / 1e9;
+        lastRefresh = now;
+
+        if (tty) printf("\033[H\033[2J");
+        printf("cpr4 system-wide: %s / %s%s, %.1f s, %llu lost records\n", session.eventName[SMP_CYCLES],
+               session.eventName[SMP_CACHE_MISSES], session.available[SMP_INSTRUCTIONS] ? " / instructions" : "",
+               (now - startNs) / 1e9, (unsigned long long)session.lost);
+        printPidTable(session, session.pidWeight, dt, nameFilter, names, tty ? 25 : 10);
+        printf("\n");
+        fflush(stdout);
+
+        for (const auto& entry : session.pidWeight) {
+            for (int e = 0; e < SMP_COUNT; ++e) totals[entry.first].weight[e] += entry.second.weight[e];
+        }
+        session.pidWeight.clear();
+        names.clear();  // PIDs get reused; names are re-read next refresh
+    }
+
+    drainSampling(session);
+    for (const auto& entry : session.pidWeight) {
+        for (int e = 0; e < SMP_COUNT; ++e) totals[entry.first].weight[e] += entry.second.weight[e];
+    }
+    double runtime = (nowNs() - startNs) / 1e9;
+    printf("\nAverage rates over %.1f seconds:\n", runtime);
+    printPidTable(session, totals, runtime, nameFilter, names, 25);
+
+    closeSampling(session);
+    if (cgroupFd >= 0) close(cgroupFd);
+    return 0;
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-i interval_ms] [-o file] [-f csv|bin] [-s] [-F freq] [-w scan_ms] [-p pid | process_name]\n"
+              << "       " << prog << " [-i interval_ms] [-o file] [-f csv|bin] [-s] [-F freq] [-w scan_ms] -- command [args...]\n"
+              << "       " << prog << " -a [-i refresh_ms] [-F freq] [-d seconds] [-g cgroup] [name_filter]\n"
+              << "       " << prog << " -c [-F freq] [-p pid | process_name | -- command [args...]]\n"
+              << "  -i  sampling interval in milliseconds (default 100, minimum 1; -a refresh default 1000)\n"
+              << "  -o  write the per-interval time series to file\n"
+              << "  -f  time series format: csv (default) or bin\n"
+              << "  -s  sample cycles and cache misses and print function/line hotspots\n"
+              << "  -F  sampling frequency in Hz for -s and -a (default 1000)\n"
+              << "  -a  system-wide per-PID cache miss, bandwidth and IPC rates (needs privileges)\n"
+              << "  -d  stop the system-wide view after this many seconds\n"
+              << "  -g  restrict -a to a cgroup (path below /sys/fs/cgroup or absolute)\n"
+              << "  -c  sample loads/stores with data source and report contended cache lines (c2c)\n"
+              << "  -w  scan the working set every scan_ms: active pages, PSS, THP/hugetlb coverage, fault rates\n"
+              << "  --  launch command under the counters, counting from its first instruction\n";
+}
+
+int main(int argc, char** argv) {
+    long intervalMs = 0;  // unset: 100 ms for a single process, 1 s refresh for -a
+    bool intervalSet = false;
+    std::string outPath;
+    std::string format = "csv";
+    pid_t targetPid = 0;
+    std::string processName;
+    bool hotspots = false;
+    uint64_t sampleFreq = 1000;
+    bool systemWide = false;
+    bool c2c = false;
+    double durationSec = 0;
+    std::string cgroup;
+    long scanMs = 0;  // working-set scan period, 0: off
+    bool wsRequested = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+i:o:f:p:sF:ad:g:cw:h")) != -1) {
+        switch (opt) {
+        case 'i': intervalMs = strtol(optarg, NULL, 10); intervalSet = true; break;
+        case 'o': outPath = optarg; break;
+        case 'f': format = optarg; break;
+        case 'p': targetPid = (pid_t)strtol(optarg, NULL, 10); break;
+        case 's': hotspots = true; break;
+        case 'F': sampleFreq = strtoull(optarg, NULL, 10); break;
+        case 'a': systemWide = true; break;
+        case 'd': durationSec = strtod(optarg, NULL); break;
+        case 'g': cgroup = optarg; break;
+        case 'c': c2c = true; break;
+        case 'w': scanMs = strtol(optarg, NULL, 10); wsRequested = true; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if ((intervalSet && intervalMs < 1) || (wsRequested && scanMs < 1) || sampleFreq < 1 ||
+        (format != "csv" && format != "bin")) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::cout << "Cache Miss Profiler for Linux (perf_event)\n";
+
+    if (systemWide) {
+        return runSystemWide(intervalSet ? intervalMs : 1000, sampleFreq, durationSec, cgroup,
+                             optind < argc ? argv[optind] : "");
+    }
+    if (!intervalSet) {
+        intervalMs = 100;
+    }
+    if (scanMs && scanMs < intervalMs) {
+        // Scans happen on interval boundaries, so this is the period they really get
+        std::cerr << "Warning: -w " << scanMs << " is shorter than the " << intervalMs
+                  << " ms interval; scanning every " << intervalMs << " ms\n";
+        scanMs = intervalMs;
+    }
+
+    // getopt stops at "--", leaving the command to launch in argv[optind..]
+    bool launched = optind > 1 && strcmp(argv[optind - 1], "--") == 0 && optind < argc;
+    int goFd = -1;
+    if (launched) {
+        processName = argv[optind];
+        targetPid = launchProcess(argv + optind, goFd);
+        if (targetPid < 0) {
+            return 1;
+        }
+    } else if (targetPid == 0) {
+        std::vector<ProcessInfo> processes = listProcesses();
+        if (optind < argc) {
+            processName = argv[optind];
+        } else {
+            std::cout << "Available processes:\n";
+            for (size_t i = 0; i < processes.size(); i++) {
+                std::cout << i + 1 << ": " << processes[i].name << " (PID: " << processes[i].pid << ")\n";
+            }
+            std::cout << "\nEnter the name of the process to profile (e.g., l3): ";
+            std::cin >> processName;
+        }
+        for (const auto& proc : processes) {
+            if (strcasecmp(proc.name.c_str(), processName.c_str()) == 0) {
+                targetPid = proc.pid;
+                break;
+            }
+        }
+        if (targetPid == 0) {
+            std::cerr << "Process not found. Exiting...\n";
+            return 1;
+        }
+    } else {
+        processName = "PID " + std::to_string(targetPid);
+    }
+
+    CounterGroup group;
+    if (!openCounters(group, targetPid, launched)) {
+        std::cerr << "Failed to set up performance counters. Exiting...\n";
+        if (launched) {
+            kill(targetPid, SIGKILL);
+            waitpid(targetPid, NULL, 0);
+        }
+        return 1;
+    }
+
+    SampleSession session;
+    if (c2c) {
+        if (!launched) {
+            readMappings(session, targetPid, true);
+        }
+        session.mode = MODE_C2C;
+        hotspots = openC2c(session, sampleTargets(targetPid, group.tids, launched), launched, sampleFreq);
+        if (!hotspots) {
+            std::cerr << "c2c sampling disabled\n";
+            closeSampling(session);
+            c2c = false;
+        }
+    } else if (hotspots) {
+        if (!launched) {
+            readMappings(session, targetPid, false);
+        }
+        session.mode = MODE_HOTSPOT;
+        if (!openSampling(session, sampleTargets(targetPid, group.tids, launched), 0, launched,
+                          sampleFreq, HOTSPOT_EVENTS)) {
+            std::cerr << "Hotspot sampling disabled\n";
+            closeSampling(session);
+            hotspots = false;
+        }
+    }
+
+    WorkingSetTracker ws;
+    if (scanMs) {
+        openWorkingSet(ws, targetPid);
+        std::cout << "Working set every " << scanMs << " ms by " << wsMethodNames[ws.method] << "\n";
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    std::cout << "Starting profiling for " << processName << " (PID: " << targetPid << ", "
+              << group.tids.size() << " threads) every " << intervalMs << " ms\n";
+    std::cout << "Profiling... Press Ctrl+C to stop if the application doesn't exit automatically.\n";
+
+    std::vector<IntervalSample> samples;
+    samples.reserve(1 << 16);
+    uint64_t previous[CNT_COUNT], current[CNT_COUNT], rssKb;
+    uint32_t threads;
+    readCounters(group, previous, rssKb, threads);
+
+    uint64_t startNs = nowNs();
+    if (launched) {
+        // Release the child; enable_on_exec switches the counters on at its exec
+        if (write(goFd, "g", 1) != 1) {
+            std::cerr << "Failed to start " << processName << std::endl;
+        }
+        close(goFd);
+    }
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint64_t nextScanNs = 0;
+    bool running = true;
+    while (running && !stopRequested) {
+        // Absolute deadlines keep the interval from drifting by the cost of reading
+        next.tv_nsec += intervalMs * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        running = isProcessRunning(targetPid);
+        if (!readCounters(group, current, rssKb, threads)) {
+            break;
+        }
+        IntervalSample s;
+        s.tNs = nowNs() - startNs;
+        for (int c = 0; c < CNT_COUNT; ++c) {
+            s.delta[c] = current[c] >= previous[c] ? current[c] - previous[c] : 0;
+            previous[c] = current[c];
+        }
+        s.rssKb = rssKb;
+        s.threads = threads;
+        if (scanMs && running && s.tNs >= nextScanNs) {
+            // Scans are slower than counter reads, so they run on their own period
+            scanWorkingSet(ws);
+            nextScanNs = s.tNs + scanMs * 1000000ull;
+        }
+        s.ws = scanMs ? ws.last : WorkingSet();
+        samples.push_back(s);
+        if (hotspots) {
+            drainSampling(session);
+        }
+    }
+    double runtime = (nowNs() - startNs) / 1e9;
+    closeCounters(group);
+    if (hotspots) {
+        drainSampling(session);
+        closeSampling(session);
+    }
+
+    if (launched) {
+        // Counters were read from the zombie above; now reap it
+        int status = 0;
+        if (stopRequested && isProcessRunning(targetPid)) {
+            kill(targetPid, SIGINT);
+        }
+        waitpid(targetPid, &status, 0);
+        if (WIFEXITED(status)) {
+            std::cout << "\n" << processName << " exited with status " << WEXITSTATUS(status) << "\n";
+        } else if (WIFSIGNALED(status)) {
+            std::cout << "\n" << processName << " killed by signal " << WTERMSIG(status) << "\n";
+        }
+    }
+
+    std::cout << "\nProfiling results for " << processName << ":\n";
+    printSummary(group, samples, runtime);
+    if (scanMs) {
+        printWorkingSet(ws, group, samples, scanMs);
+        closeWorkingSet(ws);
+    }
+    if (c2c) {
+        printC2c(session, targetPid, 20);
+    } else if (hotspots) {
+        printHotspots(session, 15);
+    }
+
+    if (!outPath.empty()) {
+        bool ok = format == "csv" ? writeCsv(outPath, group, samples, scanMs != 0)
+                                     : writeBinary(outPath, group, samples, scanMs != 0);
+        if (ok) {
+            std::cout << "Time series written to " << outPath << " (" << format << ")\n";
+        }
+    }
+    return 0;
+}
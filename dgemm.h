@@ -0,0 +1,442 @@
+/* Packed SSE dgemm kernel shared by the single-threaded (l3) and threaded
+ * drivers. Everything here is column-major with leading dimension lda;
+ * dgemm_tile() adapts it to the row-major layout of the l2 drivers.
+ * compile with -msse3 or -march=native */
+#ifndef DGEMM_H
+#define DGEMM_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <pmmintrin.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#include "cachesim.h"
+#include "trace.h"
+
+/* How many k steps ahead the packing loops and the micro-kernel prefetch
+ * (0 turns software prefetching off) */
+inline int PREFETCH_DIST = 0;
+/* Write C with non-temporal stores where it is written only once (beta=0) */
+inline bool STREAM_STORES = false;
+
+/* Epilogues: applied to a finished C tile while it is still in registers,
+ * before the store, so post-processing costs no second pass over C. vec()
+ * gets C[row:row+2, col] as computed and a pointer to where it will be
+ * stored (holding the old C); scalar() does the same for one edge element.
+ * Only full-K paths may use them, a partial sum must not be post-processed.
+ * EpilogueNone inlines to nothing, so the plain kernel is unchanged */
+struct EpilogueNone {
+  __m128d vec (__m128d acc, const double*, int, int) const { return acc; }
+  double scalar (double acc, const double*, int, int) const { return acc; }
+};
+
+/* C := alpha*A*B + beta*C; the old C is only read when beta != 0 */
+struct EpilogueScale {
+  double alpha, beta;
+  __m128d vec (__m128d acc, const double* c, int, int) const {
+    acc = _mm_mul_pd(acc, _mm_set1_pd(alpha));
+    if (beta != 0.0) acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(c), _mm_set1_pd(beta)));
+    return acc;
+  }
+  double scalar (double acc, const double* c, int, int) const {
+    return alpha * acc + (beta != 0.0 ? beta * *c : 0.0);
+  }
+};
+
+/* C[i,j] += bias[i] */
+struct EpilogueBiasRow {
+  const double* bias;
+  __m128d vec (__m128d acc, const double*, int row, int) const { return _mm_add_pd(acc, _mm_loadu_pd(bias + row)); }
+  double scalar (double acc, const double*, int row, int) const { return acc + bias[row]; }
+};
+
+/* C[i,j] += bias[j] */
+struct EpilogueBiasCol {
+  const double* bias;
+  __m128d vec (__m128d acc, const double*, int, int col) const { return _mm_add_pd(acc, _mm_set1_pd(bias[col])); }
+  double scalar (double acc, const double*, int, int col) const { return acc + bias[col]; }
+};
+
+/* C[i,j] += R[i,j], R column-major with leading dimension ldr */
+struct EpilogueResidual {
+  const double* R;
+  int ldr;
+  __m128d vec (__m128d acc, const double*, int row, int col) const {
+    return _mm_add_pd(acc, _mm_loadu_pd(R + (size_t)col*ldr + row));
+  }
+  double scalar (double acc, const double*, int row, int col) const { return acc + R[(size_t)col*ldr + row]; }
+};
+
+/* C[i,j] += beta*R[i,j]; with R the destination itself this is beta*C */
+struct EpilogueAxpy {
+  double beta;
+  const double* R;
+  int ldr;
+  __m128d vec (__m128d acc, const double*, int row, int col) const {
+    return _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(beta), _mm_loadu_pd(R + (size_t)col*ldr + row)));
+  }
+  double scalar (double acc, const double*, int row, int col) const { return acc + beta * R[(size_t)col*ldr + row]; }
+};
+
+struct EpilogueRelu {
+  __m128d vec (__m128d acc, const double*, int, int) const { return _mm_max_pd(acc, _mm_setzero_pd()); }
+  double scalar (double acc, const double*, int, int) const { return acc > 0.0 ? acc : 0.0; }
+};
+
+/* GELU, tanh approximation; there is no SSE tanh, so lane by lane */
+struct EpilogueGelu {
+  static double gelu (double x) {
+    return 0.5 * x * (1.0 + std::tanh(0.7978845608028654 * (x + 0.044715 * x * x * x)));
+  }
+  __m128d vec (__m128d acc, const double*, int, int) const {
+    double v[2];
+    _mm_storeu_pd(v, acc);
+    return _mm_set_pd(gelu(v[1]), gelu(v[0]));
+  }
+  double scalar (double acc, const double*, int, int) const { return gelu(acc); }
+};
+
+/* first, then second: e.g. scale, bias, activation, residual */
+template <class First, class Second>
+struct EpilogueChain {
+  First first;
+  Second second;
+  __m128d vec (__m128d acc, const double* c, int row, int col) const {
+    return second.vec(first.vec(acc, c, row, col), c, row, col);
+  }
+  double scalar (double acc, const double* c, int row, int col) const {
+    return second.scalar(first.scalar(acc, c, row, col), c, row, col);
+  }
+};
+
+template <class First, class Second>
+inline EpilogueChain<First, Second> epilogue_chain (First first, Second second)
+{
+  return EpilogueChain<First, Second>{first, second};
+}
+
+template <class First, class Second, class... Rest>
+inline auto epilogue_chain (First first, Second second, Rest... rest)
+{
+  return epilogue_chain(epilogue_chain(first, second), rest...);
+}
+
+template <class Epilogue = EpilogueNone>
+static void sse_4x4 (int lda, int K, double* A, double* B, double* C, bool beta0 = false,
+                     const Epilogue& ep = Epilogue(), int row = 0, int col = 0) {
+    /* Performs Matrix Multiplication on 4x4 block
+     * using SSE intrinsics 
+     * load, update, store
+     * beta0: C := A*B, the old C is not read
+     * ep: epilogue for the tile at C[row, col] of the whole matrix */
+  // A
+  __m128d A_0X_A_1X, A_2X_A_3X;
+  // B
+  __m128d B_X0, B_X1, B_X2, B_X3;
+  // C 
+  __m128d C_00_C_10, C_20_C_30,
+          C_01_C_11, C_21_C_31,
+          C_02_C_12, C_22_C_32,
+          C_03_C_13, C_23_C_33;
+
+  // LOAD --------
+  if (beta0) {
+    C_00_C_10 = C_20_C_30 = C_01_C_11 = C_21_C_31 =
+    C_02_C_12 = C_22_C_32 = C_03_C_13 = C_23_C_33 = _mm_setzero_pd();
+  } else {
+    // load unaligned
+    C_00_C_10 = _mm_loadu_pd(C              );
+    C_20_C_30 = _mm_loadu_pd(C           + 2);
+    C_01_C_11 = _mm_loadu_pd(C + lda        );
+    C_21_C_31 = _mm_loadu_pd(C + lda     + 2);
+    C_02_C_12 = _mm_loadu_pd(C + (2*lda)    );
+    C_22_C_32 = _mm_loadu_pd(C + (2*lda) + 2);
+    C_03_C_13 = _mm_loadu_pd(C + (3*lda)    );
+    C_23_C_33 = _mm_loadu_pd(C + (3*lda) + 2);
+    CACHESIM_LOAD(C          , 32);
+    CACHESIM_LOAD(C + lda    , 32);
+    CACHESIM_LOAD(C + 2*lda  , 32);
+    CACHESIM_LOAD(C + 3*lda  , 32);
+  }
+
+  // packed panels are 4 doubles per k, so prefetch every other step (one line)
+  const int pf = PREFETCH_DIST * 4;
+  for (int k = 0; k < K; ++k) {
+    if (pf && !(k & 1)) {
+      _mm_prefetch((const char*)(A + pf), _MM_HINT_T0);
+      _mm_prefetch((const char*)(B + pf), _MM_HINT_T0);
+    }
+    // load aligned
+    A_0X_A_1X = _mm_load_pd(A);
+    A_2X_A_3X = _mm_load_pd(A+2);
+    CACHESIM_LOAD(A, 32);
+    CACHESIM_LOAD(B, 32);
+    A += 4;
+      
+    // load unaligned
+    B_X0 = _mm_loaddup_pd(B);
+    B_X1 = _mm_loaddup_pd(B+1);
+    B_X2 = _mm_loaddup_pd(B+2);
+    B_X3 = _mm_loaddup_pd(B+3);
+    B += 4;
+    // UPDATE ---------
+    // C := C + A*B
+    C_00_C_10 = _mm_add_pd(C_00_C_10, _mm_mul_pd(A_0X_A_1X, B_X0));
+    C_20_C_30 = _mm_add_pd(C_20_C_30, _mm_mul_pd(A_2X_A_3X, B_X0));
+    C_01_C_11 = _mm_add_pd(C_01_C_11, _mm_mul_pd(A_0X_A_1X, B_X1));
+    C_21_C_31 = _mm_add_pd(C_21_C_31, _mm_mul_pd(A_2X_A_3X, B_X1));
+    C_02_C_12 = _mm_add_pd(C_02_C_12, _mm_mul_pd(A_0X_A_1X, B_X2));
+    C_22_C_32 = _mm_add_pd(C_22_C_32, _mm_mul_pd(A_2X_A_3X, B_X2));
+    C_03_C_13 = _mm_add_pd(C_03_C_13, _mm_mul_pd(A_0X_A_1X, B_X3));
+    C_23_C_33 = _mm_add_pd(C_23_C_33, _mm_mul_pd(A_2X_A_3X, B_X3));
+  }
+
+  // EPILOGUE ----
+  C_00_C_10 = ep.vec(C_00_C_10, C              , row    , col    );
+  C_20_C_30 = ep.vec(C_20_C_30, C           + 2, row + 2, col    );
+  C_01_C_11 = ep.vec(C_01_C_11, C + lda        , row    , col + 1);
+  C_21_C_31 = ep.vec(C_21_C_31, C + lda     + 2, row + 2, col + 1);
+  C_02_C_12 = ep.vec(C_02_C_12, C + (2*lda)    , row    , col + 2);
+  C_22_C_32 = ep.vec(C_22_C_32, C + (2*lda) + 2, row + 2, col + 2);
+  C_03_C_13 = ep.vec(C_03_C_13, C + (3*lda)    , row    , col + 3);
+  C_23_C_33 = ep.vec(C_23_C_33, C + (3*lda) + 2, row + 2, col + 3);
+
+  // STORE -------
+  CACHESIM_STORE(C          , 32);
+  CACHESIM_STORE(C + lda    , 32);
+  CACHESIM_STORE(C + 2*lda  , 32);
+  CACHESIM_STORE(C + 3*lda  , 32);
+  // streaming stores bypass the cache; they need 16-byte aligned columns
+  if (beta0 && STREAM_STORES && ((uintptr_t)C & 15) == 0 && (lda & 1) == 0) {
+    _mm_stream_pd(C              , C_00_C_10);
+    _mm_stream_pd(C           + 2, C_20_C_30);
+    _mm_stream_pd(C + lda        , C_01_C_11);
+    _mm_stream_pd(C + lda     + 2, C_21_C_31);
+    _mm_stream_pd(C + (2*lda)    , C_02_C_12);
+    _mm_stream_pd(C + (2*lda) + 2, C_22_C_32);
+    _mm_stream_pd(C + (3*lda)    , C_03_C_13);
+    _mm_stream_pd(C + (3*lda) + 2, C_23_C_33);
+    return;
+  }
+  _mm_storeu_pd(C              , C_00_C_10);
+  _mm_storeu_pd(C           + 2, C_20_C_30);
+  _mm_storeu_pd(C + lda        , C_01_C_11);
+  _mm_storeu_pd(C + lda     + 2, C_21_C_31);
+  _mm_storeu_pd(C + (2*lda)    , C_02_C_12);
+  _mm_storeu_pd(C + (2*lda) + 2, C_22_C_32);
+  _mm_storeu_pd(C + (3*lda)    , C_03_C_13);
+  _mm_storeu_pd(C + (3*lda) + 2, C_23_C_33);
+}
+
+
+inline void naive_helper (int lda, int K, double* A, double* B, double* C, int i, int j) {
+    double cij = C[j*lda + i];
+    for (int k = 0; k < K; ++k) {
+        cij += A[k*lda + i] * B[j*lda + k];
+    }
+    C[j*lda + i] = cij;
+}
+
+/* pack and align M4 rows of A into 4-row micro-panels, k-major */
+static void pack_a (int lda, int M4, int K, double* A, double* AA)
+{
+  const int pf = PREFETCH_DIST;
+  for(int m=0; m < M4; m+=4) {
+      double *dst = &AA[m*K];
+      double *src = A + m;
+      for (int k = 0; k < K; ++k) {
+          // columns of A are lda apart, so the hardware prefetcher won't follow
+          if (pf) _mm_prefetch((const char*)(src + pf*lda), _MM_HINT_T0);
+          CACHESIM_LOAD(src, 32);
+          CACHESIM_STORE(dst, 32);
+          *dst     = *src;
+          *(dst+1) = *(src+1);
+          *(dst+2) = *(src+2);
+          *(dst+3) = *(src+3);
+          dst += 4;
+          src += lda;
+      }
+  }
+}
+
+/* pack and align N4 columns of B into 4-column micro-panels, k-major */
+static void pack_b (int lda, int N4, int K, double* B, double* BB)
+{
+  const int pf = PREFETCH_DIST;
+  for(int n=0; n < N4; n+=4){
+      double *dst = &BB[n*K];
+      double *src_0 = B + n*lda;
+      double *src_1 = src_0 + lda; 
+      double *src_2 = src_1 + lda; 
+      double *src_3 = src_2 + lda;
+      for (int k = 0; k < K; ++k) {
+          if (pf && !(k & 7)) {
+              _mm_prefetch((const char*)(src_0 + pf), _MM_HINT_T0);
+              _mm_prefetch((const char*)(src_1 + pf), _MM_HINT_T0);
+              _mm_prefetch((const char*)(src_2 + pf), _MM_HINT_T0);
+              _mm_prefetch((const char*)(src_3 + pf), _MM_HINT_T0);
+          }
+          CACHESIM_LOAD(src_0, 8);
+          CACHESIM_LOAD(src_1, 8);
+          CACHESIM_LOAD(src_2, 8);
+          CACHESIM_LOAD(src_3, 8);
+          CACHESIM_STORE(dst, 32);
+          *dst++ = *src_0++;
+          *dst++ = *src_1++;
+          *dst++ = *src_2++;
+          *dst++ = *src_3++;
+      }
+  }
+}
+
+/* Run the micro-kernel over the packed panels. The next C tile is
+ * prefetched while the current one computes, unless C is only written.
+ * C is at C[row0, col0] of the matrix the epilogue indexes */
+template <class Epilogue = EpilogueNone>
+static void compute_tiles (int lda, int M4, int N4, int K, double* AA, double* BB, double* C, bool beta0,
+                           const Epilogue& ep = Epilogue(), int row0 = 0, int col0 = 0)
+{
+  const bool pf = PREFETCH_DIST && !beta0;
+  for (int i = 0; i < M4; i+=4){
+    for (int j = 0; j < N4; j+=4){
+        if (pf) {
+            double* next = (j + 4 < N4) ? &C[(j+4)*lda + i] : &C[i + 4];
+            _mm_prefetch((const char*)next, _MM_HINT_T0);
+            _mm_prefetch((const char*)(next + lda), _MM_HINT_T0);
+            _mm_prefetch((const char*)(next + 2*lda), _MM_HINT_T0);
+            _mm_prefetch((const char*)(next + 3*lda), _MM_HINT_T0);
+        }
+        sse_4x4(lda, K, &AA[i*K], &BB[j*K], &C[j*lda + i], beta0, ep, row0 + i, col0 + j);
+    }
+  }
+}
+
+/* do_block with separate leading dimensions for A, B and C, so sub-blocks
+ * of differently shaped matrices (e.g. packed panels) can be multiplied */
+inline void do_block_ld (int lda, int ldb, int ldc, int M, int N, int K, double* A, double* B, double* C)
+{
+  // largest multiple of 4 less than M
+  int M4_max = (M>>2) << 2;
+  // largest multiple of 4 less than N
+  int N4_max = (N>>2) << 2;
+  //printf("%i, %i\n", M4_max, N4_max);
+  
+  double AA[M4_max*K]; // under allocate
+  CACHESIM_NAME("AA", AA, sizeof(double) * M4_max * K);
+  TRACE_BEGIN("pack A");
+  pack_a(lda, M4_max, K, A, AA);
+  TRACE_END("pack A");
+  double BB[N4_max*K]; // under allocate
+  CACHESIM_NAME("BB", BB, sizeof(double) * N4_max * K);
+  TRACE_BEGIN("pack B");
+  pack_b(ldb, N4_max, K, B, BB);
+  TRACE_END("pack B");
+
+  // compute 4x4's using SSE intrinsics 
+  TRACE_SCOPE("kernel");
+  compute_tiles(ldc, M4_max, N4_max, K, AA, BB, C, false);
+  // compute remaining cells using naive dgemm
+  // horizontal sliver, then vertical sliver + bottom right corner
+  for (int j = 0; j < N; ++j)
+    for (int i = (j < N4_max ? M4_max : 0); i < M; ++i) {
+      double cij = C[j*ldc + i];
+      CACHESIM_LOAD(&C[j*ldc + i], 8);
+      for (int k = 0; k < K; ++k) {
+        CACHESIM_LOAD(&A[k*lda + i], 8);
+        CACHESIM_LOAD(&B[j*ldb + k], 8);
+        cij += A[k*lda + i] * B[j*ldb + k];
+      }
+      C[j*ldc + i] = cij;
+      CACHESIM_STORE(&C[j*ldc + i], 8);
+    }
+}
+
+inline void do_block (int lda, int M, int N, int K, double* A, double* B, double* C)
+{
+  do_block_ld(lda, lda, lda, M, N, K, A, B, C);
+}
+
+/* C := ep(A*B), column-major M x N x K with full-K panels like dgemm_opt3
+ * in l3.cpp: every C tile is finished in one pass, so the epilogue sees
+ * final values. Panels are bs wide; the packing buffers are per thread and
+ * only grow */
+template <class Epilogue = EpilogueNone>
+inline void dgemm_ep (int M, int N, int K, double* A, int lda, double* B, int ldb, double* C, int ldc, int bs,
+                      const Epilogue& ep = Epilogue())
+{
+  bs = (bs + 3) & ~3;
+  thread_local std::vector<double> AA, BB;
+  if (AA.size() < (size_t)bs * K) {
+    AA.resize((size_t)bs * K);
+    BB.resize((size_t)bs * K);
+  }
+  CACHESIM_NAME("AA", AA.data(), sizeof(double) * AA.size());
+  CACHESIM_NAME("BB", BB.data(), sizeof(double) * BB.size());
+  for (int j = 0; j < N; j += bs) {
+    int NB = N - j < bs ? N - j : bs;
+    int N4_max = (NB>>2) << 2;
+    TRACE_BEGIN("pack B");
+    pack_b(ldb, N4_max, K, B + (size_t)j*ldb, BB.data());
+    TRACE_END("pack B");
+    for (int i = 0; i < M; i += bs) {
+      int MB = M - i < bs ? M - i : bs;
+      int M4_max = (MB>>2) << 2;
+      double* Cij = C + i + (size_t)j*ldc;
+      TRACE_BEGIN("pack A");
+      pack_a(lda, M4_max, K, A + i, AA.data());
+      TRACE_END("pack A");
+      TRACE_SCOPE("kernel");
+      compute_tiles(ldc, M4_max, N4_max, K, AA.data(), BB.data(), Cij, true, ep, i, j);
+      // edges
+      for (int jj = 0; jj < NB; ++jj)
+        for (int ii = (jj < N4_max ? M4_max : 0); ii < MB; ++ii) {
+          double cij = 0.0;
+          for (int k = 0; k < K; ++k) {
+            CACHESIM_LOAD(&A[(size_t)k*lda + i + ii], 8);
+            CACHESIM_LOAD(&B[(size_t)(j + jj)*ldb + k], 8);
+            cij += A[(size_t)k*lda + i + ii] * B[(size_t)(j + jj)*ldb + k];
+          }
+          Cij[(size_t)jj*ldc + ii] = ep.scalar(cij, &Cij[(size_t)jj*ldc + ii], i + ii, j + jj);
+          CACHESIM_STORE(&Cij[(size_t)jj*ldc + ii], 8);
+        }
+    }
+  }
+  if (STREAM_STORES) _mm_sfence();
+}
+
+/* Tiles of C handed to the threading back-ends, in kernel blocks per side:
+ * a few blocks so a tile's A rows and B columns stay in L2 while it runs */
+inline int TILE_BLOCKS = 4;
+
+/* Row-major C[i0:i1, j0:j1] += A[i0:i1, :] * B[:, j0:j1] for n x n matrices,
+ * in bs x bs x bs blocks. A row-major matrix is its transpose in column-major,
+ * so this runs the column-major kernel on C^T += B^T * A^T */
+inline void dgemm_tile (int n, int i0, int i1, int j0, int j1, int bs, double* A, double* B, double* C)
+{
+  TRACE_SCOPE("tile");
+  for (int j = j0; j < j1; j += bs)
+    for (int i = i0; i < i1; i += bs)
+      for (int k = 0; k < n; k += bs) {
+        int M = j1 - j < bs ? j1 - j : bs;
+        int N = i1 - i < bs ? i1 - i : bs;
+        int K = n - k < bs ? n - k : bs;
+        do_block(n, M, N, K, B + k*n + j, A + i*n + k, C + i*n + j);
+      }
+}
+
+/* Row-major C (M x N) += A (M x K) * B (K x N) with leading dimensions
+ * lda, ldb, ldc, blocked like dgemm_tile */
+inline void dgemm_rect (int M, int N, int K, double* A, int lda, double* B, int ldb, double* C, int ldc, int bs)
+{
+  for (int j = 0; j < N; j += bs)
+    for (int i = 0; i < M; i += bs)
+      for (int k = 0; k < K; k += bs) {
+        int bm = N - j < bs ? N - j : bs;
+        int bn = M - i < bs ? M - i : bs;
+        int bk = K - k < bs ? K - k : bs;
+        do_block_ld(ldb, lda, ldc, bm, bn, bk, B + k*ldb + j, A + i*lda + k, C + i*ldc + j);
+      }
+}
+
+#endif
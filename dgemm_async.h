@@ -0,0 +1,68 @@
+// Asynchronous row-major n x n multiplies on a ThreadPool: gemm_async()
+// queues the tiles of C += A*B and returns immediately, so the caller can
+// prepare the next operands while earlier multiplies run.
+#ifndef DGEMM_ASYNC_H
+#define DGEMM_ASYNC_H
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include "dgemm.h"
+#include "threadpool.h"
+
+// Per-job latency, in seconds from submission
+struct GemmTiming {
+    double queued;  // until the first tile started
+    double total;   // until the last tile finished
+};
+
+inline std::future<GemmTiming> gemm_async(ThreadPool& pool, int n, int bs, double* A, double* B, double* C) {
+    typedef std::chrono::steady_clock clock;
+    struct State {
+        std::promise<GemmTiming> result;
+        clock::time_point submitted;
+        std::atomic<long long> first_start{-1};  // ns after submitted
+        std::atomic<int> remaining;
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;  // the first tile's exception, written by whoever set failed
+    };
+    auto state = std::make_shared<State>();
+    int tile = bs * TILE_BLOCKS;
+    int tiles = (n + tile - 1) / tile;
+    state->remaining = tiles * tiles;
+    state->submitted = clock::now();
+    std::future<GemmTiming> result = state->result.get_future();
+    if (tiles == 0) {
+        state->result.set_value(GemmTiming{0.0, 0.0});  // the pool would never run a tile to say so
+        return result;
+    }
+
+    pool.submit(tiles * tiles, [=](int t) {
+        long long started = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - state->submitted).count();
+        long long unset = -1;
+        state->first_start.compare_exchange_strong(unset, started);
+
+        int i0 = (t / tiles) * tile, i1 = i0 + tile < n ? i0 + tile : n;
+        int j0 = (t % tiles) * tile, j1 = j0 + tile < n ? j0 + tile : n;
+        try {
+            dgemm_tile(n, i0, i1, j0, j1, bs, A, B, C);
+        } catch (...) {
+            bool expected = false;
+            if (state->failed.compare_exchange_strong(expected, true)) state->error = std::current_exception();
+        }
+
+        // every tile counts down, thrown or not, so the last one always answers
+        if (--state->remaining == 0) {
+            if (state->failed) {
+                state->result.set_exception(state->error);
+                return;
+            }
+            std::chrono::duration<double> total = clock::now() - state->submitted;
+            state->result.set_value(GemmTiming{state->first_start * 1e-9, total.count()});
+        }
+    });
+    return result;
+}
+
+#endif
@@ -0,0 +1,53 @@
+// pthread back-end for the packed dgemm kernel (dgemm.h), row-major n x n.
+// Tiles are dealt out round-robin, like a static OpenMP schedule.
+#ifndef DGEMM_PTHREAD_H
+#define DGEMM_PTHREAD_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "dgemm.h"
+
+struct TileWork {
+    double* A;
+    double* B;
+    double* C;
+    int n;
+    int bs;
+    int first_tile;  // this thread runs first_tile, first_tile + stride, ...
+    int stride;
+};
+
+inline void* multiply_tiles(void* arg) {
+    TileWork* work = static_cast<TileWork*>(arg);
+    trace_thread_name("pthread " + std::to_string(work->first_tile));
+    int tile = work->bs * TILE_BLOCKS;
+    int tiles = (work->n + tile - 1) / tile;
+    for (int t = work->first_tile; t < tiles * tiles; t += work->stride) {
+        int i0 = (t / tiles) * tile, i1 = i0 + tile < work->n ? i0 + tile : work->n;
+        int j0 = (t % tiles) * tile, j1 = j0 + tile < work->n ? j0 + tile : work->n;
+        dgemm_tile(work->n, i0, i1, j0, j1, work->bs, work->A, work->B, work->C);
+    }
+    return nullptr;
+}
+
+// C += A*B on thread_count threads
+inline void multiply_pthread(int n, int bs, double* A, double* B, double* C, int thread_count) {
+    std::vector<pthread_t> threads(thread_count);
+    std::vector<TileWork> work(thread_count);
+    for (int i = 0; i < thread_count; ++i) {
+        work[i] = TileWork{A, B, C, n, bs, i, thread_count};
+        int create_status = pthread_create(&threads[i], NULL, multiply_tiles, &work[i]);
+        if (create_status) {
+            fprintf(stderr, "Error - pthread_create() return code: %d\n", create_status);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+}
+
+#endif
@@ -0,0 +1,250 @@
+// Shape-aware row-major C (M x N) += A (M x K) * B (K x N) on a ThreadPool.
+// Tiling C alone, as every threaded variant does, leaves threads idle when C
+// has fewer tiles than the pool has threads (M = N = 256, K = 1M), and for a
+// tall strip of C (M = 1M, N = 16) re-packs the same small B for every tile
+// and reloads C once per kernel block of K. dgemm_shape_pool picks a path:
+//   GEMM_TILES     tiles of bs * TILE_BLOCKS through dgemm_rect, as before
+//   GEMM_SPLIT_K   too few tiles for the pool and a long K: K is cut into
+//                  chunks multiplied into partial copies of C, which are then
+//                  summed into C with SSE, in parallel over rows
+//   GEMM_SKINNY_N  N <= SKINNY_N: with so few columns packing A costs as
+//                  much as using it, so A is read in place, four rows at a
+//                  time, each element broadcast against a row of B
+//   GEMM_TALL_M    M much larger than N, N >= TALL_MIN_N and a small B: B is
+//                  packed once and shared, row panels of A are streamed
+//                  through it over the full K, so C is written once
+// gemm_path() is the choice, kept apart so drivers can show it.
+#ifndef DGEMM_SHAPE_H
+#define DGEMM_SHAPE_H
+
+#include <algorithm>
+#include <vector>
+#include <emmintrin.h>
+#include "dgemm.h"
+#include "matalloc.h"
+#include "threadpool.h"
+
+enum GemmPath { GEMM_TILES, GEMM_SPLIT_K, GEMM_SKINNY_N, GEMM_TALL_M };
+
+inline const char* gemm_path_name(GemmPath path) {
+    static const char* const names[] = {"tiles", "split-K", "skinny-N", "tall-M"};
+    return names[path];
+}
+
+// Widest B for the skinny kernel; past it packing A pays off
+inline int SKINNY_N = 16;
+// A K chunk of split-K is at least this many tiles deep
+inline int SPLIT_K_MIN_TILES = 2;
+// Tall-M wants M at least this many times N, N at least TALL_MIN_N and
+// packed B at most this big. Narrower B leaves too few 4-column panels to
+// pay for packing, and the N % 4 edge columns (walked down B's columns)
+// become a large share of the work: there tall-M measured 0.7x - 1.1x of
+// the tiles, against 0.93x - 1.28x (1.1x typical) from N = 64 up
+inline int TALL_RATIO = 16;
+inline int TALL_MIN_N = 64;
+inline size_t TALL_B_BYTES = 4 << 20;
+// Depth of a K chunk on the skinny and tall paths, so a pair of A rows or a
+// panel of packed A stays in L1 while it is reused
+inline int SHAPE_KC = 256;
+
+// dgemm_rect tiled on the pool
+inline void dgemm_rect_pool(ThreadPool& pool, int M, int N, int K, double* A, int lda, double* B, int ldb, double* C,
+                            int ldc, int bs) {
+    int tile = bs * TILE_BLOCKS;
+    int rows = (M + tile - 1) / tile, cols = (N + tile - 1) / tile;
+    pool.submit(rows * cols, [&](int t) {
+        int i0 = (t / cols) * tile, j0 = (t % cols) * tile;
+        int tm = std::min(tile, M - i0), tn = std::min(tile, N - j0);
+        dgemm_rect(tm, tn, K, A + (size_t)i0 * lda, lda, B + j0, ldb, C + (size_t)i0 * ldc + j0, ldc, bs);
+    }).get();
+}
+
+// K chunks for split-K: enough for every thread to have a tile, none
+// shallower than SPLIT_K_MIN_TILES tiles; 1 means no split
+inline int split_k_chunks(int M, int N, int K, int threads, int bs) {
+    int tile = bs * TILE_BLOCKS;
+    long tiles = (long)((M + tile - 1) / tile) * ((N + tile - 1) / tile);
+    if (tiles >= threads) return 1;
+    long wanted = (threads + tiles - 1) / tiles;
+    long deepest = K / ((long)tile * SPLIT_K_MIN_TILES);
+    return (int)std::max(1L, std::min(wanted, deepest));
+}
+
+inline GemmPath gemm_path(int M, int N, int K, int threads, int bs) {
+    if (split_k_chunks(M, N, K, threads, bs) > 1) return GEMM_SPLIT_K;
+    if (N <= SKINNY_N) return GEMM_SKINNY_N;
+    if ((long)M >= (long)TALL_RATIO * N && N >= TALL_MIN_N && (size_t)N * K * sizeof(double) <= TALL_B_BYTES)
+        return GEMM_TALL_M;
+    return GEMM_TILES;
+}
+
+// Split-K: chunk 0 accumulates into C itself, chunk c > 0 into a zeroed
+// partial; a task is one (chunk, tile) pair and zeroes its own tile first.
+// The partials are then added into C, a few rows per task
+inline void dgemm_split_k_pool(ThreadPool& pool, int M, int N, int K, double* A, int lda, double* B, int ldb,
+                               double* C, int ldc, int bs, int chunks) {
+    int tile = bs * TILE_BLOCKS;
+    int rows = (M + tile - 1) / tile, cols = (N + tile - 1) / tile;
+    int depth = (K + chunks - 1) / chunks;
+    depth = (depth + bs - 1) / bs * bs;  // whole kernel blocks per chunk
+    chunks = (K + depth - 1) / depth;
+    size_t elems = (size_t)M * N;
+    double* partial = chunks > 1 ? alloc_matrix(elems * (chunks - 1)) : NULL;
+    pool.submit(chunks * rows * cols, [&](int t) {
+        int c = t / (rows * cols), r = t % (rows * cols);
+        int i0 = (r / cols) * tile, j0 = (r % cols) * tile;
+        int tm = std::min(tile, M - i0), tn = std::min(tile, N - j0);
+        int k0 = c * depth, kk = std::min(depth, K - k0);
+        double* out = C + (size_t)i0 * ldc + j0;
+        int ldo = ldc;
+        if (c > 0) {
+            out = partial + (c - 1) * elems + (size_t)i0 * N + j0;
+            ldo = N;
+            for (int i = 0; i < tm; ++i) std::fill(out + (size_t)i * ldo, out + (size_t)i * ldo + tn, 0.0);
+        }
+        dgemm_rect(tm, tn, kk, A + (size_t)i0 * lda + k0, lda, B + (size_t)k0 * ldb + j0, ldb, out, ldo, bs);
+    }).get();
+    if (chunks == 1) return;
+
+    int band = std::max(1, std::min(M, (int)((1 << 16) / std::max(1, N))));  // ~512KB of C per task
+    pool.submit((M + band - 1) / band, [&](int t) {
+        for (int i = t * band; i < std::min(M, (t + 1) * band); ++i) {
+            double* c = C + (size_t)i * ldc;
+            int j = 0;
+            for (; j + 2 <= N; j += 2) {
+                __m128d sum = _mm_loadu_pd(c + j);
+                for (int p = 0; p < chunks - 1; ++p)
+                    sum = _mm_add_pd(sum, _mm_loadu_pd(partial + p * elems + (size_t)i * N + j));
+                _mm_storeu_pd(c + j, sum);
+            }
+            for (; j < N; ++j)
+                for (int p = 0; p < chunks - 1; ++p) c[j] += partial[p * elems + (size_t)i * N + j];
+        }
+    }).get();
+    free_matrix(partial);
+}
+
+// C[R rows, 2*W2 columns] += A[R rows, 0:K] * B[0:K, 2*W2 columns]: every
+// a(i,k) is broadcast against a row of B, so A is read in place, B rows are
+// contiguous and the accumulators are C itself, R * W2 registers of them
+template <int R, int W2>
+static inline void skinny_block(int K, const double* A, int lda, const double* B, int ldb, double* C, int ldc) {
+    __m128d acc[R][W2];
+#pragma GCC unroll 4
+    for (int r = 0; r < R; ++r)
+#pragma GCC unroll 2
+        for (int w = 0; w < W2; ++w) acc[r][w] = _mm_loadu_pd(C + (size_t)r * ldc + 2 * w);
+    for (int k = 0; k < K; ++k) {
+        __m128d b[W2];
+#pragma GCC unroll 2
+        for (int w = 0; w < W2; ++w) b[w] = _mm_loadu_pd(B + (size_t)k * ldb + 2 * w);
+#pragma GCC unroll 4
+        for (int r = 0; r < R; ++r) {
+            __m128d a = _mm_load1_pd(A + (size_t)r * lda + k);
+#pragma GCC unroll 2
+            for (int w = 0; w < W2; ++w) acc[r][w] = _mm_add_pd(acc[r][w], _mm_mul_pd(a, b[w]));
+        }
+    }
+#pragma GCC unroll 4
+    for (int r = 0; r < R; ++r)
+#pragma GCC unroll 2
+        for (int w = 0; w < W2; ++w) _mm_storeu_pd(C + (size_t)r * ldc + 2 * w, acc[r][w]);
+}
+
+// R rows of C across all N columns: four at a time, then a pair, then one
+template <int R>
+static inline void skinny_rows(int N, int K, const double* A, int lda, const double* B, int ldb, double* C,
+                               int ldc) {
+    int j = 0;
+    for (; j + 4 <= N; j += 4) skinny_block<R, 2>(K, A, lda, B + j, ldb, C + j, ldc);
+    if (j + 2 <= N) {
+        skinny_block<R, 1>(K, A, lda, B + j, ldb, C + j, ldc);
+        j += 2;
+    }
+    if (j < N) {
+        for (int r = 0; r < R; ++r) {
+            double cij = C[(size_t)r * ldc + j];
+            for (int k = 0; k < K; ++k) cij += A[(size_t)r * lda + k] * B[(size_t)k * ldb + j];
+            C[(size_t)r * ldc + j] = cij;
+        }
+    }
+}
+
+// Skinny-N: tasks are tiles of rows, walked four rows and SHAPE_KC of K at
+// a time so the rows of A are reread from L1 for each group of columns
+inline void dgemm_skinny_pool(ThreadPool& pool, int M, int N, int K, double* A, int lda, double* B, int ldb,
+                              double* C, int ldc, int bs) {
+    int tile = bs * TILE_BLOCKS;
+    pool.submit((M + tile - 1) / tile, [&](int t) {
+        TRACE_SCOPE("skinny", t);
+        int i1 = std::min(M, (t + 1) * tile);
+        for (int k0 = 0; k0 < K; k0 += SHAPE_KC) {
+            int kk = std::min(SHAPE_KC, K - k0);
+            const double* b = B + (size_t)k0 * ldb;
+            int i = t * tile;
+            for (; i + 4 <= i1; i += 4)
+                skinny_rows<4>(N, kk, A + (size_t)i * lda + k0, lda, b, ldb, C + (size_t)i * ldc, ldc);
+            for (; i < i1; ++i)
+                skinny_rows<1>(N, kk, A + (size_t)i * lda + k0, lda, b, ldb, C + (size_t)i * ldc, ldc);
+        }
+    }).get();
+}
+
+// Tall-M: B^T is packed once in SHAPE_KC deep chunks of 4-column panels
+// (pack_a on the column-major view), shared by all tasks. A task packs bs
+// rows of A per chunk (pack_b) and runs them against every panel of B, so
+// neither is packed twice and C tiles stay in registers for a whole chunk
+inline void dgemm_tall_pool(ThreadPool& pool, int M, int N, int K, double* A, int lda, double* B, int ldb,
+                            double* C, int ldc, int bs) {
+    bs = (bs + 3) & ~3;
+    int N4 = (N >> 2) << 2;
+    double* BB = alloc_matrix(std::max<size_t>(1, (size_t)N4 * K));
+    for (int k0 = 0; k0 < K; k0 += SHAPE_KC)
+        pack_a(ldb, N4, std::min(SHAPE_KC, K - k0), B + (size_t)k0 * ldb, BB + (size_t)k0 * N4);
+    int tile = bs * TILE_BLOCKS;
+    pool.submit((M + tile - 1) / tile, [&](int t) {
+        TRACE_SCOPE("tall", t);
+        thread_local std::vector<double> AA;
+        if (AA.size() < (size_t)bs * SHAPE_KC) AA.resize((size_t)bs * SHAPE_KC);
+        int t1 = std::min(M, (t + 1) * tile);
+        for (int i0 = t * tile; i0 < t1; i0 += bs) {
+            int mb = std::min(bs, t1 - i0);
+            int M4 = (mb >> 2) << 2;
+            for (int k0 = 0; k0 < K; k0 += SHAPE_KC) {
+                int kk = std::min(SHAPE_KC, K - k0);
+                double* chunk = BB + (size_t)k0 * N4;
+                pack_b(lda, M4, kk, A + (size_t)i0 * lda + k0, AA.data());
+                for (int i = 0; i < M4; i += 4)
+                    for (int j = 0; j < N4; j += 4)
+                        sse_4x4(ldc, kk, chunk + (size_t)j * kk, &AA[(size_t)i * kk],
+                                C + (size_t)(i0 + i) * ldc + j);
+            }
+            // edges: the last N % 4 columns of every row, the last mb % 4 rows
+            for (int i = 0; i < mb; ++i)
+                for (int j = i < M4 ? N4 : 0; j < N; ++j) {
+                    const double* a = A + (size_t)(i0 + i) * lda;
+                    double cij = 0.0;
+                    for (int k = 0; k < K; ++k) cij += a[k] * B[(size_t)k * ldb + j];
+                    C[(size_t)(i0 + i) * ldc + j] += cij;
+                }
+        }
+    }).get();
+    free_matrix(BB);
+}
+
+// Row-major C (M x N) += A (M x K) * B (K x N) by the path gemm_path picks
+inline GemmPath dgemm_shape_pool(ThreadPool& pool, int M, int N, int K, double* A, int lda, double* B, int ldb,
+                                 double* C, int ldc, int bs) {
+    GemmPath path = gemm_path(M, N, K, pool.size(), bs);
+    switch (path) {
+    case GEMM_SPLIT_K:
+        dgemm_split_k_pool(pool, M, N, K, A, lda, B, ldb, C, ldc, bs, split_k_chunks(M, N, K, pool.size(), bs));
+        break;
+    case GEMM_SKINNY_N: dgemm_skinny_pool(pool, M, N, K, A, lda, B, ldb, C, ldc, bs); break;
+    case GEMM_TALL_M: dgemm_tall_pool(pool, M, N, K, A, lda, B, ldb, C, ldc, bs); break;
+    default: dgemm_rect_pool(pool, M, N, K, A, lda, B, ldb, C, ldc, bs); break;
+    }
+    return path;
+}
+
+#endif
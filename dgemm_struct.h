@@ -0,0 +1,159 @@
+// Structured row-major products on the packed kernel (dgemm.h), for operands
+// that make a plain multiply do redundant work:
+//   dsyrk_lower  C += A * A^T, only the lower triangle of C is computed
+//   dsymm_lower  C += S * B, S symmetric with only its lower triangle read
+//   dtrmm_lower  C += L * B, L lower triangular, blocks above it skipped
+// Everything is cut into bs x bs blocks for dgemm_rect(). Blocks on the
+// diagonal go through a small scratch buffer (zero-filled, mirrored or with
+// the other triangle discarded), so the other triangle is never read or
+// written. The _pool variants split C into tiles of bs * TILE_BLOCKS on a
+// ThreadPool, the biggest tiles first.
+#ifndef DGEMM_STRUCT_H
+#define DGEMM_STRUCT_H
+
+#include <algorithm>
+#include <vector>
+#include "dgemm.h"
+#include "matalloc.h"
+#include "threadpool.h"
+
+// Lower triangle of C[i0:i1, j0:j1] += A * At, where At is A^T (k x n,
+// leading dimension n); i0 and j0 are multiples of bs
+inline void syrk_tile(int n, int k, int i0, int i1, int j0, int j1, int bs, double* A, int lda, double* At,
+                      double* C, int ldc) {
+    std::vector<double> diag;
+    for (int i = i0; i < i1; i += bs) {
+        int bi = std::min(bs, i1 - i);
+        for (int j = j0; j < j1 && j <= i; j += bs) {
+            int bj = std::min(bs, j1 - j);
+            if (j < i) {
+                dgemm_rect(bi, bj, k, A + (size_t)i * lda, lda, At + j, n, C + (size_t)i * ldc + j, ldc, bs);
+                continue;
+            }
+            // diagonal block: compute it whole on the side, keep the lower half
+            diag.assign((size_t)bi * bi, 0.0);
+            dgemm_rect(bi, bi, k, A + (size_t)i * lda, lda, At + j, n, diag.data(), bi, bs);
+            for (int r = 0; r < bi; ++r)
+                for (int c = 0; c <= r; ++c) C[(size_t)(i + r) * ldc + j + c] += diag[(size_t)r * bi + c];
+        }
+    }
+}
+
+// A^T for the B side of the kernel, so A is only ever read row-wise
+inline double* transpose_copy(int rows, int cols, const double* A, int lda) {
+    double* At = alloc_matrix((size_t)rows * cols);
+    for (int i = 0; i < rows; ++i)
+        for (int j = 0; j < cols; ++j) At[(size_t)j * rows + i] = A[(size_t)i * lda + j];
+    return At;
+}
+
+// Lower triangle of C (n x n) += A * A^T, A n x k
+inline void dsyrk_lower(int n, int k, double* A, int lda, double* C, int ldc, int bs) {
+    double* At = transpose_copy(n, k, A, lda);
+    syrk_tile(n, k, 0, n, 0, n, bs, A, lda, At, C, ldc);
+    free_matrix(At);
+}
+
+inline void dsyrk_lower_pool(ThreadPool& pool, int n, int k, double* A, int lda, double* C, int ldc, int bs) {
+    double* At = transpose_copy(n, k, A, lda);
+    int tile = bs * TILE_BLOCKS;
+    int tiles = (n + tile - 1) / tile;
+    // tiles on or below the diagonal, row by row; the diagonal ones are cheapest
+    std::vector<std::pair<int, int>> work;
+    for (int ti = 0; ti < tiles; ++ti)
+        for (int tj = 0; tj < ti; ++tj) work.push_back(std::make_pair(ti, tj));
+    for (int t = 0; t < tiles; ++t) work.push_back(std::make_pair(t, t));
+    pool.submit((int)work.size(), [&](int t) {
+        int i0 = work[t].first * tile, j0 = work[t].second * tile;
+        syrk_tile(n, k, i0, std::min(n, i0 + tile), j0, std::min(n, j0 + tile), bs, A, lda, At, C, ldc);
+    }).get();
+    free_matrix(At);
+}
+
+// Block S[i:i+bi, k:k+bk] of a symmetric matrix whose lower triangle is
+// stored: points into S below the diagonal, otherwise built in scratch
+inline const double* symm_block(int i, int k, int bi, int bk, const double* S, int lds,
+                                std::vector<double>& scratch, int& ld) {
+    if (k + bk <= i) {
+        ld = lds;
+        return S + (size_t)i * lds + k;
+    }
+    scratch.resize((size_t)bi * bk);
+    ld = bk;
+    for (int r = 0; r < bi; ++r)
+        for (int c = 0; c < bk; ++c) {
+            int gr = i + r, gc = k + c;
+            scratch[(size_t)r * bk + c] = gr >= gc ? S[(size_t)gr * lds + gc] : S[(size_t)gc * lds + gr];
+        }
+    return scratch.data();
+}
+
+// C[i0:i1, j0:j1] += S[i0:i1, :] * B[:, j0:j1], S n x n symmetric (lower stored)
+inline void symm_tile(int n, int i0, int i1, int j0, int j1, int bs, const double* S, int lds, double* B, int ldb,
+                      double* C, int ldc) {
+    std::vector<double> scratch;
+    for (int i = i0; i < i1; i += bs) {
+        int bi = std::min(bs, i1 - i);
+        for (int k = 0; k < n; k += bs) {
+            int bk = std::min(bs, n - k), ld;
+            const double* blk = symm_block(i, k, bi, bk, S, lds, scratch, ld);
+            dgemm_rect(bi, j1 - j0, bk, const_cast<double*>(blk), ld, B + (size_t)k * ldb + j0, ldb,
+                       C + (size_t)i * ldc + j0, ldc, bs);
+        }
+    }
+}
+
+// C (n x m) += S * B (n x m)
+inline void dsymm_lower(int n, int m, const double* S, int lds, double* B, int ldb, double* C, int ldc, int bs) {
+    symm_tile(n, 0, n, 0, m, bs, S, lds, B, ldb, C, ldc);
+}
+
+inline void dsymm_lower_pool(ThreadPool& pool, int n, int m, const double* S, int lds, double* B, int ldb,
+                             double* C, int ldc, int bs) {
+    int tile = bs * TILE_BLOCKS;
+    int rows = (n + tile - 1) / tile, cols = (m + tile - 1) / tile;
+    pool.submit(rows * cols, [&](int t) {
+        int i0 = (t / cols) * tile, j0 = (t % cols) * tile;
+        symm_tile(n, i0, std::min(n, i0 + tile), j0, std::min(m, j0 + tile), bs, S, lds, B, ldb, C, ldc);
+    }).get();
+}
+
+// C[i0:i1, j0:j1] += L[i0:i1, :] * B[:, j0:j1], L n x n lower triangular
+inline void trmm_tile(int i0, int i1, int j0, int j1, int bs, double* L, int ldl, double* B, int ldb, double* C,
+                      int ldc) {
+    std::vector<double> diag;
+    for (int i = i0; i < i1; i += bs) {
+        int bi = std::min(bs, i1 - i);
+        for (int k = 0; k <= i; k += bs) {
+            if (k < i) {
+                dgemm_rect(bi, j1 - j0, bs, L + (size_t)i * ldl + k, ldl, B + (size_t)k * ldb + j0, ldb,
+                           C + (size_t)i * ldc + j0, ldc, bs);
+                continue;
+            }
+            // diagonal block with its upper half zeroed
+            diag.assign((size_t)bi * bi, 0.0);
+            for (int r = 0; r < bi; ++r)
+                for (int c = 0; c <= r; ++c) diag[(size_t)r * bi + c] = L[(size_t)(i + r) * ldl + k + c];
+            dgemm_rect(bi, j1 - j0, bi, diag.data(), bi, B + (size_t)k * ldb + j0, ldb, C + (size_t)i * ldc + j0,
+                       ldc, bs);
+        }
+    }
+}
+
+// C (n x m) += L * B (n x m)
+inline void dtrmm_lower(int n, int m, double* L, int ldl, double* B, int ldb, double* C, int ldc, int bs) {
+    trmm_tile(0, n, 0, m, bs, L, ldl, B, ldb, C, ldc);
+}
+
+inline void dtrmm_lower_pool(ThreadPool& pool, int n, int m, double* L, int ldl, double* B, int ldb, double* C,
+                             int ldc, int bs) {
+    int tile = bs * TILE_BLOCKS;
+    int rows = (n + tile - 1) / tile, cols = (m + tile - 1) / tile;
+    // bottom row tiles have the most work, hand them out first
+    pool.submit(rows * cols, [&](int t) {
+        int i0 = (rows - 1 - t / cols) * tile, j0 = (t % cols) * tile;
+        trmm_tile(i0, std::min(n, i0 + tile), j0, std::min(m, j0 + tile), bs, L, ldl, B, ldb, C, ldc);
+    }).get();
+}
+
+#endif
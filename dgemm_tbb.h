@@ -0,0 +1,32 @@
+// TBB back-end for the packed dgemm kernel (dgemm.h), row-major n x n.
+// Call inside a task_arena to bound the number of threads.
+#ifndef DGEMM_TBB_H
+#define DGEMM_TBB_H
+
+#include "tbb/blocked_range2d.h"
+#include "tbb/parallel_for.h"
+#include "tbb/partitioner.h"
+#include "dgemm.h"
+
+enum PartitionerKind { PART_AUTO, PART_AFFINITY, PART_STATIC, PART_SIMPLE };
+const char* const partitioner_names[] = {"auto", "affinity", "static", "simple"};
+
+// C += A*B over 2D tiles of C, each tile run through the packed kernel.
+// The affinity partitioner remembers which thread ran which tile, so it has
+// to outlive a single call to replay that mapping on the next one
+inline void multiply_tbb(int n, int bs, double* A, double* B, double* C, PartitionerKind kind,
+                         tbb::affinity_partitioner& affinity) {
+    int tile = bs * TILE_BLOCKS;
+    tbb::blocked_range2d<int> range(0, n, tile, 0, n, tile);
+    auto body = [=](const tbb::blocked_range2d<int>& r) {
+        dgemm_tile(n, r.rows().begin(), r.rows().end(), r.cols().begin(), r.cols().end(), bs, A, B, C);
+    };
+    switch (kind) {
+    case PART_AUTO:     tbb::parallel_for(range, body, tbb::auto_partitioner()); break;
+    case PART_AFFINITY: tbb::parallel_for(range, body, affinity); break;
+    case PART_STATIC:   tbb::parallel_for(range, body, tbb::static_partitioner()); break;
+    case PART_SIMPLE:   tbb::parallel_for(range, body, tbb::simple_partitioner()); break;
+    }
+}
+
+#endif
@@ -0,0 +1,103 @@
+//compile with g++ -O2 -march=native expr.cpp -o expr
+//usage: expr [-n size] [-b block] [-r runs]
+//Evaluates C = alpha*A*B + beta*C + D three ways: one temporary per
+//operator as naive overloading would, the product into one temporary and a
+//single pass for the rest, and as a Matrix expression (one fused GEMM). Each
+//starts from the same C; prints the best time of each and the difference.
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <getopt.h>
+#include "matrix.h"
+
+static void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [-n size] [-b block] [-r runs]\n";
+}
+
+// Function to fill a matrix with values in [-1, 1]
+static void fillRandom(Matrix& m) {
+    for (size_t e = 0; e < m.size(); ++e) m.data()[e] = (rand() % 2001 - 1000) * 1e-3;
+}
+
+// Function to time a variant, restoring C before every run and keeping the best
+static double timeBest(int runs, const Matrix& C0, Matrix& C, const std::function<void()>& run) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        std::copy(C0.data(), C0.data() + C0.size(), C.data());
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static double maxDiff(const Matrix& X, const Matrix& Y) {
+    double d = 0.0;
+    for (size_t e = 0; e < X.size(); ++e) d = std::max(d, std::fabs(X.data()[e] - Y.data()[e]));
+    return d;
+}
+
+int main(int argc, char** argv) {
+    int n = 1000;
+    int runs = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:r:h")) != -1) {
+        switch (opt) {
+        case 'n': n = atoi(optarg); break;
+        case 'b': MATRIX_BLOCK = atoi(optarg); break;
+        case 'r': runs = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (n <= 0 || MATRIX_BLOCK <= 0 || runs <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const double alpha = 0.5, beta = -2.0;
+    Matrix A(n, n), B(n, n), C0(n, n), D(n, n);
+    fillRandom(A);
+    fillRandom(B);
+    fillRandom(C0);
+    fillRandom(D);
+    Matrix C(n, n), ref(n, n);
+    const size_t elems = (size_t)n * n;
+
+    double perOperator = timeBest(runs, C0, C, [&] {
+        double* AB = new double[elems]();
+        dgemm_ep(n, n, n, A.data(), n, B.data(), n, AB, n, MATRIX_BLOCK);
+        double* scaled = new double[elems];
+        for (size_t e = 0; e < elems; ++e) scaled[e] = alpha * AB[e];
+        double* betaC = new double[elems];
+        for (size_t e = 0; e < elems; ++e) betaC[e] = beta * C.data()[e];
+        double* sum = new double[elems];
+        for (size_t e = 0; e < elems; ++e) sum[e] = scaled[e] + betaC[e];
+        for (size_t e = 0; e < elems; ++e) C.data()[e] = sum[e] + D.data()[e];
+        delete[] AB;
+        delete[] scaled;
+        delete[] betaC;
+        delete[] sum;
+    });
+    std::copy(C.data(), C.data() + elems, ref.data());
+
+    double oneTemporary = timeBest(runs, C0, C, [&] {
+        Matrix AB(n, n);
+        dgemm_ep(n, n, n, A.data(), n, B.data(), n, AB.data(), n, MATRIX_BLOCK);
+        for (size_t e = 0; e < elems; ++e) C.data()[e] = alpha * AB.data()[e] + beta * C.data()[e] + D.data()[e];
+    });
+    double diffOne = maxDiff(C, ref);
+
+    double fused = timeBest(runs, C0, C, [&] { C = alpha * A * B + beta * C + D; });
+    double diffFused = maxDiff(C, ref);
+
+    printf("%d x %d, block %d, best of %d\n", n, n, MATRIX_BLOCK, runs);
+    printf("%-16s %10s %12s\n", "evaluation", "seconds", "max diff");
+    printf("%-16s %10.4f %12.2e\n", "per operator", perOperator, 0.0);
+    printf("%-16s %10.4f %12.2e\n", "one temporary", oneTemporary, diffOne);
+    printf("%-16s %10.4f %12.2e\n", "expression", fused, diffFused);
+    return 0;
+}
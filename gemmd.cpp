@@ -0,0 +1,699 @@
+//compile with g++ -O2 -march=native -pthread gemmd.cpp -o gemmd
+//usage: gemmd [-s socket] [-t threads] [-b block] [-w window_us] [-B max_batch] [-S small_n]
+//       gemmd -l [-s socket] [-c clients] [-r requests] [-n size] [-m | -z]
+//Serves row-major C := A*B requests on a Unix domain socket. Operands come
+//inline after the request header, or (-m in the load generator) in a POSIX
+//shared memory object holding A, B and C back to back, which the server
+//maps and writes C into, or (-z) through a memfd ring attached once per
+//client (shmring.h), so steady-state requests cost no copies and no
+//syscalls beyond futex wake-ups. Requests of size <= small_n arriving within
+//window_us of each other are run as one batched pool job; bigger ones are
+//split into tiles. -l runs the bundled load generator against a server.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "dgemm.h"
+#include "threadpool.h"
+#include "shmring.h"
+
+static const uint32_t GEMMD_MAGIC = 0x47454d4d;  // "GEMM"
+static const uint32_t GEMMD_MAX_N = 65536;
+static const uint32_t GEMMD_MAX_INLINE_N = 4096;  // 3 * n * n doubles buffered per request: 384 MB
+static const char GEMMD_SHM_PREFIX[] = "/gemmd-";   // the only shm objects REQ_SHM may name
+
+enum RequestKind {
+    REQ_INLINE,  // A and B follow the header, C follows the reply
+    REQ_SHM,     // A, B and C live in the shared memory object shmName
+    REQ_ATTACH   // a memfd ring comes with the header; jobs then go through it
+};
+
+struct RequestHeader {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t n;
+    uint32_t id;        // echoed in the reply
+    char shmName[48];   // REQ_SHM only
+};
+
+struct ReplyHeader {
+    uint32_t magic;
+    uint32_t id;
+    int32_t status;     // 0, or an errno value
+    uint32_t batch;     // number of requests in the batch that ran this one (1 for tiled)
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Function to read or write exactly len bytes, false on EOF or error
+static bool readAll(int fd, void* buf, size_t len) {
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* buf, size_t len) {
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+// Function to read and throw away len bytes, false on EOF or error
+static bool discardAll(int fd, size_t len) {
+    char buf[65536];
+    while (len > 0) {
+        size_t chunk = std::min(len, sizeof(buf));
+        if (!readAll(fd, buf, chunk)) return false;
+        len -= chunk;
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    return v[(size_t)(p * (v.size() - 1) + 0.5)];
+}
+
+// ---------------------------------------------------------------- server
+
+// One client connection; replies may be sent from any worker
+struct Connection {
+    int fd;
+    uid_t peerUid = (uid_t)-1;  // from SO_PEERCRED; -1 if unknown, which matches no object
+    std::mutex writeLock;
+    explicit Connection(int f) : fd(f) {
+        ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) peerUid = cred.uid;
+    }
+    ~Connection() { close(fd); }
+};
+
+struct Request {
+    std::shared_ptr<Connection> conn;
+    uint32_t id;
+    uint32_t n;
+    std::vector<double> inlineData;  // REQ_INLINE: A, B, C
+    void* shmBase = NULL;            // REQ_SHM mapping
+    size_t shmBytes = 0;
+    double* A;
+    double* B;
+    double* C;
+    Clock::time_point arrived;
+    std::atomic<int> remaining{0};   // tiles left, for tiled requests
+    uint32_t batch = 1;
+    std::shared_ptr<ShmRingServer> ring;  // REQ_ATTACH: complete through the ring
+    ShmJob job;
+};
+
+struct ServerConfig {
+    std::string socketPath = "/tmp/gemmd.sock";
+    int threads = (int)std::thread::hardware_concurrency();
+    int block = 64;
+    int windowUs = 200;
+    int maxBatch = 64;
+    int smallN = 128;
+};
+
+// Latencies in log-spaced buckets, 16 per doubling from 1 us, so a server
+// that runs for weeks keeps a fixed 5 KB however many requests it answers;
+// percentiles come out within about 2% of the exact value
+struct LatencyHistogram {
+    static const int PER_DOUBLING = 16;
+    static const int BUCKETS = 40 * PER_DOUBLING;  // up to ~12 days
+    unsigned long long counts[BUCKETS] = {};
+    unsigned long long total = 0;
+
+    void add(double us) {
+        int b = us <= 1.0 ? 0 : (int)(std::log2(us) * PER_DOUBLING);
+        counts[std::min(b, BUCKETS - 1)]++;
+        total++;
+    }
+
+    // Geometric middle of the bucket holding the p-quantile
+    double percentile(double p) const {
+        if (total == 0) return 0.0;
+        unsigned long long rank = (unsigned long long)(p * (total - 1) + 0.5), seen = 0;
+        int b = 0;
+        for (; b < BUCKETS - 1; ++b) {
+            seen += counts[b];
+            if (seen > rank) break;
+        }
+        return std::exp2((b + 0.5) / PER_DOUBLING);
+    }
+};
+
+struct ServerStats {
+    std::mutex lock;
+    LatencyHistogram latencyUs;  // arrival to reply sent
+    long long batches = 0;
+    long long batchedRequests = 0;
+    long long tiledRequests = 0;
+    long long failed = 0;
+};
+
+// Requests waiting to be batched
+struct RequestQueue {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::shared_ptr<Request>> items;
+
+    void push(std::shared_ptr<Request> r) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            items.push_back(std::move(r));
+        }
+        ready.notify_one();
+    }
+
+    // Block for the first request, then collect more until window_us has
+    // passed or max_batch are in hand
+    std::vector<std::shared_ptr<Request>> takeBatch(int windowUs, int maxBatch, volatile sig_atomic_t& stop) {
+        std::vector<std::shared_ptr<Request>> batch;
+        std::unique_lock<std::mutex> guard(lock);
+        while (items.empty() && !stop) {
+            ready.wait_for(guard, std::chrono::milliseconds(100));
+        }
+        Clock::time_point deadline = Clock::now() + std::chrono::microseconds(windowUs);
+        while (!stop && (int)batch.size() < maxBatch) {
+            while (!items.empty() && (int)batch.size() < maxBatch) {
+                batch.push_back(items.front());
+                items.pop_front();
+            }
+            if ((int)batch.size() >= maxBatch || !ready.wait_until(guard, deadline, [this] { return !items.empty(); })) {
+                break;
+            }
+        }
+        return batch;
+    }
+};
+
+static volatile sig_atomic_t stopServer = 0;
+
+static void onSignal(int) {
+    stopServer = 1;
+}
+
+// Function to send the socket reply (and inline C) and release the operands
+static void sendReply(Request& r, int status) {
+    ReplyHeader reply = {GEMMD_MAGIC, r.id, status, r.batch};
+    {
+        std::lock_guard<std::mutex> guard(r.conn->writeLock);
+        bool ok = writeAll(r.conn->fd, &reply, sizeof(reply));
+        if (ok && status == 0 && r.shmBase == NULL) {
+            writeAll(r.conn->fd, r.C, (size_t)r.n * r.n * sizeof(double));
+        }
+    }
+    if (r.shmBase != NULL) {
+        munmap(r.shmBase, r.shmBytes);
+        r.shmBase = NULL;
+    }
+    std::vector<double>().swap(r.inlineData);
+}
+
+// Function to report a finished request through its socket or ring
+static void finishRequest(Request& r, int status, ServerStats& stats) {
+    if (r.ring) {
+        r.job.status = status;
+        r.ring->finish(r.job);
+        r.ring.reset();
+    } else {
+        sendReply(r, status);
+    }
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - r.arrived).count();
+    std::lock_guard<std::mutex> guard(stats.lock);
+    stats.latencyUs.add(us);
+    if (status != 0) stats.failed++;
+}
+
+// Function to pass jobs from a client's ring to the batcher until the client
+// detaches or disconnects
+static void serveRing(std::shared_ptr<Connection> conn, std::shared_ptr<ShmRingServer> ring, RequestQueue& queue,
+                      ServerStats& stats) {
+    ShmJob job;
+    while (!stopServer && !ring->closed()) {
+        if (!ring->next(job, 100)) {
+            pollfd pfd = {conn->fd, POLLIN, 0};
+            if (poll(&pfd, 1, 0) > 0) break;  // EOF (or stray bytes): client is gone
+            continue;
+        }
+        auto r = std::make_shared<Request>();
+        r->conn = conn;
+        r->id = job.id;
+        r->n = job.n;
+        r->ring = ring;
+        r->job = job;
+        r->arrived = Clock::now();
+        r->A = ring->operand(job.a, job.n);
+        r->B = ring->operand(job.b, job.n);
+        r->C = ring->operand(job.c, job.n);
+        if (job.n == 0 || r->A == NULL || r->B == NULL || r->C == NULL) {
+            finishRequest(*r, EINVAL, stats);
+            continue;
+        }
+        queue.push(r);
+    }
+}
+
+// Function to map the operands of a shared memory request. The server writes
+// C into the object, so it only opens the load generator's names, and only
+// objects owned by the user at the other end of the socket: a client cannot
+// point it at another client's buffers or anything else it can reach
+static int mapShared(Request& r, const char* name) {
+    if (strncmp(name, GEMMD_SHM_PREFIX, sizeof(GEMMD_SHM_PREFIX) - 1) != 0 || strchr(name + 1, '/') != NULL) {
+        return EACCES;
+    }
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return errno;
+    r.shmBytes = 3 * (size_t)r.n * r.n * sizeof(double);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != r.conn->peerUid) {
+        close(fd);
+        return EACCES;
+    }
+    if ((size_t)st.st_size < r.shmBytes) {
+        close(fd);
+        return EINVAL;  // touching pages past the end of the object would SIGBUS the server
+    }
+    r.shmBase = mmap(NULL, r.shmBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (r.shmBase == MAP_FAILED) {
+        r.shmBase = NULL;
+        return err;
+    }
+    r.A = (double*)r.shmBase;
+    r.B = r.A + (size_t)r.n * r.n;
+    r.C = r.B + (size_t)r.n * r.n;
+    return 0;
+}
+
+// Function to read requests from one client until it disconnects
+static void serveConnection(std::shared_ptr<Connection> conn, RequestQueue& queue, ServerStats& stats) {
+    RequestHeader hdr;
+    int passed;
+    while (shmring_recv_fd(conn->fd, &hdr, sizeof(hdr), passed)) {
+        if (hdr.magic == GEMMD_MAGIC && hdr.kind == REQ_ATTACH && passed >= 0) {
+            auto ring = std::make_shared<ShmRingServer>(passed);
+            ReplyHeader reply = {GEMMD_MAGIC, hdr.id, ring->valid() ? 0 : EINVAL, 0};
+            if (!writeAll(conn->fd, &reply, sizeof(reply)) || !ring->valid()) return;
+            serveRing(conn, ring, queue, stats);
+            return;
+        }
+        if (passed >= 0) close(passed);
+        bool known = hdr.kind == REQ_INLINE || hdr.kind == REQ_SHM;
+        if (hdr.magic != GEMMD_MAGIC || !known || hdr.n == 0 || hdr.n > GEMMD_MAX_N ||
+            (hdr.kind == REQ_INLINE && hdr.n > GEMMD_MAX_INLINE_N)) {
+            fprintf(stderr, "gemmd: bad request header, dropping client\n");
+            return;
+        }
+        auto r = std::make_shared<Request>();
+        r->conn = conn;
+        r->id = hdr.id;
+        r->n = hdr.n;
+        size_t elems = (size_t)hdr.n * hdr.n;
+        if (hdr.kind == REQ_INLINE) {
+            try {
+                r->inlineData.resize(3 * elems);
+            } catch (const std::bad_alloc&) {
+                // Skip the operands so the stream stays in step, then refuse
+                if (!discardAll(conn->fd, 2 * elems * sizeof(double))) return;
+                r->arrived = Clock::now();
+                finishRequest(*r, ENOMEM, stats);
+                continue;
+            }
+            r->A = r->inlineData.data();
+            r->B = r->A + elems;
+            r->C = r->B + elems;
+            if (!readAll(conn->fd, r->A, 2 * elems * sizeof(double))) return;
+            r->arrived = Clock::now();
+        } else {
+            r->arrived = Clock::now();
+            hdr.shmName[sizeof(hdr.shmName) - 1] = '\0';
+            int err = mapShared(*r, hdr.shmName);
+            if (err != 0) {
+                finishRequest(*r, err, stats);
+                continue;
+            }
+        }
+        queue.push(r);
+    }
+}
+
+// Function to turn batches from the queue into pool jobs
+static void runBatcher(const ServerConfig& config, RequestQueue& queue, ThreadPool& pool, ServerStats& stats) {
+    const int bs = config.block;
+    while (!stopServer) {
+        std::vector<std::shared_ptr<Request>> batch = queue.takeBatch(config.windowUs, config.maxBatch, stopServer);
+        std::vector<std::shared_ptr<Request>> small;
+        for (std::shared_ptr<Request>& r : batch) {
+            if ((int)r->n <= config.smallN) {
+                small.push_back(r);
+                continue;
+            }
+            // Large: one job, one task per tile of C
+            int n = r->n, tile = bs * TILE_BLOCKS, tiles = (n + tile - 1) / tile;
+            std::fill(r->C, r->C + (size_t)n * n, 0.0);
+            r->remaining = tiles * tiles;
+            pool.submit(tiles * tiles, [r, n, tile, tiles, bs, &stats](int t) {
+                int i0 = (t / tiles) * tile, i1 = std::min(n, i0 + tile);
+                int j0 = (t % tiles) * tile, j1 = std::min(n, j0 + tile);
+                dgemm_tile(n, i0, i1, j0, j1, bs, r->A, r->B, r->C);
+                if (--r->remaining == 0) finishRequest(*r, 0, stats);
+            });
+            std::lock_guard<std::mutex> guard(stats.lock);
+            stats.tiledRequests++;
+        }
+        if (small.empty()) continue;
+        // Small: one job for the whole batch, one task per request
+        for (std::shared_ptr<Request>& r : small) r->batch = (uint32_t)small.size();
+        pool.submit((int)small.size(), [small, bs, &stats](int i) {
+            Request& r = *small[i];
+            std::fill(r.C, r.C + (size_t)r.n * r.n, 0.0);
+            dgemm_tile(r.n, 0, r.n, 0, r.n, bs, r.A, r.B, r.C);
+            finishRequest(r, 0, stats);
+        });
+        std::lock_guard<std::mutex> guard(stats.lock);
+        stats.batches++;
+        stats.batchedRequests += small.size();
+    }
+}
+
+static int runServer(const ServerConfig& config) {
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, config.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(config.socketPath.c_str());
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+        perror("gemmd: listen");
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    // The pool (and the pack buffers on its workers' stacks) stays up for the
+    // life of the server, so requests never pay for thread start-up
+    ThreadPool pool(std::max(1, config.threads));
+    RequestQueue queue;
+    ServerStats stats;
+    std::thread batcher(runBatcher, std::cref(config), std::ref(queue), std::ref(pool), std::ref(stats));
+    std::cout << "gemmd listening on " << config.socketPath << " with " << pool.size() << " threads, block "
+              << config.block << ", batching n <= " << config.smallN << " for " << config.windowUs << " us\n";
+
+    Clock::time_point start = Clock::now();
+    while (!stopServer) {
+        pollfd pfd = {listenFd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) continue;
+        std::thread(serveConnection, std::make_shared<Connection>(fd), std::ref(queue), std::ref(stats)).detach();
+    }
+    batcher.join();
+    close(listenFd);
+    unlink(config.socketPath.c_str());
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::lock_guard<std::mutex> guard(stats.lock);
+    printf("\n%llu requests (%lld failed) in %.1f s, %.1f req/s\n", stats.latencyUs.total, stats.failed, elapsed,
+           stats.latencyUs.total / elapsed);
+    printf("server latency p50 %.0f us, p99 %.0f us\n", stats.latencyUs.percentile(0.50),
+           stats.latencyUs.percentile(0.99));
+    printf("%lld batches, %.1f requests per batch, %lld tiled requests\n", stats.batches,
+           stats.batches ? (double)stats.batchedRequests / stats.batches : 0.0, stats.tiledRequests);
+    // Workers may still be replying to clients that have gone; don't wait on them
+    fflush(stdout);
+    _exit(0);
+}
+
+// ---------------------------------------------------------------- load generator
+
+struct LoadConfig {
+    std::string socketPath = "/tmp/gemmd.sock";
+    int clients = 4;
+    int requests = 200;
+    int n = 64;
+    bool shared = false;
+    bool ring = false;
+};
+
+// Function to connect to the server, -1 on failure
+static int connectServer(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("gemmd -l: connect");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to check one entry of C against a dot product
+static bool spotCheck(int n, const double* A, const double* B, const double* C) {
+    int i = n / 2, j = n / 3;
+    double expect = 0.0;
+    for (int k = 0; k < n; ++k) expect += A[(size_t)i * n + k] * B[(size_t)k * n + j];
+    return C[(size_t)i * n + j] == expect;
+}
+
+// Function to run one closed-loop client: send, wait for the reply, repeat
+static void runClient(const LoadConfig& config, int client, std::vector<double>& latencyUs,
+                      std::atomic<int>& errors, std::atomic<long long>& batched) {
+    int fd = connectServer(config.socketPath);
+    if (fd < 0) {
+        errors += config.requests;
+        return;
+    }
+
+    const size_t elems = (size_t)config.n * config.n;
+    RequestHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = GEMMD_MAGIC;
+    hdr.kind = config.shared ? REQ_SHM : REQ_INLINE;
+    hdr.n = config.n;
+
+    // Operands, either private (sent inline) or in a shared object the server maps
+    std::vector<double> local;
+    double* A;
+    double* B;
+    double* C;
+    size_t shmBytes = 3 * elems * sizeof(double);
+    void* shm = NULL;
+    if (config.shared) {
+        snprintf(hdr.shmName, sizeof(hdr.shmName), "%s%d-%d", GEMMD_SHM_PREFIX, (int)getpid(), client);
+        int sfd = shm_open(hdr.shmName, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (sfd < 0 || ftruncate(sfd, shmBytes) != 0 ||
+            (shm = mmap(NULL, shmBytes, PROT_READ | PROT_WRITE, MAP_SHARED, sfd, 0)) == MAP_FAILED) {
+            perror("gemmd -l: shm");
+            errors += config.requests;
+            if (sfd >= 0) close(sfd);
+            shm_unlink(hdr.shmName);
+            close(fd);
+            return;
+        }
+        close(sfd);
+        A = (double*)shm;
+    } else {
+        local.resize(3 * elems);
+        A = local.data();
+    }
+    B = A + elems;
+    C = B + elems;
+    unsigned seed = 12345u + client;
+    for (size_t i = 0; i < 2 * elems; ++i) A[i] = (double)(rand_r(&seed) % 7 - 3);
+
+    for (int r = 0; r < config.requests; ++r) {
+        hdr.id = r;
+        Clock::time_point sent = Clock::now();
+        ReplyHeader reply;
+        bool ok = writeAll(fd, &hdr, sizeof(hdr)) && (config.shared || writeAll(fd, A, 2 * elems * sizeof(double))) &&
+                  readAll(fd, &reply, sizeof(reply)) && reply.magic == GEMMD_MAGIC && reply.id == (uint32_t)r &&
+                  (config.shared || reply.status != 0 || readAll(fd, C, elems * sizeof(double)));
+        if (!ok || reply.status != 0) {
+            errors++;
+            if (!ok) break;
+            continue;
+        }
+        latencyUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+        batched += reply.batch;
+
+        if (r == 0 && !spotCheck(config.n, A, B, C)) {
+            fprintf(stderr, "gemmd -l: client %d got a wrong result\n", client);
+            errors++;
+        }
+    }
+
+    if (shm != NULL) {
+        munmap(shm, shmBytes);
+        shm_unlink(hdr.shmName);
+    }
+    close(fd);
+}
+
+// Function to run one closed-loop client over a memfd ring: A and B are
+// written once into the ring's arena and reused by every request
+static void runRingClient(const LoadConfig& config, int client, std::vector<double>& latencyUs,
+                          std::atomic<int>& errors, std::atomic<long long>&) {
+    const size_t elems = (size_t)config.n * config.n;
+    int fd = connectServer(config.socketPath);
+    ShmRingClient ring(3 * (elems * sizeof(double) + SHMRING_ALIGN));
+    if (fd < 0 || !ring.valid()) {
+        errors += config.requests;
+        if (fd >= 0) close(fd);
+        return;
+    }
+    RequestHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = GEMMD_MAGIC;
+    hdr.kind = REQ_ATTACH;
+    ReplyHeader reply;
+    if (!ring.sendTo(fd, &hdr, sizeof(hdr)) || !readAll(fd, &reply, sizeof(reply)) || reply.status != 0) {
+        fprintf(stderr, "gemmd -l: client %d could not attach its ring\n", client);
+        errors += config.requests;
+        close(fd);
+        return;
+    }
+
+    int a = ring.alloc(elems * sizeof(double));
+    int b = ring.alloc(elems * sizeof(double));
+    int c = ring.alloc(elems * sizeof(double));
+    if (a < 0 || b < 0 || c < 0) {
+        fprintf(stderr, "gemmd -l: client %d could not allocate its operands\n", client);
+        errors += config.requests;
+        close(fd);
+        return;
+    }
+    unsigned seed = 12345u + client;
+    for (size_t i = 0; i < elems; ++i) ring.data(a)[i] = (double)(rand_r(&seed) % 7 - 3);
+    for (size_t i = 0; i < elems; ++i) ring.data(b)[i] = (double)(rand_r(&seed) % 7 - 3);
+
+    for (int r = 0; r < config.requests; ++r) {
+        Clock::time_point sent = Clock::now();
+        ShmJob done;
+        if (!ring.submit(r, config.n, a, b, c)) {
+            errors++;
+            continue;
+        }
+        while (!ring.complete(done, 1000)) {
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 0) > 0) {  // server hung up
+                errors += config.requests - r;
+                close(fd);
+                return;
+            }
+        }
+        if (done.status != 0 || done.id != (uint32_t)r) {
+            errors++;
+            continue;
+        }
+        latencyUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+        if (r == 0 && !spotCheck(config.n, ring.data(a), ring.data(b), ring.data(c))) {
+            fprintf(stderr, "gemmd -l: client %d got a wrong result\n", client);
+            errors++;
+        }
+    }
+    for (int h : {a, b, c}) ring.release(h);
+    close(fd);
+}
+
+static int runLoad(const LoadConfig& config) {
+    std::vector<std::vector<double>> latency(config.clients);
+    std::atomic<int> errors(0);
+    std::atomic<long long> batched(0);
+    std::vector<std::thread> clients;
+    Clock::time_point start = Clock::now();
+    for (int c = 0; c < config.clients; ++c) {
+        clients.emplace_back(config.ring ? runRingClient : runClient, std::cref(config), c, std::ref(latency[c]),
+                             std::ref(errors), std::ref(batched));
+    }
+    for (std::thread& t : clients) t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    for (std::vector<double>& l : latency) all.insert(all.end(), l.begin(), l.end());
+    double gflop = 2.0 * config.n * config.n * config.n * all.size() * 1e-9;
+    printf("%d clients x %d requests of %d x %d (%s): %zu ok, %d errors\n", config.clients, config.requests, config.n,
+           config.n, config.ring ? "memfd ring" : config.shared ? "shared memory" : "inline", all.size(), errors.load());
+    printf("throughput %.1f req/s (%.2f GFLOP/s), latency p50 %.0f us, p99 %.0f us", all.size() / elapsed,
+           gflop / elapsed, percentile(all, 0.50), percentile(all, 0.99));
+    if (batched > 0) printf(", mean batch %.1f", (double)batched / all.size());  // not reported through the ring
+    printf("\n");
+    return errors ? 1 : 0;
+}
+
+static void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [-s socket] [-t threads] [-b block] [-w window_us] [-B max_batch] [-S small_n]\n"
+              << "       " << prog << " -l [-s socket] [-c clients] [-r requests] [-n size] [-m | -z]\n";
+}
+
+int main(int argc, char** argv) {
+    ServerConfig server;
+    LoadConfig load;
+    bool loadMode = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:b:w:B:S:lc:r:n:mzh")) != -1) {
+        switch (opt) {
+        case 's': server.socketPath = load.socketPath = optarg; break;
+        case 't': server.threads = atoi(optarg); break;
+        case 'b': server.block = atoi(optarg); break;
+        case 'w': server.windowUs = atoi(optarg); break;
+        case 'B': server.maxBatch = atoi(optarg); break;
+        case 'S': server.smallN = atoi(optarg); break;
+        case 'l': loadMode = true; break;
+        case 'c': load.clients = atoi(optarg); break;
+        case 'r': load.requests = atoi(optarg); break;
+        case 'n': load.n = atoi(optarg); break;
+        case 'm': load.shared = true; break;
+        case 'z': load.ring = true; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (server.block <= 0 || server.windowUs < 0 || server.maxBatch <= 0 || load.clients <= 0 ||
+        load.requests <= 0 || load.n <= 0 || load.n > (int)GEMMD_MAX_N ||
+        (!load.shared && !load.ring && load.n > (int)GEMMD_MAX_INLINE_N)) {
+        usage(argv[0]);
+        return 1;
+    }
+    return loadMode ? runLoad(load) : runServer(server);
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <future>
+#include <sys/sysinfo.h>
+#include "matalloc.h"
+#include "dgemm_async.h"
+
+//compile with -O2 -march=native -pthread
+//Submits JOBS independent multiplies to one worker pool while the operands of
+//the next job are still being loaded. Sizes cycle through SIZE, SIZE/2, SIZE/4
+//so the per-job latencies show whether small jobs get through behind big ones.
+//The same jobs are then run one at a time (load, multiply, wait) for comparison.
+
+using namespace std;
+
+// Fill a matrix with random values
+void fill_random(double* matrix, int n) {
+    if (matrix == nullptr) {
+        cerr << "Error: Matrix is not allocated properly!" << endl;
+        return;
+    }
+
+    for (int i = 0; i < n * n; ++i) {
+        double random_value;
+        do {
+            random_value = static_cast<double>(rand());
+        } while (random_value == 0.0);
+
+        matrix[i] = 1.0 / random_value;
+    }
+}
+
+struct Operands {
+    int n;
+    double* A;
+    double* B;
+    double* C;
+    double load;  // seconds spent loading A and B
+};
+
+// Stand-in for reading a job's operands: allocate and fill them
+Operands load_operands(int n) {
+    auto start = chrono::steady_clock::now();
+    Operands op{n, alloc_matrix(n * n), alloc_matrix(n * n), alloc_matrix(n * n), 0.0};
+    fill_random(op.A, n);
+    fill_random(op.B, n);
+    op.load = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return op;
+}
+
+void free_operands(Operands& op) {
+    free_matrix(op.A);
+    free_matrix(op.B);
+    free_matrix(op.C);
+}
+
+int main() {
+    srand(static_cast<unsigned>(time(0)));
+    string input;
+
+    while (true) {
+        int n, block_size = 0, jobs = 8;
+        int thread_count = get_nprocs(); // Retrieve max threads
+        cout << "\nEnter command (EXIT to quit):" << endl
+             << "Format: [SIZE] [BLOCK_SIZE] [THREADS] [JOBS], max threads " << thread_count
+             << " (use 'm' for max threads)" << endl
+             << "Example: 1000 64 4 8" << endl
+             << "> ";
+
+        getline(cin, input);
+        if (input == "EXIT") break;
+
+        istringstream iss(input);
+        vector<string> tokens{istream_iterator<string>{iss}, istream_iterator<string>{}};
+
+        if (tokens.size() < 2) {
+            cerr << "Invalid input! Minimum 2 parameters required" << endl;
+            continue;
+        }
+
+        try {
+            n = stoi(tokens[0]);
+            if (n <= 0) throw invalid_argument("Size must be positive");
+
+            block_size = stoi(tokens[1]);
+            if (block_size <= 0) throw invalid_argument("Block size must be positive");
+
+            if (tokens.size() > 2 && tokens[2] != "m" && tokens[2] != "M") {
+                thread_count = stoi(tokens[2]);
+                if (thread_count <= 0) throw invalid_argument("Thread count must be positive");
+            }
+            if (tokens.size() > 3) {
+                jobs = stoi(tokens[3]);
+                if (jobs <= 0) throw invalid_argument("Job count must be positive");
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            continue;
+        }
+
+        ThreadPool pool(thread_count);
+        vector<Operands> operands;
+        vector<future<GemmTiming>> pending;
+
+        // Overlapped: job j multiplies while job j+1 loads
+        auto start = chrono::steady_clock::now();
+        for (int j = 0; j < jobs; ++j) {
+            operands.push_back(load_operands(max(1, n >> (j % 3))));
+            Operands& op = operands.back();
+            pending.push_back(gemm_async(pool, op.n, block_size, op.A, op.B, op.C));
+        }
+        printf("%4s %6s %10s %10s %10s\n", "job", "size", "load", "queued", "latency");
+        for (int j = 0; j < jobs; ++j) {
+            GemmTiming t = pending[j].get();
+            printf("%4d %6d %10.4f %10.4f %10.4f\n", j, operands[j].n, operands[j].load, t.queued, t.total);
+        }
+        double overlapped = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (Operands& op : operands) free_operands(op);
+
+        // Serial: load, multiply, wait, next
+        start = chrono::steady_clock::now();
+        for (int j = 0; j < jobs; ++j) {
+            Operands op = load_operands(max(1, n >> (j % 3)));
+            gemm_async(pool, op.n, block_size, op.A, op.B, op.C).get();
+            free_operands(op);
+        }
+        double serial = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << "Completed " << jobs << " jobs on " << thread_count << " threads in " << overlapped
+             << " seconds with loading overlapped, " << serial << " seconds one at a time." << endl;
+    }
+
+    return 0;
+}
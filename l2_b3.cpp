@@ -6,14 +6,34 @@
 #include <vector>
 #include <sstream>
 #include <iterator>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
 #include <pthread.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <sys/sysinfo.h>
+#include <memory>
+#include "matalloc.h"
+#include "cachesim.h"
+#include "trace.h"
+
+//usage: l2_b3 [--padded] [--trace-writes] [--objects]
+//  --padded        give every ThreadData entry its own cache line
+//  --trace-writes  record the cache lines each thread touches and report shared ones
+//  --objects       publish A/B/C/thread_data ranges in /tmp/cpr4-<pid>.objects for cpr4 -c
+//TRACE_FILE=run.json writes a per-thread timeline (rows, join) for Perfetto
+//built with -DCACHESIM, every thread's accesses also go through its own
+//simulated cache hierarchy (cachesim.h), reported after the multiplication
 
 using namespace std;
 
 int BLOCK_SIZE = 32;
 
+const int CACHE_LINE = 64;
+
+struct WriteTrace;
+
 // Structure for passing thread arguments
 struct ThreadData {
     double* A;
@@ -22,8 +42,32 @@ struct ThreadData {
     int n;
     int start_row;
     int end_row;
+    WriteTrace* trace;
+#ifdef CACHESIM
+    CacheSim* sim;
+#endif
+};
+
+// Same fields, but each entry owns a whole cache line
+struct alignas(CACHE_LINE) PaddedThreadData : ThreadData {
+};
+
+// Cache lines touched by one thread: bit 0 read, bit 1 written.
+// epoch is how many workers were already running when the owner touched the line,
+// so the main thread's setup writes only conflict with workers started before them.
+struct WriteTrace {
+    std::unordered_map<uintptr_t, unsigned char> lines;
+    std::unordered_map<uintptr_t, int> epoch;
 };
 
+static void trace_access(WriteTrace* trace, const void* p, size_t size, unsigned char kind, int epoch = 0) {
+    uintptr_t first = (uintptr_t)p / CACHE_LINE, last = ((uintptr_t)p + size - 1) / CACHE_LINE;
+    for (uintptr_t line = first; line <= last; ++line) {
+        trace->lines[line] |= kind;
+        trace->epoch[line] = max(trace->epoch[line], epoch);
+    }
+}
+
 // Fill a matrix with random values
 void fill_random(double* matrix, int n) {
     if (matrix == nullptr) {
@@ -44,6 +88,31 @@ void fill_random(double* matrix, int n) {
 // Thread function for matrix multiplication
 void* matrix_multiply(void* arg) {
     ThreadData* data = static_cast<ThreadData*>(arg);
+    CACHESIM_ATTACH(data->sim);
+    trace_thread_name("rows " + to_string(data->start_row) + "-" + to_string(data->end_row));
+    TRACE_BEGIN("rows", data->start_row);
+    for (int i = data->start_row; i < data->end_row; ++i) {
+        for (int j = 0; j < data->n; ++j) {
+            double sum = 0.0;
+            for (int k = 0; k < data->n; ++k) {
+                CACHESIM_LOAD(&data->A[i * data->n + k], sizeof(double));
+                CACHESIM_LOAD(&data->B[k * data->n + j], sizeof(double));
+                sum += data->A[i * data->n + k] * data->B[k * data->n + j];
+            }
+            CACHESIM_LOAD(&data->C[i * data->n + j], sizeof(double));
+            data->C[i * data->n + j] += sum;
+            CACHESIM_STORE(&data->C[i * data->n + j], sizeof(double));
+        }
+    }
+    TRACE_END("rows");
+    CACHESIM_ATTACH(nullptr);
+    pthread_exit(nullptr);
+}
+
+// Same multiplication, logging every ThreadData read and C write
+void* matrix_multiply_traced(void* arg) {
+    ThreadData* data = static_cast<ThreadData*>(arg);
+    trace_access(data->trace, data, sizeof(ThreadData), 1);
     for (int i = data->start_row; i < data->end_row; ++i) {
         for (int j = 0; j < data->n; ++j) {
             double sum = 0.0;
@@ -51,14 +120,129 @@ void* matrix_multiply(void* arg) {
                 sum += data->A[i * data->n + k] * data->B[k * data->n + j];
             }
             data->C[i * data->n + j] += sum;
+            trace_access(data->trace, &data->C[i * data->n + j], sizeof(double), 2);
         }
     }
     pthread_exit(nullptr);
 }
 
-int main() {
+// Named address range used to attribute a cache line to its data structure
+struct TracedObject {
+    const char* name;
+    const void* base;
+    size_t size;
+    size_t stride;  // element size for arrays of per-thread entries, 0 otherwise
+};
+
+static string owner_of(uintptr_t addr, const vector<TracedObject>& objects) {
+    for (const TracedObject& obj : objects) {
+        uintptr_t base = (uintptr_t)obj.base;
+        if (addr < base || addr >= base + obj.size) continue;
+        string owner = obj.name;
+        if (obj.stride) {
+            owner += "[" + to_string((addr - base) / obj.stride) + "]";
+        } else {
+            // Byte offset of the line inside the matrix
+            owner += " offset " + to_string(addr - base);
+        }
+        return owner;
+    }
+    return "?";
+}
+
+// Report lines that one thread wrote while another was using them
+void report_shared_lines(const vector<WriteTrace>& traces, const WriteTrace& setup,
+                         const vector<TracedObject>& objects, int n) {
+    unordered_map<uintptr_t, vector<pair<int, unsigned char>>> users;
+    for (size_t t = 0; t < traces.size(); ++t) {
+        for (const auto& line : traces[t].lines) {
+            users[line.first].push_back({(int)t, line.second});
+        }
+    }
+
+    int contended = 0;
+    unordered_map<string, int> per_object;
+    vector<string> examples;
+    for (const auto& entry : users) {
+        const auto& list = entry.second;
+        bool written = false;
+        for (const auto& user : list) written |= (user.second & 2) != 0;
+        bool shared = list.size() > 1 && written;
+
+        // Main wrote this line after some worker that uses it had already started
+        auto setup_write = setup.epoch.find(entry.first);
+        if (!shared && setup_write != setup.epoch.end()) {
+            for (const auto& user : list) shared |= user.first < setup_write->second;
+        }
+        if (!shared) continue;
+
+        contended++;
+        string owner = owner_of(entry.first * CACHE_LINE, objects);
+        per_object[owner.substr(0, owner.find_first_of("[ "))]++;
+        if (examples.size() < 8) {
+            string who;
+            for (const auto& user : list) {
+                who += " t" + to_string(user.first) + ((user.second & 2) ? "(w)" : "(r)");
+            }
+            if (setup_write != setup.epoch.end()) who += " main(w)";
+            examples.push_back(owner + ":" + who);
+        }
+    }
+
+    cout << "Write tracer: " << contended << " cache lines shared between threads with at least one writer" << endl;
+    for (const auto& obj : per_object) {
+        cout << "  " << obj.first << ": " << obj.second << " lines" << endl;
+    }
+    for (const string& example : examples) {
+        cout << "    " << example << endl;
+    }
+    if (n * sizeof(double) % CACHE_LINE != 0) {
+        cout << "  (rows of C are " << n * sizeof(double) << " bytes, so row blocks of neighbouring threads"
+             << " meet inside a cache line)" << endl;
+    }
+}
+
+// Publish object ranges so cpr4 -c can name the structures owning contended lines
+// The name is predictable and /tmp is world-writable, so the list goes to a
+// fresh mkstemp() file renamed over it: rename() replaces a planted symlink
+// instead of writing through it
+void publish_objects(const vector<TracedObject>& objects) {
+    string path = "/tmp/cpr4-" + to_string(getpid()) + ".objects";
+    string temp = path + ".XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    FILE* out = fd < 0 ? NULL : fdopen(fd, "w");
+    if (out == NULL) {
+        perror(temp.c_str());
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp.c_str());
+        }
+        return;
+    }
+    for (const TracedObject& obj : objects) {
+        fprintf(out, "%lx %lx %s\n", (unsigned long)(uintptr_t)obj.base, (unsigned long)obj.size, obj.name);
+    }
+    if (fclose(out) != 0 || rename(temp.c_str(), path.c_str()) != 0) {
+        perror(path.c_str());
+        unlink(temp.c_str());
+    }
+}
+
+int main(int argc, char** argv) {
     srand(static_cast<unsigned>(time(0)));
     string input;
+    bool padded = false, trace_writes = false, objects_file = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--padded") == 0) padded = true;
+        else if (strcmp(argv[i], "--trace-writes") == 0) trace_writes = true;
+        else if (strcmp(argv[i], "--objects") == 0) objects_file = true;
+        else {
+            cerr << "Usage: " << argv[0] << " [--padded] [--trace-writes] [--objects]" << endl;
+            return 1;
+        }
+    }
+    cout << "ThreadData layout: " << (padded ? "padded (" : "packed (") 
+         << (padded ? sizeof(PaddedThreadData) : sizeof(ThreadData)) << " bytes per entry)" << endl;
 
     while (true) {
         int n, block_size = 0, thread_count = 0;
@@ -105,30 +289,66 @@ int main() {
             continue;
         }
 
-        double* A = new double[n * n];
-        double* B = new double[n * n];
-        double* C = new double[n * n];
+        double* A = alloc_matrix(n * n);
+        double* B = alloc_matrix(n * n);
+        double* C = alloc_matrix(n * n);
 
         fill_random(A, n);
         fill_random(B, n);
-        fill(C, C + n * n, 0.0);
 
         pthread_t* threads = new pthread_t[thread_count];
-        ThreadData* thread_data = new ThreadData[thread_count];
+        ThreadData* packed_data = padded ? nullptr : new ThreadData[thread_count];
+        PaddedThreadData* padded_data = padded ? new PaddedThreadData[thread_count] : nullptr;
+        size_t stride = padded ? sizeof(PaddedThreadData) : sizeof(ThreadData);
+        auto thread_data = [&](int i) -> ThreadData& {
+            return padded ? padded_data[i] : packed_data[i];
+        };
+
+        vector<WriteTrace> traces(trace_writes ? thread_count : 0);
+        WriteTrace setup_trace;
+        vector<TracedObject> objects = {
+            {"A", A, n * n * sizeof(double), 0},
+            {"B", B, n * n * sizeof(double), 0},
+            {"C", C, n * n * sizeof(double), 0},
+            {"thread_data", &thread_data(0), thread_count * stride, stride},
+        };
+        if (objects_file) {
+            publish_objects(objects);
+        }
 
+#ifdef CACHESIM
+        vector<unique_ptr<CacheSim>> sims;
+        for (int i = 0; i < thread_count; ++i) {
+            sims.emplace_back(new CacheSim());
+            sims[i]->name("A", A, n * n * sizeof(double));
+            sims[i]->name("B", B, n * n * sizeof(double));
+            sims[i]->name("C", C, n * n * sizeof(double));
+        }
+#endif
+
+        TlbCounters tlb = tlb_counters_start();
         auto start = chrono::high_resolution_clock::now();
 
         // Distributing work among threads
         int rows_per_thread = n / thread_count;
         for (int i = 0; i < thread_count; ++i) {
-            thread_data[i].A = A;
-            thread_data[i].B = B;
-            thread_data[i].C = C;
-            thread_data[i].n = n;
-            thread_data[i].start_row = i * rows_per_thread;
-            thread_data[i].end_row = (i == thread_count - 1) ? n : (i + 1) * rows_per_thread;
-
-            int create_status = pthread_create(&threads[i], NULL, matrix_multiply, (void*)&thread_data[i]);
+            ThreadData& td = thread_data(i);
+            td.A = A;
+            td.B = B;
+            td.C = C;
+            td.n = n;
+            td.start_row = i * rows_per_thread;
+            td.end_row = (i == thread_count - 1) ? n : (i + 1) * rows_per_thread;
+            td.trace = trace_writes ? &traces[i] : nullptr;
+#ifdef CACHESIM
+            td.sim = sims[i].get();
+#endif
+            if (trace_writes) {
+                trace_access(&setup_trace, &td, sizeof(ThreadData), 2, i);
+            }
+
+            int create_status = pthread_create(&threads[i], NULL, trace_writes ? matrix_multiply_traced : matrix_multiply,
+                                               (void*)&td);
             if (create_status) {
                 fprintf(stderr, "Error - pthread_create() return code: %d\n", create_status);
                 exit(EXIT_FAILURE);
@@ -136,19 +356,31 @@ int main() {
         }
 
         // Joining threads
+        TRACE_BEGIN("join");
         for (int i = 0; i < thread_count; ++i) {
             pthread_join(threads[i], nullptr);
         }
+        TRACE_END("join");
 
         auto end = chrono::high_resolution_clock::now();
         chrono::duration<double> elapsed = end - start;
-        cout << "Completed multiplication with multithreaded algorithm in " << elapsed.count() << " seconds." << endl;
+        cout << "Completed multiplication with multithreaded algorithm in " << elapsed.count() << " seconds"
+             << tlb_counters_stop(tlb) << ", matrices backed by " << matrix_backing(A) << "." << endl;
+        if (trace_writes) {
+            report_shared_lines(traces, setup_trace, objects, n);
+        }
+#ifdef CACHESIM
+        for (int i = 0; i < thread_count; ++i) {
+            cout << "Simulated caches, thread " << i << ":" << endl << sims[i]->report();
+        }
+#endif
 
-        delete[] A;
-        delete[] B;
-        delete[] C;
+        free_matrix(A);
+        free_matrix(B);
+        free_matrix(C);
         delete[] threads;
-        delete[] thread_data;
+        delete[] packed_data;
+        delete[] padded_data;
     }
 
     return 0;
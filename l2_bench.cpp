@@ -0,0 +1,169 @@
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sys/sysinfo.h>
+#include "tbb/task_arena.h"
+#include "matalloc.h"
+#include "dgemm_pthread.h"
+#include "dgemm_tbb.h"
+#include "dgemm_omp.h"
+
+//compile with -O2 -march=native -fopenmp -pthread -ltbb
+//Runs the same packed kernel under pthreads, TBB and OpenMP on identical
+//matrices and tiling, so only the threading model differs between rows.
+
+using namespace std;
+
+// Fill a matrix with random values
+void fill_random(double* matrix, int n) {
+    if (matrix == nullptr) {
+        cerr << "Error: Matrix is not allocated properly!" << endl;
+        return;
+    }
+
+    for (int i = 0; i < n * n; ++i) {
+        double random_value;
+        do {
+            random_value = static_cast<double>(rand());
+        } while (random_value == 0.0);
+
+        matrix[i] = 1.0 / random_value;
+    }
+}
+
+// Largest difference relative to the largest entry of the reference
+double max_rel_diff(int n, const double* X, const double* ref) {
+    double d = 0.0, scale = 0.0;
+    for (int i = 0; i < n * n; ++i) {
+        d = max(d, fabs(X[i] - ref[i]));
+        scale = max(scale, fabs(ref[i]));
+    }
+    return scale > 0.0 ? d / scale : d;
+}
+
+struct Backend {
+    string name;
+    function<void(int n, int bs, double* A, double* B, double* C, int threads)> run;
+    function<void(int threads)> prepare;  // untimed set-up before run, if any
+};
+
+// One arena per thread count for the whole session, started before it is
+// timed, and the affinity partitioner that records slots in that arena
+struct Arena {
+    explicit Arena(int threads) : arena(threads) { arena.initialize(); }
+    tbb::task_arena arena;
+    tbb::affinity_partitioner affinity;
+};
+
+int main() {
+    srand(static_cast<unsigned>(time(0)));
+    string input;
+    map<int, unique_ptr<Arena>> arenas;
+    auto arena_for = [&arenas](int threads) -> Arena& {
+        unique_ptr<Arena>& arena = arenas[threads];
+        if (!arena) arena.reset(new Arena(threads));
+        return *arena;
+    };
+
+    vector<Backend> backends = {
+        {"pthread", [](int n, int bs, double* A, double* B, double* C, int t) {
+             multiply_pthread(n, bs, A, B, C, t);
+         }, nullptr},
+    };
+    for (int k = PART_AUTO; k <= PART_STATIC; ++k) {
+        backends.push_back({string("tbb ") + partitioner_names[k],
+                            [k, &arena_for](int n, int bs, double* A, double* B, double* C, int t) {
+                                Arena& arena = arena_for(t);
+                                arena.arena.execute(
+                                    [&] { multiply_tbb(n, bs, A, B, C, (PartitionerKind)k, arena.affinity); });
+                            },
+                            [&arena_for](int t) { arena_for(t); }});
+    }
+    for (int m = OMP_FOR; m <= OMP_SIMD; ++m) {
+        backends.push_back({string("omp ") + omp_mode_names[m],
+                            [m](int n, int bs, double* A, double* B, double* C, int t) {
+                                multiply_omp(n, bs, A, B, C, t, (OmpMode)m);
+                            }, nullptr});
+    }
+
+    while (true) {
+        int n, block_size = 0;
+        int thread_count = get_nprocs(); // Retrieve max threads
+        cout << "\nEnter command (EXIT to quit):" << endl
+             << "Format: [SIZE] [BLOCK_SIZE] [THREADS], max threads " << thread_count
+             << " (use 'm' for max threads)" << endl
+             << "Example: 1000 64 4" << endl
+             << "> ";
+
+        getline(cin, input);
+        if (input == "EXIT") break;
+
+        istringstream iss(input);
+        vector<string> tokens{istream_iterator<string>{iss}, istream_iterator<string>{}};
+
+        if (tokens.size() < 2) {
+            cerr << "Invalid input! Minimum 2 parameters required" << endl;
+            continue;
+        }
+
+        try {
+            n = stoi(tokens[0]);
+            if (n <= 0) throw invalid_argument("Size must be positive");
+
+            block_size = stoi(tokens[1]);
+            if (block_size <= 0) throw invalid_argument("Block size must be positive");
+
+            if (tokens.size() > 2 && tokens[2] != "m" && tokens[2] != "M") {
+                thread_count = stoi(tokens[2]);
+                if (thread_count <= 0) throw invalid_argument("Thread count must be positive");
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            continue;
+        }
+
+        double* A = alloc_matrix(n * n);
+        double* B = alloc_matrix(n * n);
+        double* C = alloc_matrix(n * n);
+        double* ref = alloc_matrix(n * n);
+
+        fill_random(A, n);
+        fill_random(B, n);
+
+        printf("%d x %d, block %d, tile %d, %d threads, matrices backed by %s\n", n, n, block_size,
+               block_size * TILE_BLOCKS, thread_count, matrix_backing(A));
+        printf("%-14s %10s %10s %12s\n", "back-end", "seconds", "GFLOP/s", "rel diff");
+        for (size_t b = 0; b < backends.size(); ++b) {
+            double* out = b == 0 ? ref : C;
+            fill(out, out + (size_t)n * n, 0.0);
+
+            if (backends[b].prepare) backends[b].prepare(thread_count);
+            TlbCounters tlb = tlb_counters_start();
+            auto start = chrono::high_resolution_clock::now();
+            backends[b].run(n, block_size, A, B, out, thread_count);
+            auto end = chrono::high_resolution_clock::now();
+            string counters = tlb_counters_stop(tlb);
+
+            chrono::duration<double> elapsed = end - start;
+            double gflops = 2.0 * n * n * n / elapsed.count() * 1e-9;
+            printf("%-14s %10.4f %10.2f %12.2e%s\n", backends[b].name.c_str(), elapsed.count(), gflops,
+                   b == 0 ? 0.0 : max_rel_diff(n, out, ref), counters.c_str());
+        }
+
+        free_matrix(A);
+        free_matrix(B);
+        free_matrix(C);
+        free_matrix(ref);
+    }
+
+    return 0;
+}
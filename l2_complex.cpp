@@ -0,0 +1,167 @@
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <sys/sysinfo.h>
+#include "matalloc.h"
+#include "threadpool.h"
+#include "zgemm.h"
+
+//compile with -O2 -march=native -pthread
+//Complex products on the pool: interleaved ZGEMM and CGEMM micro-kernels and
+//the split-layout 4M and 3M algorithms, each checked against a plain triple
+//loop. GFLOP/s counts 8 real flops per complex multiply-add for all of them.
+
+using namespace std;
+
+typedef complex<double> zdouble;
+typedef complex<float> zfloat;
+
+// Fill a complex matrix with random values
+void fill_random(zdouble* matrix, int n) {
+    for (int i = 0; i < n * n; ++i) {
+        matrix[i] = zdouble((rand() % 2001 - 1000) * 1e-3, (rand() % 2001 - 1000) * 1e-3);
+    }
+}
+
+// Reference: C += A * B, no blocking, no SIMD
+void zgemm_base(int n, const zdouble* A, const zdouble* B, zdouble* C) {
+    for (int i = 0; i < n; ++i)
+        for (int k = 0; k < n; ++k) {
+            zdouble a = A[i * n + k];
+            for (int j = 0; j < n; ++j) C[i * n + j] += a * B[k * n + j];
+        }
+}
+
+// Largest difference relative to the largest entry of the reference
+template <class T>
+double max_rel_diff(int n, const T* X, const zdouble* ref) {
+    double d = 0.0, scale = 0.0;
+    for (int i = 0; i < n * n; ++i) {
+        d = max(d, abs(zdouble(X[i]) - ref[i]));
+        scale = max(scale, abs(ref[i]));
+    }
+    return scale > 0.0 ? d / scale : d;
+}
+
+int main() {
+    srand(static_cast<unsigned>(time(0)));
+    string input;
+
+    while (true) {
+        int n, block_size = 0;
+        int thread_count = get_nprocs(); // Retrieve max threads
+        cout << "\nEnter command (EXIT to quit):" << endl
+             << "Format: [SIZE] [BLOCK_SIZE] [THREADS], max threads " << thread_count
+             << " (use 'm' for max threads)" << endl
+             << "Example: 500 64 4" << endl
+             << "> ";
+
+        getline(cin, input);
+        if (input == "EXIT") break;
+
+        istringstream iss(input);
+        vector<string> tokens{istream_iterator<string>{iss}, istream_iterator<string>{}};
+
+        if (tokens.size() < 2) {
+            cerr << "Invalid input! Minimum 2 parameters required" << endl;
+            continue;
+        }
+
+        try {
+            n = stoi(tokens[0]);
+            if (n <= 0) throw invalid_argument("Size must be positive");
+
+            block_size = stoi(tokens[1]);
+            if (block_size <= 0) throw invalid_argument("Block size must be positive");
+
+            if (tokens.size() > 2 && tokens[2] != "m" && tokens[2] != "M") {
+                thread_count = stoi(tokens[2]);
+                if (thread_count <= 0) throw invalid_argument("Thread count must be positive");
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            continue;
+        }
+
+        ThreadPool pool(thread_count);
+        size_t elems = (size_t)n * n;
+        zdouble* A = reinterpret_cast<zdouble*>(alloc_matrix(2 * elems));
+        zdouble* B = reinterpret_cast<zdouble*>(alloc_matrix(2 * elems));
+        zdouble* C = reinterpret_cast<zdouble*>(alloc_matrix(2 * elems));
+        zdouble* ref = reinterpret_cast<zdouble*>(alloc_matrix(2 * elems));
+        fill_random(A, n);
+        fill_random(B, n);
+
+        // the same operands split into real and imaginary parts, and in single precision
+        double* split = alloc_matrix(6 * elems);
+        double *Ar = split, *Ai = split + elems, *Br = split + 2 * elems, *Bi = split + 3 * elems;
+        double *Cr = split + 4 * elems, *Ci = split + 5 * elems;
+        zfloat* Af = reinterpret_cast<zfloat*>(alloc_matrix(elems));
+        zfloat* Bf = reinterpret_cast<zfloat*>(alloc_matrix(elems));
+        zfloat* Cf = reinterpret_cast<zfloat*>(alloc_matrix(elems));
+        for (size_t e = 0; e < elems; ++e) {
+            Ar[e] = A[e].real();
+            Ai[e] = A[e].imag();
+            Br[e] = B[e].real();
+            Bi[e] = B[e].imag();
+            Af[e] = zfloat(A[e]);
+            Bf[e] = zfloat(B[e]);
+        }
+
+        struct Variant {
+            string name;
+            function<void()> run;
+            function<double()> check;
+        };
+        vector<Variant> variants = {
+            {"reference", [&] { zgemm_base(n, A, B, ref); }, [] { return 0.0; }},
+            {"zgemm", [&] { zgemm_pool(pool, n, n, n, A, n, B, n, C, n, block_size); },
+             [&] { return max_rel_diff(n, C, ref); }},
+            {"zgemm 4M split", [&] { zgemm_split_4m(pool, n, n, n, Ar, Ai, n, Br, Bi, n, Cr, Ci, n, block_size); },
+             [&] {
+                 for (size_t e = 0; e < elems; ++e) C[e] = zdouble(Cr[e], Ci[e]);
+                 return max_rel_diff(n, C, ref);
+             }},
+            {"zgemm 3M split", [&] { zgemm_split_3m(pool, n, n, n, Ar, Ai, n, Br, Bi, n, Cr, Ci, n, block_size); },
+             [&] {
+                 for (size_t e = 0; e < elems; ++e) C[e] = zdouble(Cr[e], Ci[e]);
+                 return max_rel_diff(n, C, ref);
+             }},
+            {"cgemm", [&] { cgemm_pool(pool, n, n, n, Af, n, Bf, n, Cf, n, block_size); },
+             [&] { return max_rel_diff(n, Cf, ref); }},
+        };
+
+        printf("%d x %d complex, block %d, tile %d, %d threads\n", n, n, block_size, block_size * TILE_BLOCKS,
+               thread_count);
+        printf("%-16s %10s %10s %12s\n", "variant", "seconds", "GFLOP/s", "rel diff");
+        for (Variant& v : variants) {
+            fill(C, C + elems, zdouble(0.0));
+            fill(Cr, Cr + 2 * elems, 0.0);
+            fill(Cf, Cf + elems, zfloat(0.0f));
+            auto start = chrono::high_resolution_clock::now();
+            v.run();
+            chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+            double gflops = 8.0 * n * n * n / elapsed.count() * 1e-9;
+            printf("%-16s %10.4f %10.2f %12.2e\n", v.name.c_str(), elapsed.count(), gflops, v.check());
+        }
+
+        free_matrix(reinterpret_cast<double*>(A));
+        free_matrix(reinterpret_cast<double*>(B));
+        free_matrix(reinterpret_cast<double*>(C));
+        free_matrix(reinterpret_cast<double*>(ref));
+        free_matrix(split);
+        free_matrix(reinterpret_cast<double*>(Af));
+        free_matrix(reinterpret_cast<double*>(Bf));
+        free_matrix(reinterpret_cast<double*>(Cf));
+    }
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <sys/sysinfo.h>
+#include "matalloc.h"
+#include "threadpool.h"
+#include "dgemm_shape.h"
+#include "conv.h"
+
+//compile with -O2 -march=native -pthread
+//2D convolution, "same" padding: explicit im2col plus the shape-aware GEMM
+//against implicit im2col (conv.h), in NCHW and NHWC, each checked against a
+//direct loop nest. "extra MB" is what a variant allocates besides the tensors;
+//the explicit lowering reuses one patch matrix for the whole batch.
+
+using namespace std;
+
+// Fill a tensor with random values
+void fill_random(double* data, size_t count) {
+    for (size_t i = 0; i < count; ++i) data[i] = (rand() % 2001 - 1000) * 1e-3;
+}
+
+// Reference: NCHW/OIHW convolution as a plain loop nest
+void conv_direct(const ConvShape& s, const double* X, const double* Wt, double* Y) {
+    int P = s.P(), Q = s.Q();
+    for (int n = 0; n < s.N; ++n)
+        for (int k = 0; k < s.K; ++k)
+            for (int p = 0; p < P; ++p)
+                for (int q = 0; q < Q; ++q) {
+                    double sum = 0.0;
+                    for (int c = 0; c < s.C; ++c)
+                        for (int r = 0; r < s.R; ++r)
+                            for (int t = 0; t < s.S; ++t) {
+                                int ih = p * s.strideH - s.padH + r * s.dilH, iw = q * s.strideW - s.padW + t * s.dilW;
+                                if (ih < 0 || ih >= s.H || iw < 0 || iw >= s.W) continue;
+                                sum += X[(((size_t)n * s.C + c) * s.H + ih) * s.W + iw] *
+                                       Wt[(((size_t)k * s.C + c) * s.R + r) * s.S + t];
+                            }
+                    Y[(((size_t)n * s.K + k) * P + p) * Q + q] = sum;
+                }
+}
+
+// Explicit lowering of one image: the (C*R*S) x (P*Q) patch matrix for NCHW,
+// its transpose (P*Q) x (R*S*C) for NHWC
+void im2col(const ConvShape& s, ConvLayout layout, const double* X, double* col) {
+    int P = s.P(), Q = s.Q(), crs = s.reduction();
+    for (int p = 0; p < P; ++p)
+        for (int q = 0; q < Q; ++q)
+            for (int c = 0; c < s.C; ++c)
+                for (int r = 0; r < s.R; ++r)
+                    for (int t = 0; t < s.S; ++t) {
+                        int ih = p * s.strideH - s.padH + r * s.dilH, iw = q * s.strideW - s.padW + t * s.dilW;
+                        bool in = ih >= 0 && ih < s.H && iw >= 0 && iw < s.W;
+                        if (layout == CONV_NCHW)
+                            col[((size_t)(c * s.R + r) * s.S + t) * P * Q + p * Q + q] =
+                                in ? X[((size_t)c * s.H + ih) * s.W + iw] : 0.0;
+                        else
+                            col[(size_t)(p * Q + q) * crs + (r * s.S + t) * s.C + c] =
+                                in ? X[((size_t)ih * s.W + iw) * s.C + c] : 0.0;
+                    }
+}
+
+void conv2d_explicit(ThreadPool& pool, const ConvShape& s, ConvLayout layout, const double* X, double* Wt,
+                     double* Y, double* col, double* WtT, int bs) {
+    int PQ = s.P() * s.Q(), crs = s.reduction();
+    size_t in = (size_t)s.C * s.H * s.W, out = (size_t)s.K * PQ;
+    fill(Y, Y + s.N * out, 0.0);
+    for (int n = 0; n < s.N; ++n) {
+        im2col(s, layout, X + n * in, col);
+        if (layout == CONV_NCHW)
+            dgemm_shape_pool(pool, s.K, PQ, crs, Wt, crs, col, PQ, Y + n * out, PQ, bs);
+        else
+            dgemm_shape_pool(pool, PQ, s.K, crs, col, crs, WtT, s.K, Y + n * out, s.K, bs);
+    }
+}
+
+// Largest difference relative to the largest entry of the reference
+double max_rel_diff(size_t count, const double* X, const double* ref) {
+    double d = 0.0, scale = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        d = max(d, fabs(X[i] - ref[i]));
+        scale = max(scale, fabs(ref[i]));
+    }
+    return scale > 0.0 ? d / scale : d;
+}
+
+double seconds(const function<void()>& run) {
+    auto start = chrono::high_resolution_clock::now();
+    run();
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+int main() {
+    srand(static_cast<unsigned>(time(0)));
+    string input;
+
+    while (true) {
+        ConvShape s{};
+        int block_size = 0;
+        int thread_count = get_nprocs(); // Retrieve max threads
+        cout << "\nEnter command (EXIT to quit):" << endl
+             << "Format: [BATCH] [SIZE] [CHANNELS] [FILTERS] [KERNEL] [STRIDE] [BLOCK_SIZE] [THREADS], max threads "
+             << thread_count << " (use 'm' for max threads)" << endl
+             << "Example: 4 56 64 64 3 1 64 4" << endl
+             << "> ";
+
+        getline(cin, input);
+        if (input == "EXIT") break;
+
+        istringstream iss(input);
+        vector<string> tokens{istream_iterator<string>{iss}, istream_iterator<string>{}};
+
+        if (tokens.size() < 7) {
+            cerr << "Invalid input! Minimum 7 parameters required" << endl;
+            continue;
+        }
+
+        try {
+            s.N = stoi(tokens[0]);
+            s.H = s.W = stoi(tokens[1]);
+            s.C = stoi(tokens[2]);
+            s.K = stoi(tokens[3]);
+            s.R = s.S = stoi(tokens[4]);
+            s.strideH = s.strideW = stoi(tokens[5]);
+            if (s.N <= 0 || s.H <= 0 || s.C <= 0 || s.K <= 0 || s.R <= 0 || s.strideH <= 0)
+                throw invalid_argument("Sizes must be positive");
+            s.padH = s.padW = s.R / 2;
+            s.dilH = s.dilW = 1;
+
+            block_size = stoi(tokens[6]);
+            if (block_size <= 0) throw invalid_argument("Block size must be positive");
+
+            if (tokens.size() > 7 && tokens[7] != "m" && tokens[7] != "M") {
+                thread_count = stoi(tokens[7]);
+                if (thread_count <= 0) throw invalid_argument("Thread count must be positive");
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            continue;
+        }
+
+        ThreadPool pool(thread_count);
+        int P = s.P(), Q = s.Q(), crs = s.reduction();
+        size_t in = (size_t)s.N * s.C * s.H * s.W, weights = (size_t)s.K * crs, out = (size_t)s.N * s.K * P * Q;
+        double* X = alloc_matrix(in);
+        double* Wt = alloc_matrix(weights);
+        double* ref = alloc_matrix(out);
+        double* Y = alloc_matrix(out);
+        fill_random(X, in);
+        fill_random(Wt, weights);
+
+        // the same tensors in NHWC / OHWI, and the references permuted to NHWC
+        double* Xh = alloc_matrix(in);
+        double* Wh = alloc_matrix(weights);
+        double* refh = alloc_matrix(out);
+        double* WhT = alloc_matrix(weights);  // OHWI transposed, for the explicit NHWC product
+        for (int n = 0; n < s.N; ++n)
+            for (int c = 0; c < s.C; ++c)
+                for (int h = 0; h < s.H; ++h)
+                    for (int w = 0; w < s.W; ++w)
+                        Xh[(((size_t)n * s.H + h) * s.W + w) * s.C + c] = X[(((size_t)n * s.C + c) * s.H + h) * s.W + w];
+        for (int k = 0; k < s.K; ++k)
+            for (int c = 0; c < s.C; ++c)
+                for (int r = 0; r < s.R * s.S; ++r) {
+                    Wh[((size_t)k * s.R * s.S + r) * s.C + c] = Wt[((size_t)k * s.C + c) * s.R * s.S + r];
+                    WhT[((size_t)r * s.C + c) * s.K + k] = Wt[((size_t)k * s.C + c) * s.R * s.S + r];
+                }
+        double* col = alloc_matrix((size_t)crs * P * Q);
+        size_t col_bytes = sizeof(double) * crs * P * Q;
+
+        double direct = seconds([&] { conv_direct(s, X, Wt, ref); });
+        for (int n = 0; n < s.N; ++n)
+            for (int k = 0; k < s.K; ++k)
+                for (int p = 0; p < P * Q; ++p)
+                    refh[((size_t)n * P * Q + p) * s.K + k] = ref[((size_t)n * s.K + k) * P * Q + p];
+
+        printf("%d x %d x %d x %d, %d filters %dx%d stride %d -> %d x %d, block %d, %d threads\n", s.N, s.C, s.H, s.W,
+               s.K, s.R, s.S, s.strideH, P, Q, block_size, thread_count);
+        printf("%-16s %10s %10s %10s %12s\n", "variant", "seconds", "GFLOP/s", "extra MB", "rel diff");
+        auto row = [&](const char* name, double sec, size_t bytes, const double* result, const double* expected) {
+            printf("%-16s %10.4f %10.2f %10.2f %12.2e\n", name, sec, s.flops() / sec * 1e-9, bytes / 1048576.0,
+                   result ? max_rel_diff(out, result, expected) : 0.0);
+        };
+        row("direct", direct, 0, NULL, NULL);
+        row("im2col NCHW", seconds([&] { conv2d_explicit(pool, s, CONV_NCHW, X, Wt, Y, col, NULL, block_size); }),
+            col_bytes, Y, ref);
+        row("implicit NCHW", seconds([&] { conv2d_implicit(pool, s, CONV_NCHW, X, Wt, Y, block_size); }),
+            conv_implicit_bytes(s, block_size, thread_count), Y, ref);
+        row("im2col NHWC", seconds([&] { conv2d_explicit(pool, s, CONV_NHWC, Xh, Wh, Y, col, WhT, block_size); }),
+            col_bytes + sizeof(double) * weights, Y, refh);
+        row("implicit NHWC", seconds([&] { conv2d_implicit(pool, s, CONV_NHWC, Xh, Wh, Y, block_size); }),
+            conv_implicit_bytes(s, block_size, thread_count), Y, refh);
+
+        free_matrix(X);
+        free_matrix(Wt);
+        free_matrix(ref);
+        free_matrix(Y);
+        free_matrix(Xh);
+        free_matrix(Wh);
+        free_matrix(refh);
+        free_matrix(WhT);
+        free_matrix(col);
+    }
+
+    return 0;
+}
@@ -2,15 +2,22 @@
 #include <ctime>
 #include <cstdlib>
 #include <chrono>
+#include <map>
+#include <memory>
 #include <vector>
 #include <sstream>
 #include <iterator>
 #include <tbb/tbb.h>
-#include "tbb/blocked_range.h"
+#include "tbb/blocked_range2d.h"
 #include "tbb/parallel_for.h"
-#include "tbb/task_scheduler_init.h"
+#include "tbb/partitioner.h"
+#include "tbb/task_arena.h"
 #include <iostream>
 #include <vector>
+#include "matalloc.h"
+#include "dgemm_tbb.h"
+
+//compile with -O2 -march=native -ltbb
 
 using namespace std; //https://github.com/wjakob/tbb/tree/master
 using namespace tbb;
@@ -37,13 +44,24 @@ void fill_random(double* matrix, int n) {
 int main() {
     srand(static_cast<unsigned>(time(0)));
     string input;
+    // An affinity_partitioner records which arena slot ran each subrange, so
+    // it only means something for the arena it was used in: keep one arena,
+    // with its own partitioner, per thread count for the whole session
+    struct Arena {
+        explicit Arena(int threads) : arena(threads) {}
+        task_arena arena;
+        affinity_partitioner affinity;
+    };
+    map<int, unique_ptr<Arena>> arenas;
 
     while (true) {
         int n, block_size = 0;
-        int thread_count = task_scheduler_init::default_num_threads(); // Retrieve max threads
+        PartitionerKind partitioner = PART_AUTO;
+        int thread_count = this_task_arena::max_concurrency(); // Retrieve max threads
         cout << "\nEnter command (EXIT to quit):" << endl
-             << "Format: [SIZE] [BLOCK_SIZE] or " << thread_count << " (use 'm' for max threads)" << endl
-             << "Example: 1000 64 or 4" << endl
+             << "Format: [SIZE] [BLOCK_SIZE] [THREADS] [auto|affinity|static|simple], max threads " << thread_count
+             << " (use 'm' for max threads)" << endl
+             << "Example: 1000 64 4 affinity" << endl
              << "> ";
 
         getline(cin, input);
@@ -67,7 +85,7 @@ int main() {
             if (tokens.size() > 2) {
                 string third_param = tokens[2];
                 if (third_param == "m" || third_param == "M") {
-                    thread_count = task_scheduler_init::default_num_threads(); // Retrieve max threads
+                    thread_count = this_task_arena::max_concurrency(); // Retrieve max threads
                     cout << "Using maximum threads: " << thread_count << endl;
                 } else {
                     thread_count = stoi(third_param);
@@ -77,39 +95,45 @@ int main() {
                 cout << "Using default thread count: 4" << endl;
                 thread_count = 4;
             }
+
+            if (tokens.size() > 3) {
+                int k = 0;
+                while (k < 4 && tokens[3] != partitioner_names[k]) ++k;
+                if (k == 4) throw invalid_argument("Partitioner must be auto, affinity, static or simple");
+                partitioner = (PartitionerKind)k;
+            }
         } catch (const exception& e) {
             cerr << "Error: " << e.what() << endl;
             continue;
         }
 
-        double* A = new double[n * n];
-        double* B = new double[n * n];
-        double* C = new double[n * n];
+        double* A = alloc_matrix(n * n);
+        double* B = alloc_matrix(n * n);
+        double* C = alloc_matrix(n * n);
 
         fill_random(A, n);
         fill_random(B, n);
-        fill(C, C + n * n, 0.0);
 
+        TlbCounters tlb = tlb_counters_start();
         auto start = chrono::high_resolution_clock::now();
 
-        // Using Intel TBB for parallel matrix multiplication
-        parallel_for(0, n, 1, [&](int i) {
-            for (int j = 0; j < n; ++j) {
-                double sum = 0.0;
-                for (int k = 0; k < n; ++k) {
-                    sum += A[i * n + k] * B[k * n + j];
-                }
-                C[i * n + j] += sum;
-            }
+        // Using Intel TBB for parallel matrix multiplication, limited to the
+        // requested number of threads by running inside an arena of that size
+        unique_ptr<Arena>& arena = arenas[thread_count];
+        if (!arena) arena.reset(new Arena(thread_count));
+        arena->arena.execute([&] {
+            multiply_tbb(n, block_size, A, B, C, partitioner, arena->affinity);
         });
 
         auto end = chrono::high_resolution_clock::now();
         chrono::duration<double> elapsed = end - start;
-        cout << "Completed multiplication with Intel TBB in " << elapsed.count() << " seconds." << endl;
+        cout << "Completed multiplication with Intel TBB (" << thread_count << " threads, "
+             << partitioner_names[partitioner] << " partitioner) in " << elapsed.count() << " seconds"
+             << tlb_counters_stop(tlb) << ", matrices backed by " << matrix_backing(A) << "." << endl;
 
-        delete[] A;
-        delete[] B;
-        delete[] C;
+        free_matrix(A);
+        free_matrix(B);
+        free_matrix(C);
     }
 
     return 0;
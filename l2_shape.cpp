@@ -0,0 +1,148 @@
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <sys/sysinfo.h>
+#include "matalloc.h"
+#include "threadpool.h"
+#include "dgemm_shape.h"
+
+//compile with -O2 -march=native -pthread
+//Rectangular products: the plain tiled multiply against the path dgemm_shape_pool
+//picks for the shape (split-K, skinny-N, tall-M or tiles again). "sweep" runs a
+//fixed set of square, long-K, skinny and tall shapes. Split-K only appears
+//when the pool has more threads than C has tiles.
+
+using namespace std;
+
+struct Shape {
+    int M, N, K;
+};
+
+static const Shape sweep_shapes[] = {
+    {1024, 1024, 1024},   // square: tiles
+    {2048, 2048, 32},     // small K, plenty of tiles
+    {256, 256, 65536},    // few tiles, long K: split-K
+    {64, 64, 262144},
+    {262144, 16, 256},    // skinny N
+    {1048576, 4, 64},
+    {262144, 64, 128},    // tall M
+    {65536, 256, 256},
+};
+
+// Fill a matrix with random values
+void fill_random(double* matrix, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        double random_value;
+        do {
+            random_value = static_cast<double>(rand());
+        } while (random_value == 0.0);
+
+        matrix[i] = 1.0 / random_value;
+    }
+}
+
+// Largest difference relative to the largest entry of the reference
+double max_rel_diff(size_t count, const double* X, const double* ref) {
+    double d = 0.0, scale = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        d = max(d, fabs(X[i] - ref[i]));
+        scale = max(scale, fabs(ref[i]));
+    }
+    return scale > 0.0 ? d / scale : d;
+}
+
+double seconds(const function<void()>& run) {
+    auto start = chrono::high_resolution_clock::now();
+    run();
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+void run_shape(ThreadPool& pool, const Shape& s, int block_size) {
+    size_t a = (size_t)s.M * s.K, b = (size_t)s.K * s.N, c = (size_t)s.M * s.N;
+    double* A = alloc_matrix(a);
+    double* B = alloc_matrix(b);
+    double* ref = alloc_matrix(c);
+    double* C = alloc_matrix(c);
+    fill_random(A, a);
+    fill_random(B, b);
+    fill(ref, ref + c, 0.0);
+    fill(C, C + c, 0.0);
+
+    double tiles = seconds([&] { dgemm_rect_pool(pool, s.M, s.N, s.K, A, s.K, B, s.N, ref, s.N, block_size); });
+    GemmPath path = GEMM_TILES;
+    double shaped = seconds([&] { path = dgemm_shape_pool(pool, s.M, s.N, s.K, A, s.K, B, s.N, C, s.N, block_size); });
+    double flops = 2.0 * s.M * s.N * s.K;
+    printf("%8d %6d %7d  %-9s %10.4f %10.4f %9.2fx %9.2f %12.2e\n", s.M, s.N, s.K, gemm_path_name(path), tiles,
+           shaped, tiles / shaped, flops / shaped * 1e-9, max_rel_diff(c, C, ref));
+
+    free_matrix(A);
+    free_matrix(B);
+    free_matrix(ref);
+    free_matrix(C);
+}
+
+int main() {
+    srand(static_cast<unsigned>(time(0)));
+    string input;
+
+    while (true) {
+        int block_size = 0;
+        int thread_count = get_nprocs(); // Retrieve max threads
+        cout << "\nEnter command (EXIT to quit):" << endl
+             << "Format: [M] [N] [K] [BLOCK_SIZE] [THREADS] or sweep [BLOCK_SIZE] [THREADS], max threads "
+             << thread_count << " (use 'm' for max threads)" << endl
+             << "Example: 256 256 65536 64 4" << endl
+             << "> ";
+
+        getline(cin, input);
+        if (input == "EXIT") break;
+
+        istringstream iss(input);
+        vector<string> tokens{istream_iterator<string>{iss}, istream_iterator<string>{}};
+
+        bool sweep = !tokens.empty() && tokens[0] == "sweep";
+        size_t first = sweep ? 1 : 3;  // where BLOCK_SIZE is
+        if (tokens.size() < first + 1) {
+            cerr << "Invalid input! Minimum " << first + 1 << " parameters required" << endl;
+            continue;
+        }
+
+        vector<Shape> shapes;
+        try {
+            if (sweep) {
+                shapes.assign(begin(sweep_shapes), end(sweep_shapes));
+            } else {
+                Shape s{stoi(tokens[0]), stoi(tokens[1]), stoi(tokens[2])};
+                if (s.M <= 0 || s.N <= 0 || s.K <= 0) throw invalid_argument("Sizes must be positive");
+                shapes.push_back(s);
+            }
+
+            block_size = stoi(tokens[first]);
+            if (block_size <= 0) throw invalid_argument("Block size must be positive");
+
+            if (tokens.size() > first + 1 && tokens[first + 1] != "m" && tokens[first + 1] != "M") {
+                thread_count = stoi(tokens[first + 1]);
+                if (thread_count <= 0) throw invalid_argument("Thread count must be positive");
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            continue;
+        }
+
+        ThreadPool pool(thread_count);
+        printf("block %d, tile %d, %d threads\n", block_size, block_size * TILE_BLOCKS, thread_count);
+        printf("%8s %6s %7s  %-9s %10s %10s %10s %9s %12s\n", "M", "N", "K", "path", "tiles s", "shaped s",
+               "speed-up", "GFLOP/s", "rel diff");
+        for (const Shape& s : shapes) run_shape(pool, s, block_size);
+    }
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <sys/sysinfo.h>
+#include "matalloc.h"
+#include "threadpool.h"
+#include "dgemm_async.h"
+#include "dgemm_struct.h"
+
+//compile with -O2 -march=native -pthread
+//Times SYRK, SYMM and TRMM against the plain multiply of the same dense
+//operands on the same pool. The triangle the structured kernels must not
+//read is filled with NaN, so any stray read shows up in the difference.
+
+using namespace std;
+
+// Fill a matrix with random values
+void fill_random(double* matrix, int n) {
+    if (matrix == nullptr) {
+        cerr << "Error: Matrix is not allocated properly!" << endl;
+        return;
+    }
+
+    for (int i = 0; i < n * n; ++i) {
+        double random_value;
+        do {
+            random_value = static_cast<double>(rand());
+        } while (random_value == 0.0);
+
+        matrix[i] = 1.0 / random_value;
+    }
+}
+
+// Largest difference relative to the largest entry of the reference, over
+// the lower triangle only or the whole matrix
+double max_rel_diff(int n, const double* X, const double* ref, bool lower) {
+    double d = 0.0, scale = 0.0;
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < (lower ? i + 1 : n); ++j) {
+            double diff = fabs(X[i * n + j] - ref[i * n + j]);
+            d = diff == diff ? max(d, diff) : numeric_limits<double>::infinity();
+            scale = max(scale, fabs(ref[i * n + j]));
+        }
+    return scale > 0.0 ? d / scale : d;
+}
+
+double seconds(const function<void()>& run) {
+    auto start = chrono::high_resolution_clock::now();
+    run();
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+void print_row(const char* name, double gemm, double structured, double flop_ratio, double diff) {
+    printf("%-6s %10.4f %12.4f %9.2fx %11.2fx %12.2e\n", name, gemm, structured, gemm / structured,
+           1.0 / flop_ratio, diff);
+}
+
+int main() {
+    srand(static_cast<unsigned>(time(0)));
+    string input;
+    const double nan = numeric_limits<double>::quiet_NaN();
+
+    while (true) {
+        int n, block_size = 0;
+        int thread_count = get_nprocs(); // Retrieve max threads
+        cout << "\nEnter command (EXIT to quit):" << endl
+             << "Format: [SIZE] [BLOCK_SIZE] [THREADS], max threads " << thread_count
+             << " (use 'm' for max threads)" << endl
+             << "Example: 1000 64 4" << endl
+             << "> ";
+
+        getline(cin, input);
+        if (input == "EXIT") break;
+
+        istringstream iss(input);
+        vector<string> tokens{istream_iterator<string>{iss}, istream_iterator<string>{}};
+
+        if (tokens.size() < 2) {
+            cerr << "Invalid input! Minimum 2 parameters required" << endl;
+            continue;
+        }
+
+        try {
+            n = stoi(tokens[0]);
+            if (n <= 0) throw invalid_argument("Size must be positive");
+
+            block_size = stoi(tokens[1]);
+            if (block_size <= 0) throw invalid_argument("Block size must be positive");
+
+            if (tokens.size() > 2 && tokens[2] != "m" && tokens[2] != "M") {
+                thread_count = stoi(tokens[2]);
+                if (thread_count <= 0) throw invalid_argument("Thread count must be positive");
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            continue;
+        }
+
+        ThreadPool pool(thread_count);
+        size_t elems = (size_t)n * n;
+        double* A = alloc_matrix(elems);
+        double* B = alloc_matrix(elems);
+        double* dense = alloc_matrix(elems);   // the operand the plain multiply sees
+        double* stored = alloc_matrix(elems);  // the same with the unused triangle poisoned
+        double* ref = alloc_matrix(elems);
+        double* C = alloc_matrix(elems);
+        fill_random(A, n);
+        fill_random(B, n);
+
+        printf("%d x %d, block %d, tile %d, %d threads, matrices backed by %s\n", n, n, block_size,
+               block_size * TILE_BLOCKS, thread_count, matrix_backing(A));
+        printf("%-6s %10s %12s %10s %12s %12s\n", "op", "gemm s", "structured s", "speed-up", "flop saving",
+               "rel diff");
+
+        // SYRK: C = A * A^T against a multiply by an explicit transpose
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j) dense[j * n + i] = A[i * n + j];
+        fill(ref, ref + elems, 0.0);
+        double gemm = seconds([&] { gemm_async(pool, n, block_size, A, dense, ref).get(); });
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j) C[i * n + j] = j > i ? nan : 0.0;
+        double structured = seconds([&] { dsyrk_lower_pool(pool, n, n, A, n, C, n, block_size); });
+        print_row("syrk", gemm, structured, 0.5 * (n + 1.0) / n, max_rel_diff(n, C, ref, true));
+
+        // SYMM: C = S * B, S = A + A^T
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j) {
+                dense[i * n + j] = A[i * n + j] + A[j * n + i];
+                stored[i * n + j] = j > i ? nan : dense[i * n + j];
+            }
+        fill(ref, ref + elems, 0.0);
+        gemm = seconds([&] { gemm_async(pool, n, block_size, dense, B, ref).get(); });
+        fill(C, C + elems, 0.0);
+        structured = seconds([&] { dsymm_lower_pool(pool, n, n, stored, n, B, n, C, n, block_size); });
+        print_row("symm", gemm, structured, 1.0, max_rel_diff(n, C, ref, false));
+
+        // TRMM: C = L * B, L the lower triangle of A
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j) {
+                dense[i * n + j] = j > i ? 0.0 : A[i * n + j];
+                stored[i * n + j] = j > i ? nan : A[i * n + j];
+            }
+        fill(ref, ref + elems, 0.0);
+        gemm = seconds([&] { gemm_async(pool, n, block_size, dense, B, ref).get(); });
+        fill(C, C + elems, 0.0);
+        structured = seconds([&] { dtrmm_lower_pool(pool, n, n, stored, n, B, n, C, n, block_size); });
+        print_row("trmm", gemm, structured, 0.5 * (n + 1.0) / n, max_rel_diff(n, C, ref, false));
+
+        free_matrix(A);
+        free_matrix(B);
+        free_matrix(dense);
+        free_matrix(stored);
+        free_matrix(ref);
+        free_matrix(C);
+    }
+
+    return 0;
+}
@@ -7,11 +7,15 @@
 #include <vector>
 #include <sstream>
 #include <iterator>
+#include <cmath>
 #include <stdio.h>
 #include <mmintrin.h>
 #include <xmmintrin.h>
 #include <pmmintrin.h>
 #include <emmintrin.h>
+#include "matalloc.h"
+#include "dgemm.h"
+#include "cachesim.h"
 using namespace std;
 
 
@@ -19,74 +23,6 @@ using namespace std;
 
 
 int BLOCK_SIZE = 32;
-static void sse_4x4 (int lda, int K, double* A, double* B, double* C) {
-    /* Performs Matrix Multiplication on 4x4 block
-     * using SSE intrinsics 
-     * load, update, store*/
-  // A
-  __m128d A_0X_A_1X, A_2X_A_3X;
-  // B
-  __m128d B_X0, B_X1, B_X2, B_X3;
-  // C 
-  __m128d C_00_C_10, C_20_C_30,
-          C_01_C_11, C_21_C_31,
-          C_02_C_12, C_22_C_32,
-          C_03_C_13, C_23_C_33;
-
-  // LOAD --------
-  // load unaligned
-  C_00_C_10 = _mm_loadu_pd(C              );
-  C_20_C_30 = _mm_loadu_pd(C           + 2);
-  C_01_C_11 = _mm_loadu_pd(C + lda        );
-  C_21_C_31 = _mm_loadu_pd(C + lda     + 2);
-  C_02_C_12 = _mm_loadu_pd(C + (2*lda)    );
-  C_22_C_32 = _mm_loadu_pd(C + (2*lda) + 2);
-  C_03_C_13 = _mm_loadu_pd(C + (3*lda)    );
-  C_23_C_33 = _mm_loadu_pd(C + (3*lda) + 2);
-
-  for (int k = 0; k < K; ++k) {
-    // load aligned
-    A_0X_A_1X = _mm_load_pd(A);
-    A_2X_A_3X = _mm_load_pd(A+2);
-    A += 4;
-      
-    // load unaligned
-    B_X0 = _mm_loaddup_pd(B);
-    B_X1 = _mm_loaddup_pd(B+1);
-    B_X2 = _mm_loaddup_pd(B+2);
-    B_X3 = _mm_loaddup_pd(B+3);
-    B += 4;
-    // UPDATE ---------
-    // C := C + A*B
-    C_00_C_10 = _mm_add_pd(C_00_C_10, _mm_mul_pd(A_0X_A_1X, B_X0));
-    C_20_C_30 = _mm_add_pd(C_20_C_30, _mm_mul_pd(A_2X_A_3X, B_X0));
-    C_01_C_11 = _mm_add_pd(C_01_C_11, _mm_mul_pd(A_0X_A_1X, B_X1));
-    C_21_C_31 = _mm_add_pd(C_21_C_31, _mm_mul_pd(A_2X_A_3X, B_X1));
-    C_02_C_12 = _mm_add_pd(C_02_C_12, _mm_mul_pd(A_0X_A_1X, B_X2));
-    C_22_C_32 = _mm_add_pd(C_22_C_32, _mm_mul_pd(A_2X_A_3X, B_X2));
-    C_03_C_13 = _mm_add_pd(C_03_C_13, _mm_mul_pd(A_0X_A_1X, B_X3));
-    C_23_C_33 = _mm_add_pd(C_23_C_33, _mm_mul_pd(A_2X_A_3X, B_X3));
-  }
-
-  // STORE -------
-  _mm_storeu_pd(C              , C_00_C_10);
-  _mm_storeu_pd(C           + 2, C_20_C_30);
-  _mm_storeu_pd(C + lda        , C_01_C_11);
-  _mm_storeu_pd(C + lda     + 2, C_21_C_31);
-  _mm_storeu_pd(C + (2*lda)    , C_02_C_12);
-  _mm_storeu_pd(C + (2*lda) + 2, C_22_C_32);
-  _mm_storeu_pd(C + (3*lda)    , C_03_C_13);
-  _mm_storeu_pd(C + (3*lda) + 2, C_23_C_33);
-}
-
-
-void naive_helper (int lda, int K, double* A, double* B, double* C, int i, int j) {
-    double cij = C[j*lda + i];
-    for (int k = 0; k < K; ++k) {
-        cij += A[k*lda + i] * B[j*lda + k];
-    }
-    C[j*lda + i] = cij;
-}
 
 void fill_random(double* matrix, int n) {
     if (matrix == nullptr) {
@@ -109,9 +45,12 @@ void dgemm_base(int n, double* A, double* B, double* C) {
         for (int j = 0; j < n; ++j) {
             double sum = 0.0;
             for (int k = 0; k < n; ++k) {
+                CACHESIM_LOAD(&A[i*n + k], sizeof(double));
+                CACHESIM_LOAD(&B[k*n + j], sizeof(double));
                 sum += A[i*n + k] * B[k*n + j];
             }
             C[i*n + j] = sum;
+            CACHESIM_STORE(&C[i*n + j], sizeof(double));
         }
     }
 }
@@ -120,8 +59,12 @@ void dgemm_opt1(int n, double* A, double* B, double* C) {
     for (int i = 0; i < n; ++i) {
         for (int k = 0; k < n; ++k) {
             double a = A[i*n + k];
+            CACHESIM_LOAD(&A[i*n + k], sizeof(double));
             for (int j = 0; j < n; ++j) {
+                CACHESIM_LOAD(&B[k*n + j], sizeof(double));
+                CACHESIM_LOAD(&C[i*n + j], sizeof(double));
                 C[i*n + j] += a * B[k*n + j];
+                CACHESIM_STORE(&C[i*n + j], sizeof(double));
             }
         }
     }
@@ -130,66 +73,6 @@ void dgemm_opt1(int n, double* A, double* B, double* C) {
 
 
 
-void do_block (int lda, int M, int N, int K, double* A, double* B, double* C)
-{
-  // largest multiple of 4 less than M
-  int M4_max = (M>>2) << 2;
-  // largest multiple of 4 less than N
-  int N4_max = (N>>2) << 2;
-  //printf("%i, %i\n", M4_max, N4_max);
-  
-  // pack and align data from A 
-  double AA[M4_max*K]; // under allocate
-  for(int m=0; m < M4_max; m+=4) {
-      double *dst = &AA[m*K];
-      double *src = A + m;
-      for (int k = 0; k < K; ++k) {
-          *dst     = *src;
-          *(dst+1) = *(src+1);
-          *(dst+2) = *(src+2);
-          *(dst+3) = *(src+3);
-          dst += 4;
-          src += lda;
-      }
-  }
-  // pack and align data from B
-  double BB[N4_max*K]; // under allocate
-  for(int n=0; n < N4_max; n+=4){
-      double *dst = &BB[n*K];
-      double *src_0 = B + n*lda;
-      double *src_1 = src_0 + lda; 
-      double *src_2 = src_1 + lda; 
-      double *src_3 = src_2 + lda;
-      for (int k = 0; k < K; ++k) {
-          *dst++ = *src_0++;
-          *dst++ = *src_1++;
-          *dst++ = *src_2++;
-          *dst++ = *src_3++;
-      }
-  }
-
-  // compute 4x4's using SSE intrinsics 
-  for (int i = 0; i < M4_max; i+=4){
-    for (int j = 0; j < N4_max; j+=4){
-        //printf("aa,bb: %f, %f\n", AA[i+1], BB[j+1]);
-        sse_4x4(lda, K, &AA[i*K], &BB[j*K], &C[j*lda + i]);
-    }
-  }
-  // compute remaining cells using naive dgemm
-  // horizontal sliver
-  if(M4_max!=M){
-      for (int i=M4_max; i < M; ++i)
-          for (int tmp=0; tmp < N; ++tmp) 
-              naive_helper(lda, K, A, B, C, i, tmp);
-  }
-  // vertical sliver + bottom right corner 
-  if(N4_max!=N){
-      for (int j=N4_max; j < N; ++j)
-          for (int tmp=0; tmp < M4_max; ++tmp) 
-              naive_helper(lda, K, A, B, C, tmp, j);
-  }
-}
-
 void dgemm_opt2 (int lda, double* A, double* B, double* C)
 {
   /* For each block-row of A */ 
@@ -209,8 +92,225 @@ void dgemm_opt2 (int lda, double* A, double* B, double* C)
       }
 }
 
+/* C := ep(A*B) with full-K panels: each C tile is finished in one pass of
+ * the micro-kernel, so C is never read (unless the epilogue reads it) and can
+ * be streamed out. Packed B panel (BLOCK_SIZE columns) is reused across every
+ * row block of A */
+template <class Epilogue = EpilogueNone>
+void dgemm_opt3 (int lda, double* A, double* B, double* C, const Epilogue& ep = Epilogue())
+{
+  int K = lda;
+  int bs = (BLOCK_SIZE + 3) & ~3;
+  double* AA = alloc_matrix((size_t)bs * K);
+  double* BB = alloc_matrix((size_t)bs * K);
+  CACHESIM_NAME("AA", AA, sizeof(double) * bs * K);
+  CACHESIM_NAME("BB", BB, sizeof(double) * bs * K);
+  for (int j = 0; j < lda; j += bs) {
+    int N = mymin(bs, lda-j);
+    int N4_max = (N>>2) << 2;
+    pack_b(lda, N4_max, K, B + j*lda, BB);
+    for (int i = 0; i < lda; i += bs) {
+      int M = mymin(bs, lda-i);
+      int M4_max = (M>>2) << 2;
+      double* Cij = C + i + j*lda;
+      pack_a(lda, M4_max, K, A + i, AA);
+      compute_tiles(lda, M4_max, N4_max, K, AA, BB, Cij, true, ep, i, j);
+      // edges
+      for (int jj = 0; jj < N; ++jj)
+        for (int ii = (jj < N4_max ? M4_max : 0); ii < M; ++ii) {
+          double cij = 0.0;
+          for (int k = 0; k < K; ++k) {
+            CACHESIM_LOAD(&A[k*lda + i + ii], 8);
+            CACHESIM_LOAD(&B[(j + jj)*lda + k], 8);
+            cij += A[k*lda + i + ii] * B[(j + jj)*lda + k];
+          }
+          Cij[jj*lda + ii] = ep.scalar(cij, &Cij[jj*lda + ii], i + ii, j + jj);
+          CACHESIM_STORE(&Cij[jj*lda + ii], 8);
+        }
+    }
+  }
+  if (STREAM_STORES) _mm_sfence();  // order the streamed C before anyone reads it
+  free_matrix(AA);
+  free_matrix(BB);
+}
+
+/* Leaf of the cache-oblivious recursion. Chosen for the 4x4 micro-kernel and
+ * the packing buffers, not for any particular cache size */
+#define REC_LEAF 32
+
+/* Split point that keeps the first half a multiple of 4 so the
+ * micro-kernel tiles stay full */
+static int rec_split (int dim)
+{
+  int h = ((dim >> 1) + 3) & ~3;
+  return h < dim ? h : dim >> 1;
+}
+
+/* Cache-oblivious C += A*B on an M x N x K sub-problem: halve the largest
+ * dimension until the block fits the leaf. Every level of the hierarchy sees
+ * blocks that fit it at some depth of the recursion, so nothing is tuned */
+void dgemm_rec_block (int lda, int M, int N, int K, double* A, double* B, double* C)
+{
+  if (M <= REC_LEAF && N <= REC_LEAF && K <= REC_LEAF) {
+    do_block(lda, M, N, K, A, B, C);
+  } else if (M >= N && M >= K) {
+    int h = rec_split(M);
+    dgemm_rec_block(lda, h, N, K, A, B, C);
+    dgemm_rec_block(lda, M - h, N, K, A + h, B, C + h);
+  } else if (N >= K) {
+    int h = rec_split(N);
+    dgemm_rec_block(lda, M, h, K, A, B, C);
+    dgemm_rec_block(lda, M, N - h, K, A, B + h*lda, C + h*lda);
+  } else {
+    int h = rec_split(K);
+    dgemm_rec_block(lda, M, N, h, A, B, C);
+    dgemm_rec_block(lda, M, N, K - h, A + h*lda, B + h, C);
+  }
+}
 
+void dgemm_rec (int lda, double* A, double* B, double* C)
+{
+  dgemm_rec_block(lda, lda, lda, lda, A, B, C);
+}
 
+/* Morton (Z-order) tiled storage: REC_LEAF x REC_LEAF column-major tiles,
+ * tiles ordered along a Z curve so every quadrant at every level of the
+ * recursion is one contiguous range. The tile grid is padded with zeros
+ * to a power of two */
+struct MortonMatrix {
+  int n;       // logical size
+  int tiles;   // tiles per side, a power of two
+  double* data;
+};
+
+/* Interleave the bits of the tile row (even bits) and column (odd bits) */
+static size_t morton_index (unsigned ti, unsigned tj)
+{
+  size_t z = 0;
+  for (int b = 0; b < 16; ++b) {
+    z |= (size_t)((ti >> b) & 1) << (2*b);
+    z |= (size_t)((tj >> b) & 1) << (2*b + 1);
+  }
+  return z;
+}
+
+MortonMatrix morton_alloc (int n)
+{
+  MortonMatrix m;
+  m.n = n;
+  m.tiles = 1;
+  while (m.tiles * REC_LEAF < n) m.tiles <<= 1;
+  size_t elems = (size_t)m.tiles * m.tiles * REC_LEAF * REC_LEAF;
+  m.data = alloc_matrix(elems);  // zeroed, so the padding tiles are too
+  return m;
+}
+
+void morton_free (MortonMatrix& m)
+{
+  free_matrix(m.data);
+  m.data = nullptr;
+}
+
+/* Copy a column-major n x n matrix (lda = n) into Morton storage */
+void to_morton (const double* src, MortonMatrix& dst)
+{
+  for (int tj = 0; tj * REC_LEAF < dst.n; ++tj)
+    for (int ti = 0; ti * REC_LEAF < dst.n; ++ti) {
+      double* tile = dst.data + morton_index(ti, tj) * REC_LEAF * REC_LEAF;
+      int M = mymin(REC_LEAF, dst.n - ti*REC_LEAF);
+      int N = mymin(REC_LEAF, dst.n - tj*REC_LEAF);
+      for (int j = 0; j < N; ++j)
+        std::copy(src + (tj*REC_LEAF + j)*dst.n + ti*REC_LEAF,
+                  src + (tj*REC_LEAF + j)*dst.n + ti*REC_LEAF + M, tile + j*REC_LEAF);
+    }
+}
+
+/* Copy Morton storage back to a column-major n x n matrix */
+void from_morton (const MortonMatrix& src, double* dst)
+{
+  for (int tj = 0; tj * REC_LEAF < src.n; ++tj)
+    for (int ti = 0; ti * REC_LEAF < src.n; ++ti) {
+      const double* tile = src.data + morton_index(ti, tj) * REC_LEAF * REC_LEAF;
+      int M = mymin(REC_LEAF, src.n - ti*REC_LEAF);
+      int N = mymin(REC_LEAF, src.n - tj*REC_LEAF);
+      for (int j = 0; j < N; ++j)
+        std::copy(tile + j*REC_LEAF, tile + j*REC_LEAF + M, dst + (tj*REC_LEAF + j)*src.n + ti*REC_LEAF);
+    }
+}
+
+/* C += A*B on tiles x tiles Morton blocks. Quadrants are stored in the order
+ * 00, 10, 01, 11 (row index in the low bit), each tiles^2/4 tiles long */
+static void dgemm_morton_rec (int tiles, double* A, double* B, double* C)
+{
+  if (tiles == 1) {
+    do_block(REC_LEAF, REC_LEAF, REC_LEAF, REC_LEAF, A, B, C);
+    return;
+  }
+  size_t q = (size_t)(tiles/2) * (tiles/2) * REC_LEAF * REC_LEAF;
+  int h = tiles / 2;
+  double *A00 = A, *A10 = A + q, *A01 = A + 2*q, *A11 = A + 3*q;
+  double *B00 = B, *B10 = B + q, *B01 = B + 2*q, *B11 = B + 3*q;
+  double *C00 = C, *C10 = C + q, *C01 = C + 2*q, *C11 = C + 3*q;
+  dgemm_morton_rec(h, A00, B00, C00);
+  dgemm_morton_rec(h, A01, B10, C00);
+  dgemm_morton_rec(h, A10, B00, C10);
+  dgemm_morton_rec(h, A11, B10, C10);
+  dgemm_morton_rec(h, A00, B01, C01);
+  dgemm_morton_rec(h, A01, B11, C01);
+  dgemm_morton_rec(h, A10, B01, C11);
+  dgemm_morton_rec(h, A11, B11, C11);
+}
+
+void dgemm_morton (MortonMatrix& A, MortonMatrix& B, MortonMatrix& C)
+{
+  dgemm_morton_rec(A.tiles, A.data, B.data, C.data);
+}
+
+/* Largest absolute difference between two n x n results */
+double max_diff (int n, const double* X, const double* Y)
+{
+  double d = 0.0;
+  for (int i = 0; i < n*n; ++i) d = std::max(d, std::abs(X[i] - Y[i]));
+  return d;
+}
+
+
+
+#ifdef CACHESIM
+static CacheSim* sim = NULL;
+#endif
+
+/* Built with -DCACHESIM, each of the first four runs also goes through the
+ * cache simulator (slow: keep SIZE to a few hundred). sim_stop() returns the
+ * report to print after the timing, and nothing otherwise */
+#ifdef CACHESIM
+void sim_start (int n, double* A, double* B, double* C)
+{
+  sim = new CacheSim();
+  sim->name("A", A, sizeof(double) * n * n);
+  sim->name("B", B, sizeof(double) * n * n);
+  sim->name("C", C, sizeof(double) * n * n);
+  CACHESIM_ATTACH(sim);
+}
+#else
+void sim_start (int, double*, double*, double*)
+{
+}
+#endif
+
+std::string sim_stop ()
+{
+#ifdef CACHESIM
+  CACHESIM_ATTACH(NULL);
+  std::string report = "\nSimulated caches:\n" + sim->report();
+  report.pop_back();  // the caller ends the line
+  delete sim;
+  sim = NULL;
+  return report;
+#else
+  return "";
+#endif
+}
 
 int main() {
     std::string input;
@@ -222,8 +322,8 @@ int main() {
         auto endb = std::chrono::high_resolution_clock::now();
     while(true) {
         std::cout << "\nEnter command (EXIT to quit):\n"
-                     "Format: [SIZE] [BLOCK_SIZE]\n"
-                     "Example: 1000 64\n> ";
+                     "Format: [SIZE] [BLOCK_SIZE] [PREFETCH_DIST] [stream|nostream]\n"
+                     "Example: 1000 64 8 stream\n> ";
         
         std::getline(std::cin, input);
         if(input == "EXIT") break;
@@ -238,14 +338,17 @@ int main() {
             std::cerr << "Invalid input! Minimum 2 parameters required\n";
             continue;
         }
-        int n, BLOCK_SIZE = 0;
+        int n;
         try {
             n = std::stoi(tokens[0]);
             if(n <= 0) throw std::invalid_argument("Size must be positive");
             
             
-                BLOCK_SIZE = std::stoi(tokens[1]);
-                if(BLOCK_SIZE <= 0) throw std::invalid_argument("Block size must be positive");
+                ::BLOCK_SIZE = std::stoi(tokens[1]);
+                if(::BLOCK_SIZE <= 0) throw std::invalid_argument("Block size must be positive");
+                ::PREFETCH_DIST = tokens.size() > 2 ? std::stoi(tokens[2]) : 0;
+                if(::PREFETCH_DIST < 0) throw std::invalid_argument("Prefetch distance must not be negative");
+                ::STREAM_STORES = tokens.size() > 3 && tokens[3] == "stream";
             
         }
         catch(const std::exception& e) {
@@ -255,40 +358,117 @@ int main() {
 		
         auto start = std::chrono::high_resolution_clock::now();
 		try{
-        // Allocate memory
-        double* A = new double[n*n];
-        double* B = new double[n*n];
-        double* C = new double[n*n];
+        // Allocate memory (huge pages where available, see matalloc.h)
+        TlbCounters tlb = tlb_counters_start();
+        double* A = alloc_matrix(n*n);
+        double* B = alloc_matrix(n*n);
+        double* C = alloc_matrix(n*n);
         
         fill_random(A, n);
 		
         fill_random(B, n);
-        std::fill(C, C + n*n, 0.0);
-        cout<<"a";
+        cout<<"Matrices backed by "<<matrix_backing(A)<<", allocated and filled"<<tlb_counters_stop(tlb)<<"\n";
         // Run multiplication
+			tlb = tlb_counters_start();
+			sim_start(n, A, B, C);
             dgemm_base(n, A, B, C);
 			endb = std::chrono::high_resolution_clock::now();
 			std::chrono::duration<double> elapsed = endb - start;
-			cout<<"Completed multiplication with base dgemm algorithm. In "<<elapsed.count() <<". Continue?\n";
+			cout<<"Completed multiplication with base dgemm algorithm. In "<<elapsed.count()<<tlb_counters_stop(tlb)<<sim_stop()<<". Continue?\n";
 			
 			std::getline(std::cin, input);
 			if(input == "n") break;
+			tlb = tlb_counters_start();
+			sim_start(n, A, B, C);
 			endb = std::chrono::high_resolution_clock::now();
             dgemm_opt1(n, A, B, C);
 			end1 = std::chrono::high_resolution_clock::now();
 			elapsed = end1 - endb;
-			cout<<"Completed multiplication with line optimised dgemm algorithm. In "<<elapsed.count() <<". Continue?\n";
+			cout<<"Completed multiplication with line optimised dgemm algorithm. In "<<elapsed.count()<<tlb_counters_stop(tlb)<<sim_stop()<<". Continue?\n";
             
 			std::getline(std::cin, input);
 			if(input == "n") break;
 			
+			std::fill(C, C + n*n, 0.0);
+			tlb = tlb_counters_start();
+			sim_start(n, A, B, C);
 			end1 = std::chrono::high_resolution_clock::now();
             dgemm_opt2(n, A, B, C);
 			end2 = std::chrono::high_resolution_clock::now();
 			elapsed = end2 - end1;
-			cout<<"Completed multiplication with block optimised dgemm algorithm. In "<<elapsed.count() <<".\n";
+			cout<<"Completed multiplication with block optimised dgemm algorithm. In "<<elapsed.count()<<tlb_counters_stop(tlb)<<sim_stop()<<". Continue?\n";
            // }
 
+			std::getline(std::cin, input);
+			if(input == "n") break;
+
+			// Full-K panels with beta=0, checked against the blocked result
+			double* C2 = alloc_matrix(n*n);
+			tlb = tlb_counters_start();
+			sim_start(n, A, B, C2);
+			end1 = std::chrono::high_resolution_clock::now();
+            dgemm_opt3(n, A, B, C2);
+			end2 = std::chrono::high_resolution_clock::now();
+			elapsed = end2 - end1;
+			cout<<"Completed multiplication with full-K panel dgemm algorithm (prefetch "<<PREFETCH_DIST
+			    <<(STREAM_STORES ? ", streaming stores" : ", cached stores")<<"). In "<<elapsed.count()
+			    <<tlb_counters_stop(tlb)<<" (max diff "<<max_diff(n, C, C2)<<")"<<sim_stop()<<".\n";
+			std::chrono::duration<double> plain = elapsed;
+
+			// C3 := relu(0.5*A*B + bias) + C with the epilogue fused into the
+			// store, against the full-K result above plus a separate pass over it
+			double* bias = alloc_matrix(n);
+			for (int j = 0; j < n; ++j) bias[j] = 0.5 - (double)j / n;
+			double* C3 = alloc_matrix(n*n);
+			end1 = std::chrono::high_resolution_clock::now();
+            dgemm_opt3(n, A, B, C3, epilogue_chain(EpilogueScale{0.5, 0.0}, EpilogueBiasCol{bias},
+                                                   EpilogueRelu{}, EpilogueResidual{C, n}));
+			end2 = std::chrono::high_resolution_clock::now();
+			for (int j = 0; j < n; ++j)
+				for (int i = 0; i < n; ++i) {
+					double v = 0.5 * C2[j*n + i] + bias[j];
+					C2[j*n + i] = (v > 0.0 ? v : 0.0) + C[j*n + i];
+				}
+			end3 = std::chrono::high_resolution_clock::now();
+			elapsed = end2 - end1;
+			std::chrono::duration<double> pass = end3 - end2;
+			cout<<"Completed multiplication with fused epilogue (scale, bias, ReLU, residual). In "<<elapsed.count()
+			    <<" (unfused "<<plain.count()<<" + "<<pass.count()<<" pass, max diff "<<max_diff(n, C2, C3)<<").\n";
+			free_matrix(bias);
+			free_matrix(C3);
+
+			// Cache-oblivious variants, checked against the blocked result
+			std::fill(C2, C2 + n*n, 0.0);
+			tlb = tlb_counters_start();
+			end1 = std::chrono::high_resolution_clock::now();
+            dgemm_rec(n, A, B, C2);
+			end2 = std::chrono::high_resolution_clock::now();
+			elapsed = end2 - end1;
+			cout<<"Completed multiplication with cache-oblivious recursive dgemm algorithm. In "<<elapsed.count()
+			    <<tlb_counters_stop(tlb)<<" (max diff "<<max_diff(n, C, C2)<<").\n";
+
+			end1 = std::chrono::high_resolution_clock::now();
+			MortonMatrix MA = morton_alloc(n), MB = morton_alloc(n), MC = morton_alloc(n);
+			to_morton(A, MA);
+			to_morton(B, MB);
+			end2 = std::chrono::high_resolution_clock::now();
+			std::chrono::duration<double> convert = end2 - end1;
+			tlb = tlb_counters_start();
+            dgemm_morton(MA, MB, MC);
+			end3 = std::chrono::high_resolution_clock::now();
+			std::string counters = tlb_counters_stop(tlb);
+			from_morton(MC, C2);
+			elapsed = end3 - end2;
+			cout<<"Completed multiplication with Morton-order recursive dgemm algorithm. In "<<elapsed.count()
+			    <<counters<<" (+"<<convert.count()<<" converting, max diff "<<max_diff(n, C, C2)<<").\n";
+			morton_free(MA);
+			morton_free(MB);
+			morton_free(MC);
+			free_matrix(C2);
+			free_matrix(A);
+			free_matrix(B);
+			free_matrix(C);
+
 		
         }
         catch(...) {
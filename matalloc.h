@@ -0,0 +1,248 @@
+// Matrix buffer allocator: page-aligned storage backed by huge pages where the
+// system allows it, with optional parallel pre-faulting, plus dTLB-miss and
+// page-fault counters to see what the backing buys.
+//
+// Selected with environment variables so every driver picks it up unchanged:
+//   MATALLOC=1g|2m|thp|4k     backing to try first (default thp); 1g and 2m need
+//                             pages reserved in /proc/sys/vm/nr_hugepages or
+//                             /sys/kernel/mm/hugepages, and fall back down the list
+//   MATALLOC_PREFAULT=N       touch every page from N threads at allocation time
+//                             (0 = let the first write fault them in, the default)
+#ifndef MATALLOC_H
+#define MATALLOC_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <map>
+#include <new>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+enum MatBacking {
+    MAT_HUGETLB_1G,  // explicit 1 GB hugetlbfs pages
+    MAT_HUGETLB_2M,  // explicit 2 MB hugetlbfs pages
+    MAT_THP,         // 2 MB aligned anonymous memory with MADV_HUGEPAGE
+    MAT_PAGES        // plain 4 KB pages, still page aligned
+};
+
+static const char* const mat_backing_names[] = {"1 GB hugetlb", "2 MB hugetlb", "THP (madvise)", "4 KB pages"};
+
+struct MatAllocConfig {
+    MatBacking first;
+    int prefault_threads;
+};
+
+struct MatAllocation {
+    void* base;
+    size_t bytes;
+    MatBacking backing;
+};
+
+inline const MatAllocConfig& matalloc_config()
+{
+    static MatAllocConfig config = [] {
+        MatAllocConfig c = {MAT_THP, 0};
+        const char* mode = getenv("MATALLOC");
+        if (mode != NULL) {
+            if (strcmp(mode, "1g") == 0) c.first = MAT_HUGETLB_1G;
+            else if (strcmp(mode, "2m") == 0) c.first = MAT_HUGETLB_2M;
+            else if (strcmp(mode, "4k") == 0) c.first = MAT_PAGES;
+        }
+        const char* prefault = getenv("MATALLOC_PREFAULT");
+        if (prefault != NULL) c.prefault_threads = atoi(prefault);
+        return c;
+    }();
+    return config;
+}
+
+// Live allocations by data pointer, so free_matrix() knows how to unmap
+struct MatAllocTable {
+    std::mutex lock;
+    std::map<void*, MatAllocation> live;
+};
+
+inline MatAllocTable& matalloc_table()
+{
+    static MatAllocTable table;
+    return table;
+}
+
+static inline size_t round_up(size_t x, size_t to)
+{
+    return (x + to - 1) / to * to;
+}
+
+// Touch one byte per page from several threads so the faults (and, on NUMA
+// machines, the first-touch placement) are spread over the workers
+inline void prefault_pages(char* p, size_t bytes, int threads)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t pages = bytes / page;
+    size_t per_thread = (pages + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        size_t first = t * per_thread, last = std::min(pages, first + per_thread);
+        if (first >= last) break;
+        workers.emplace_back([=] {
+            for (size_t i = first; i < last; ++i) {
+                p[i * page] = 0;
+            }
+        });
+    }
+    for (std::thread& w : workers) w.join();
+}
+
+static void* map_backing(MatBacking backing, size_t& bytes)
+{
+    const size_t small = sysconf(_SC_PAGESIZE);
+    const size_t huge = 2u << 20;
+    void* p = MAP_FAILED;
+    switch (backing) {
+    case MAT_HUGETLB_1G:
+        bytes = round_up(bytes, 1ull << 30);
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        break;
+    case MAT_HUGETLB_2M:
+        bytes = round_up(bytes, huge);
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        break;
+    case MAT_THP: {
+        // Over-map by one huge page and trim, so the range starts on a 2 MB boundary
+        bytes = round_up(bytes, huge);
+        char* raw = (char*)mmap(NULL, bytes + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) break;
+        char* aligned = (char*)round_up((uintptr_t)raw, huge);
+        if (aligned > raw) munmap(raw, aligned - raw);
+        munmap(aligned + bytes, raw + huge - aligned);
+        if (madvise(aligned, bytes, MADV_HUGEPAGE) != 0) {
+            munmap(aligned, bytes);
+            break;
+        }
+        p = aligned;
+        break;
+    }
+    case MAT_PAGES:
+        bytes = round_up(bytes, small);
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        break;
+    }
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// Allocate a zeroed, page-aligned (hence cache-line aligned) array of doubles,
+// trying the configured backing first and falling back to smaller pages
+inline double* alloc_matrix(size_t elems)
+{
+    const MatAllocConfig& config = matalloc_config();
+    for (int b = config.first; b <= MAT_PAGES; ++b) {
+        size_t bytes = elems * sizeof(double);
+        void* p = map_backing((MatBacking)b, bytes);
+        if (p == NULL) continue;
+        if (config.prefault_threads > 0) {
+            prefault_pages((char*)p, bytes, config.prefault_threads);
+        }
+        MatAllocTable& table = matalloc_table();
+        std::lock_guard<std::mutex> guard(table.lock);
+        table.live[p] = MatAllocation{p, bytes, (MatBacking)b};
+        return (double*)p;
+    }
+    throw std::bad_alloc();
+}
+
+inline void free_matrix(double* p)
+{
+    if (p == NULL) return;
+    MatAllocTable& table = matalloc_table();
+    std::lock_guard<std::mutex> guard(table.lock);
+    auto it = table.live.find(p);
+    if (it == table.live.end()) {
+        fprintf(stderr, "free_matrix: %p was not allocated by alloc_matrix\n", (void*)p);
+        return;
+    }
+    munmap(it->second.base, it->second.bytes);
+    table.live.erase(it);
+}
+
+// Human-readable backing of an allocation, for benchmark output
+inline const char* matrix_backing(const double* p)
+{
+    MatAllocTable& table = matalloc_table();
+    std::lock_guard<std::mutex> guard(table.lock);
+    auto it = table.live.find((void*)p);
+    return it == table.live.end() ? "unknown" : mat_backing_names[it->second.backing];
+}
+
+// dTLB load misses and page faults of this process (threads started later
+// included), counted around a kernel. Values are -1 when a counter is unavailable.
+struct TlbCounters {
+    int dtlb_fd;
+    int fault_fd;
+};
+
+static inline int open_self_counter(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+inline TlbCounters tlb_counters_start()
+{
+    TlbCounters c;
+    c.dtlb_fd = open_self_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    c.fault_fd = open_self_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    for (int fd : {c.dtlb_fd, c.fault_fd}) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return c;
+}
+
+static inline long long read_and_close(int fd)
+{
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    long long value = -1;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) value = -1;
+    close(fd);
+    return value;
+}
+
+// Stop the counters and format them as " (dTLB misses: X, page faults: Y)"
+inline std::string tlb_counters_stop(TlbCounters& c)
+{
+    long long dtlb = read_and_close(c.dtlb_fd), faults = read_and_close(c.fault_fd);
+    std::string s = " (dTLB misses: " + (dtlb < 0 ? std::string("n/a") : std::to_string(dtlb)) +
+                    ", page faults: " + (faults < 0 ? std::string("n/a") : std::to_string(faults)) + ")";
+    c.dtlb_fd = c.fault_fd = -1;
+    return s;
+}
+
+#endif
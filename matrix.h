@@ -0,0 +1,276 @@
+// Column-major Matrix and MatrixView over the packed kernel (dgemm.h), with
+// expression templates so that a whole statement such as
+//     C = alpha * A * B + beta * C + D;
+// builds no temporaries: the right-hand side is a GemmExpr holding views of
+// A and B and an epilogue type collecting the scaling and the added terms,
+// and assignment runs it as one dgemm_ep() call with the epilogue fused into
+// the store. Supported shapes are a single product, optionally scaled, plus
+// any number of (scaled) matrices, wrapped in relu()/gelu() if wanted;
+// anything else does not compile.
+//
+// Matrix owns page-aligned storage from matalloc.h and is move-only, so a
+// copy is always spelled clone(). The destination may appear among the added
+// terms as exactly itself, same data and leading dimension (each element is
+// read before it is written), but not as a factor of the product, nor as a
+// term that only partly overlaps it such as a shifted block(): those throw
+// rather than allocating a temporary behind the caller's back.
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "dgemm.h"
+#include "matalloc.h"
+
+// Block size for the products evaluated by assignment
+inline int MATRIX_BLOCK = 64;
+
+template <class Epilogue>
+struct GemmExpr;
+
+class MatrixView {
+public:
+    MatrixView(double* data, int rows, int cols, int ld) : data_(data), rows_(rows), cols_(cols), ld_(ld) {}
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    int ld() const { return ld_; }
+    double* data() const { return data_; }
+
+    double& operator()(int i, int j) const { return data_[(size_t)j * ld_ + i]; }
+
+    // rows x cols block starting at (i, j)
+    MatrixView block(int i, int j, int rows, int cols) const {
+        if (i < 0 || j < 0 || rows < 0 || cols < 0 || i + rows > rows_ || j + cols > cols_)
+            throw std::out_of_range("block outside the matrix");
+        return MatrixView(&(*this)(i, j), rows, cols, ld_);
+    }
+
+    void fill(double value) const {
+        for (int j = 0; j < cols_; ++j) std::fill(&(*this)(0, j), &(*this)(0, j) + rows_, value);
+    }
+
+    template <class Epilogue>
+    const MatrixView& operator=(const GemmExpr<Epilogue>& expr) const;
+    template <class Epilogue>
+    const MatrixView& operator+=(const GemmExpr<Epilogue>& expr) const;
+
+    // true when any element of this and other share memory
+    bool overlaps(const MatrixView& other) const {
+        const double* end = data_ + (size_t)(cols_ - 1) * ld_ + rows_;
+        const double* otherEnd = other.data_ + (size_t)(other.cols_ - 1) * other.ld_ + other.rows_;
+        return rows_ > 0 && cols_ > 0 && other.rows_ > 0 && other.cols_ > 0 && data_ < otherEnd &&
+               other.data_ < end;
+    }
+
+private:
+    double* data_;
+    int rows_, cols_, ld_;
+};
+
+class Matrix {
+public:
+    Matrix() : data_(NULL), rows_(0), cols_(0) {}
+
+    // zero-filled
+    Matrix(int rows, int cols) : data_(NULL), rows_(rows), cols_(cols) {
+        if (rows < 0 || cols < 0) throw std::invalid_argument("negative matrix size");
+        if (size() > 0) data_ = alloc_matrix(size());
+    }
+
+    template <class Epilogue>
+    Matrix(const GemmExpr<Epilogue>& expr);
+
+    ~Matrix() { free_matrix(data_); }
+
+    Matrix(const Matrix&) = delete;
+    Matrix& operator=(const Matrix&) = delete;
+
+    Matrix(Matrix&& other) noexcept : data_(other.data_), rows_(other.rows_), cols_(other.cols_) {
+        other.data_ = NULL;
+        other.rows_ = other.cols_ = 0;
+    }
+
+    Matrix& operator=(Matrix&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(rows_, other.rows_);
+        std::swap(cols_, other.cols_);
+        return *this;
+    }
+
+    Matrix clone() const {
+        Matrix copy(rows_, cols_);
+        std::copy(data_, data_ + size(), copy.data_);
+        return copy;
+    }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    size_t size() const { return (size_t)rows_ * cols_; }
+    double* data() const { return data_; }
+
+    double& operator()(int i, int j) const { return data_[(size_t)j * rows_ + i]; }
+
+    MatrixView view() const { return MatrixView(data_, rows_, cols_, std::max(1, rows_)); }
+    operator MatrixView() const { return view(); }
+    MatrixView block(int i, int j, int rows, int cols) const { return view().block(i, j, rows, cols); }
+
+    template <class Epilogue>
+    Matrix& operator=(const GemmExpr<Epilogue>& expr) {
+        view() = expr;
+        return *this;
+    }
+    template <class Epilogue>
+    Matrix& operator+=(const GemmExpr<Epilogue>& expr) {
+        view() += expr;
+        return *this;
+    }
+
+private:
+    double* data_;
+    int rows_, cols_;
+};
+
+// alpha * M, as a factor or as an added term
+struct ScaledView {
+    double alpha;
+    MatrixView view;
+};
+
+// Added terms must be the destination itself or not touch it: an element of
+// a partly overlapping term may be overwritten before it is read. Terms have
+// the destination's shape; other epilogue stages read nothing
+template <class Stage>
+inline void check_terms(const Stage&, const MatrixView&) {}
+
+inline void check_terms(const EpilogueAxpy& term, const MatrixView& dest) {
+    MatrixView view(const_cast<double*>(term.R), dest.rows(), dest.cols(), term.ldr);
+    if (view.overlaps(dest) && (term.R != dest.data() || term.ldr != dest.ld()))
+        throw std::invalid_argument("added term partly overlaps the destination");
+}
+
+template <class First, class Second>
+inline void check_terms(const EpilogueChain<First, Second>& chain, const MatrixView& dest) {
+    check_terms(chain.first, dest);
+    check_terms(chain.second, dest);
+}
+
+// alpha * A * B followed by the terms in Epilogue, which starts as the
+// EpilogueScale that applies alpha
+template <class Epilogue>
+struct GemmExpr {
+    MatrixView A, B;
+    Epilogue ep;
+
+    int rows() const { return A.rows(); }
+    int cols() const { return B.cols(); }
+
+    template <class Next>
+    GemmExpr<EpilogueChain<Epilogue, Next> > then(const Next& next) const {
+        return GemmExpr<EpilogueChain<Epilogue, Next> >{A, B, epilogue_chain(ep, next)};
+    }
+
+    // Run into dest, which must have the result's shape, be neither factor and
+    // be either exactly or not at all any added term
+    void evaluate(const MatrixView& dest) const {
+        if (A.cols() != B.rows()) throw std::invalid_argument("product shapes do not match");
+        if (dest.rows() != rows() || dest.cols() != cols()) throw std::invalid_argument("result shape does not match");
+        if (dest.overlaps(A) || dest.overlaps(B)) throw std::invalid_argument("destination aliases a factor");
+        check_terms(ep, dest);
+        if (dest.rows() == 0 || dest.cols() == 0) return;
+        dgemm_ep(rows(), cols(), A.cols(), A.data(), A.ld(), B.data(), B.ld(), dest.data(), dest.ld(), MATRIX_BLOCK,
+                 ep);
+    }
+};
+
+typedef GemmExpr<EpilogueScale> ProductExpr;
+
+inline ScaledView operator*(double alpha, const MatrixView& m) { return ScaledView{alpha, m}; }
+inline ScaledView operator*(double alpha, const Matrix& m) { return ScaledView{alpha, m.view()}; }
+inline ScaledView operator-(const MatrixView& m) { return ScaledView{-1.0, m}; }
+inline ScaledView operator-(const Matrix& m) { return ScaledView{-1.0, m.view()}; }
+
+inline ProductExpr operator*(const MatrixView& A, const MatrixView& B) { return ProductExpr{A, B, EpilogueScale{1.0, 0.0}}; }
+inline ProductExpr operator*(const Matrix& A, const Matrix& B) { return A.view() * B.view(); }
+inline ProductExpr operator*(const Matrix& A, const MatrixView& B) { return A.view() * B; }
+inline ProductExpr operator*(const MatrixView& A, const Matrix& B) { return A * B.view(); }
+inline ProductExpr operator*(const ScaledView& A, const MatrixView& B) { return ProductExpr{A.view, B, EpilogueScale{A.alpha, 0.0}}; }
+inline ProductExpr operator*(const ScaledView& A, const Matrix& B) { return A * B.view(); }
+inline ProductExpr operator*(double alpha, const ProductExpr& p) {
+    return ProductExpr{p.A, p.B, EpilogueScale{alpha * p.ep.alpha, 0.0}};
+}
+
+// Added terms become EpilogueAxpy on the view
+inline EpilogueAxpy axpy_term(const ScaledView& s) { return EpilogueAxpy{s.alpha, s.view.data(), s.view.ld()}; }
+
+template <class Epilogue>
+inline void check_term(const GemmExpr<Epilogue>& e, const MatrixView& m) {
+    if (m.rows() != e.rows() || m.cols() != e.cols()) throw std::invalid_argument("added term shape does not match");
+}
+
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator+(const GemmExpr<Epilogue>& e, const ScaledView& s) {
+    check_term(e, s.view);
+    return e.then(axpy_term(s));
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator+(const GemmExpr<Epilogue>& e, const MatrixView& m) {
+    return e + ScaledView{1.0, m};
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator+(const GemmExpr<Epilogue>& e, const Matrix& m) {
+    return e + ScaledView{1.0, m.view()};
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator-(const GemmExpr<Epilogue>& e, const ScaledView& s) {
+    return e + ScaledView{-s.alpha, s.view};
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator-(const GemmExpr<Epilogue>& e, const MatrixView& m) {
+    return e + ScaledView{-1.0, m};
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator-(const GemmExpr<Epilogue>& e, const Matrix& m) {
+    return e + ScaledView{-1.0, m.view()};
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator+(const ScaledView& s, const GemmExpr<Epilogue>& e) {
+    return e + s;
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator+(const MatrixView& m, const GemmExpr<Epilogue>& e) {
+    return e + m;
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueAxpy> > operator+(const Matrix& m, const GemmExpr<Epilogue>& e) {
+    return e + m;
+}
+
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueRelu> > relu(const GemmExpr<Epilogue>& e) {
+    return e.then(EpilogueRelu());
+}
+template <class Epilogue>
+inline GemmExpr<EpilogueChain<Epilogue, EpilogueGelu> > gelu(const GemmExpr<Epilogue>& e) {
+    return e.then(EpilogueGelu());
+}
+
+template <class Epilogue>
+const MatrixView& MatrixView::operator=(const GemmExpr<Epilogue>& expr) const {
+    expr.evaluate(*this);
+    return *this;
+}
+
+template <class Epilogue>
+const MatrixView& MatrixView::operator+=(const GemmExpr<Epilogue>& expr) const {
+    (expr + *this).evaluate(*this);
+    return *this;
+}
+
+template <class Epilogue>
+Matrix::Matrix(const GemmExpr<Epilogue>& expr) : Matrix(expr.rows(), expr.cols()) {
+    expr.evaluate(view());
+}
+
+#endif
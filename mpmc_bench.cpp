@@ -0,0 +1,175 @@
+//compile with g++ -O2 -march=native -pthread mpmc_bench.cpp -o mpmc_bench
+//usage: mpmc_bench [-p producers] [-c consumers] [-n items_per_producer] [-b batch] [-q capacity]
+//Pushes timestamped items through a mutex-protected deque, one lock-free
+//MpmcQueue and a per-core ShardedQueue, with the same bounded capacity, and
+//prints throughput and enqueue-to-dequeue latency for each. Consumers take
+//up to -b items per dequeue (one lock hold for the mutex queue).
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <getopt.h>
+#include "mpmc_queue.h"
+
+struct Item {
+    uint64_t enqueuedNs;
+};
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Baseline: the obvious bounded queue, one mutex around a deque
+class MutexQueue {
+public:
+    explicit MutexQueue(size_t capacity) : capacity(capacity) {}
+
+    bool try_push(const Item& item) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (items.size() >= capacity) return false;
+        items.push_back(item);
+        return true;
+    }
+
+    size_t try_pop_bulk(Item* out, size_t max) {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t n = std::min(max, items.size());
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = items.front();
+            items.pop_front();
+        }
+        return n;
+    }
+
+private:
+    std::mutex lock;
+    std::deque<Item> items;
+    size_t capacity;
+};
+
+struct BenchConfig {
+    int producers = 4;
+    int consumers = 4;
+    long items = 200000;  // per producer
+    int batch = 1;
+    size_t capacity = 4096;
+};
+
+struct BenchResult {
+    double seconds;
+    double p50Ns, p99Ns;
+};
+
+// Function to run producers and consumers over one queue; every 16th item's
+// latency is kept for the percentiles
+template <typename Queue>
+static BenchResult runBench(Queue& queue, const BenchConfig& config) {
+    const long total = config.items * config.producers;
+    std::atomic<long> consumed(0);
+    std::atomic<int> ready(0);
+    std::vector<std::vector<uint64_t>> latency(config.consumers);
+    std::vector<std::thread> threads;
+    const int everyone = config.producers + config.consumers;
+
+    for (int p = 0; p < config.producers; ++p) {
+        threads.emplace_back([&] {
+            ready.fetch_add(1);
+            while (ready.load() < everyone) std::this_thread::yield();
+            for (long i = 0; i < config.items; ++i) {
+                Item item = {nowNs()};
+                while (!queue.try_push(item)) std::this_thread::yield();
+            }
+        });
+    }
+    for (int c = 0; c < config.consumers; ++c) {
+        threads.emplace_back([&, c] {
+            std::vector<Item> got(config.batch);
+            std::vector<uint64_t>& mine = latency[c];
+            uint64_t seen = 0;
+            ready.fetch_add(1);
+            while (ready.load() < everyone) std::this_thread::yield();
+            while (consumed.load(std::memory_order_relaxed) < total) {
+                size_t n = queue.try_pop_bulk(got.data(), config.batch);
+                if (n == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                uint64_t now = nowNs();
+                for (size_t i = 0; i < n; ++i) {
+                    if ((seen++ & 15) == 0) mine.push_back(now - got[i].enqueuedNs);
+                }
+                consumed.fetch_add(n, std::memory_order_relaxed);
+            }
+        });
+    }
+    while (ready.load() < everyone) std::this_thread::yield();
+    uint64_t start = nowNs();
+    for (std::thread& t : threads) t.join();
+    uint64_t end = nowNs();
+
+    std::vector<uint64_t> all;
+    for (std::vector<uint64_t>& l : latency) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    BenchResult result;
+    result.seconds = (end - start) * 1e-9;
+    result.p50Ns = all.empty() ? 0 : all[all.size() / 2];
+    result.p99Ns = all.empty() ? 0 : all[(size_t)(all.size() * 0.99)];
+    return result;
+}
+
+static void printResult(const char* name, const BenchConfig& config, const BenchResult& r) {
+    double ops = 2.0 * config.items * config.producers;  // an enqueue and a dequeue per item
+    printf("%-10s %10.2f %12.0f %12.0f\n", name, ops / r.seconds * 1e-6, r.p50Ns, r.p99Ns);
+}
+
+static void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [-p producers] [-c consumers] [-n items_per_producer] [-b batch] [-q capacity]\n";
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:n:b:q:h")) != -1) {
+        switch (opt) {
+        case 'p': config.producers = atoi(optarg); break;
+        case 'c': config.consumers = atoi(optarg); break;
+        case 'n': config.items = atol(optarg); break;
+        case 'b': config.batch = atoi(optarg); break;
+        case 'q': config.capacity = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (config.producers <= 0 || config.consumers <= 0 || config.items <= 0 || config.batch <= 0 ||
+        config.capacity < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%d producers, %d consumers, %ld items each, batch %d, capacity %zu\n", config.producers,
+           config.consumers, config.items, config.batch, config.capacity);
+    printf("%-10s %10s %12s %12s\n", "queue", "Mops/s", "p50 ns", "p99 ns");
+    {
+        MutexQueue queue(config.capacity);
+        printResult("mutex", config, runBench(queue, config));
+    }
+    {
+        MpmcQueue<Item> queue(config.capacity);
+        printResult("mpmc", config, runBench(queue, config));
+    }
+    {
+        // Same total capacity, split over the shards
+        int shards = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+        ShardedQueue<Item> queue(std::max<size_t>(2, config.capacity / shards), shards);
+        printResult("sharded", config, runBench(queue, config));
+    }
+    return 0;
+}
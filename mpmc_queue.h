@@ -0,0 +1,191 @@
+// Bounded lock-free multi-producer/multi-consumer queues.
+//
+// MpmcQueue is Vyukov's array queue: every cell carries a sequence number
+// that says whether it is free for the producer of a given position or full
+// for the consumer of it, so producers and consumers only contend on their
+// own position counter. try_pop_bulk() claims a run of full cells with one
+// CAS.
+//
+// ShardedQueue puts one MpmcQueue per core: producers push to the shard of
+// the CPU they run on and consumers pop from their home shard first, only
+// stealing from the others when it is empty, so in the common case threads
+// on different cores touch different cache lines.
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+template <typename T>
+class MpmcQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit MpmcQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) cells[i].seq.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // false when full, and then item is left as it was
+    bool try_push(T&& item) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(item);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // the consumer of the previous lap hasn't freed it
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_push(const T& item) {
+        T copy(item);
+        return try_push(std::move(copy));
+    }
+
+    // false when empty
+    bool try_pop(T& item) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    item = std::move(cell.data);
+                    cell.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Pop up to max items with a single CAS; returns how many
+    size_t try_pop_bulk(T* out, size_t max) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t n = 0;
+            while (n < max && cells[(pos + n) & mask].seq.load(std::memory_order_acquire) == pos + n + 1) ++n;
+            if (n == 0) {
+                // empty, unless another consumer moved on while we looked
+                size_t now = dequeuePos.load(std::memory_order_relaxed);
+                if (now == pos) return 0;
+                pos = now;
+                continue;
+            }
+            if (dequeuePos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < n; ++i) {
+                    Cell& cell = cells[(pos + i) & mask];
+                    out[i] = std::move(cell.data);
+                    cell.seq.store(pos + i + mask + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    // Racy by nature: only a hint for whether to go to sleep
+    bool empty() const {
+        return dequeuePos.load(std::memory_order_acquire) >= enqueuePos.load(std::memory_order_acquire);
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+template <typename T>
+class ShardedQueue {
+public:
+    // One shard per online CPU unless told otherwise
+    explicit ShardedQueue(size_t capacity_per_shard, int shard_count = 0) {
+        if (shard_count <= 0) shard_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (shard_count <= 0) shard_count = 1;
+        for (int i = 0; i < shard_count; ++i) shards.emplace_back(new MpmcQueue<T>(capacity_per_shard));
+    }
+
+    int shard_count() const { return (int)shards.size(); }
+
+    // Shard of the calling thread's current CPU
+    int home() const {
+        int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : cpu % (int)shards.size();
+    }
+
+    // Push to the home shard, spilling to the next ones when it is full
+    bool try_push(T&& item, int shard = -1) {
+        if (shard < 0) shard = home();
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (shards[(shard + i) % shards.size()]->try_push(std::move(item))) return true;
+        }
+        return false;
+    }
+
+    bool try_push(const T& item, int shard = -1) {
+        T copy(item);
+        return try_push(std::move(copy), shard);
+    }
+
+    // Pop from the home shard, then steal from the others in order
+    bool try_pop(T& item, int shard = -1) {
+        if (shard < 0) shard = home();
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (shards[(shard + i) % shards.size()]->try_pop(item)) return true;
+        }
+        return false;
+    }
+
+    // Bulk pop from the first non-empty shard, starting at home
+    size_t try_pop_bulk(T* out, size_t max, int shard = -1) {
+        if (shard < 0) shard = home();
+        for (size_t i = 0; i < shards.size(); ++i) {
+            size_t n = shards[(shard + i) % shards.size()]->try_pop_bulk(out, max);
+            if (n > 0) return n;
+        }
+        return 0;
+    }
+
+    bool empty() const {
+        for (const auto& s : shards) {
+            if (!s->empty()) return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::unique_ptr<MpmcQueue<T>>> shards;
+};
+
+#endif
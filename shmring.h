@@ -0,0 +1,346 @@
+// Zero-copy operand passing between a client process and the GEMM engine.
+//
+// The client creates one memfd region and hands the fd to the server over a
+// Unix socket (SCM_RIGHTS); both map it. The region holds
+//   - a header with two single-producer/single-consumer rings of ShmJob:
+//     submissions (client -> server) and completions (server -> client),
+//     synchronised with atomics only, and a shared futex for sleeping
+//   - a table of reference-counted handles, each naming a range of the arena
+//   - the arena, where the client writes A and B and the server writes C.
+// A submitted job holds a reference on each of its handles until the server
+// completes it, so the client may release an operand while it is still in
+// use, or keep reusing one (e.g. the same A) across jobs, without copying.
+//
+// The server does not trust the client: the region must be sealed against
+// resizing, the layout is copied out of the header once and checked, and
+// operand ranges are read once and bounds-checked before use.
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static const uint32_t SHMRING_MAGIC = 0x52494e47;  // "RING"
+static const uint64_t SHMRING_ALIGN = 4096;         // operands start on a page
+
+struct ShmJob {
+    uint32_t id;
+    uint32_t n;        // C := A*B, row-major n x n
+    uint32_t a, b, c;  // handle indices
+    int32_t status;    // set by the server on completion: 0 or an errno value
+};
+
+struct ShmHandle {
+    std::atomic<uint32_t> refs;  // 0: free (bytes may be reused)
+    uint32_t pad;
+    uint64_t offset;             // from the start of the region
+    uint64_t bytes;
+};
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t slots;             // ring capacity, a power of two
+    uint32_t handles;           // handle table entries
+    uint32_t pad;
+    uint64_t bytes;             // whole region
+    uint64_t arena;             // offset of the arena
+    alignas(64) std::atomic<uint32_t> subTail;   // written by the client
+    alignas(64) std::atomic<uint32_t> subHead;   // written by the server
+    alignas(64) std::atomic<uint32_t> compTail;  // written by the server
+    alignas(64) std::atomic<uint32_t> compHead;  // written by the client
+    alignas(64) std::atomic<uint32_t> subWaiters;
+    std::atomic<uint32_t> compWaiters;
+    std::atomic<uint32_t> closed;                // client has detached
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared-memory atomics must be address-free");
+
+// Sleep until word != seen (or timeout_ms passes); waiters tells the other
+// side a wake-up is needed. Spins briefly first, since jobs are short, unless
+// there is only one CPU and spinning would just hold up the other side.
+inline void shmring_wait(std::atomic<uint32_t>& word, uint32_t seen, std::atomic<uint32_t>& waiters, int timeout_ms) {
+    static const int spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 2000 : 0;
+    for (int spin = 0; spin < spins; ++spin) {
+        if (word.load(std::memory_order_acquire) != seen) return;
+        __builtin_ia32_pause();
+    }
+    waiters.fetch_add(1);
+    if (word.load() == seen) {
+        timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, seen, &ts, NULL, 0);
+    }
+    waiters.fetch_sub(1);
+}
+
+inline void shmring_wake(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters) {
+    if (waiters.load() != 0) {
+        syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Mapping shared by both sides
+class ShmRegion {
+public:
+    ShmRegion(const ShmRegion&) = delete;
+    ShmRegion& operator=(const ShmRegion&) = delete;
+
+    ~ShmRegion() {
+        if (base != NULL) munmap(base, bytes);
+        if (fd >= 0) close(fd);
+    }
+
+    bool valid() const { return base != NULL; }
+    int memfd() const { return fd; }
+    ShmRingHeader& header() const { return *(ShmRingHeader*)base; }
+    uint32_t handleCount() const { return handleSlots; }
+    ShmHandle& handle(uint32_t h) const { return handleTable()[h]; }
+    double* data(uint32_t h) const { return (double*)((char*)base + handle(h).offset); }
+
+    // Drop one reference; the range becomes reusable when the last goes
+    void release(uint32_t h) { handle(h).refs.fetch_sub(1, std::memory_order_acq_rel); }
+
+protected:
+    ShmRegion() {}
+
+    static uint64_t roundUp(uint64_t x, uint64_t to) { return (x + to - 1) / to * to; }
+    // End of the rings and handle table, where the arena may start
+    static uint64_t tableEnd(uint32_t slots, uint32_t handles) {
+        return roundUp(sizeof(ShmRingHeader), 64) + 2 * (uint64_t)slots * sizeof(ShmJob) +
+               (uint64_t)handles * sizeof(ShmHandle);
+    }
+    ShmJob* subRing() const { return (ShmJob*)((char*)base + roundUp(sizeof(ShmRingHeader), 64)); }
+    ShmJob* compRing() const { return subRing() + ringSlots; }
+    ShmHandle* handleTable() const { return (ShmHandle*)(compRing() + ringSlots); }
+
+    int fd = -1;
+    void* base = NULL;
+    size_t bytes = 0;
+    // Layout, kept here rather than read back from the shared header
+    uint32_t ringSlots = 0;
+    uint32_t handleSlots = 0;
+    uint64_t arenaOffset = 0;
+};
+
+// Client side: owns the region, allocates operands, submits jobs
+class ShmRingClient : public ShmRegion {
+public:
+    ShmRingClient(size_t arena_bytes, uint32_t slots = 64, uint32_t handles = 256) {
+        uint32_t s = 1;
+        while (s < slots) s <<= 1;
+        uint64_t arena = roundUp(tableEnd(s, handles), SHMRING_ALIGN);
+        bytes = arena + roundUp(arena_bytes, SHMRING_ALIGN);
+        fd = memfd_create("shmring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0 || ftruncate(fd, bytes) != 0) return;
+        // The server refuses regions whose size could still change under it
+        if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) return;
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return;
+        base = p;  // memfd pages start zeroed: rings empty, every handle free
+        ringSlots = s;
+        handleSlots = handles;
+        arenaOffset = arena;
+        ShmRingHeader& hdr = header();
+        hdr.slots = s;
+        hdr.handles = handles;
+        hdr.bytes = bytes;
+        hdr.arena = arena;
+        top = arena;
+        hdr.magic = SHMRING_MAGIC;
+    }
+
+    ~ShmRingClient() {
+        if (valid()) {
+            header().closed.store(1);
+            shmring_wake(header().subTail, header().subWaiters);
+        }
+    }
+
+    // Pass the region to the server with one byte-stream message, header first
+    bool sendTo(int sock, const void* msg, size_t len) const {
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        iovec iov = {(void*)msg, len};
+        msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+        return sendmsg(sock, &mh, MSG_NOSIGNAL) == (ssize_t)len;
+    }
+
+    // New operand of at least `size` bytes, holding one reference; -1 when full.
+    // Free ranges are reused first fit, otherwise carved from the top of the arena
+    int alloc(size_t size) {
+        size = roundUp(size, SHMRING_ALIGN);
+        int fresh = -1;
+        for (uint32_t h = 0; h < handleCount(); ++h) {
+            ShmHandle& e = handle(h);
+            if (e.refs.load(std::memory_order_acquire) != 0) continue;
+            if (e.bytes >= size) {
+                e.refs.store(1, std::memory_order_relaxed);
+                return (int)h;
+            }
+            if (e.bytes == 0 && fresh < 0) fresh = (int)h;
+        }
+        if (fresh < 0 || top + size > bytes) return -1;
+        ShmHandle& e = handle(fresh);
+        e.offset = top;
+        e.bytes = size;
+        e.refs.store(1, std::memory_order_relaxed);
+        top += size;
+        return fresh;
+    }
+
+    // Queue C := A*B; false when the ring is full. The job takes its own
+    // reference on each handle, dropped by the server when it completes
+    bool submit(uint32_t id, uint32_t n, uint32_t a, uint32_t b, uint32_t c) {
+        ShmRingHeader& hdr = header();
+        uint32_t tail = hdr.subTail.load(std::memory_order_relaxed);
+        if (tail - hdr.compHead.load(std::memory_order_acquire) >= ringSlots) return false;  // completions not yet read
+        for (uint32_t h : {a, b, c}) handle(h).refs.fetch_add(1, std::memory_order_relaxed);
+        subRing()[tail & (ringSlots - 1)] = ShmJob{id, n, a, b, c, 0};
+        hdr.subTail.store(tail + 1);
+        shmring_wake(hdr.subTail, hdr.subWaiters);
+        return true;
+    }
+
+    // Next completion, waiting up to timeout_ms; false on timeout
+    bool complete(ShmJob& job, int timeout_ms) {
+        ShmRingHeader& hdr = header();
+        uint32_t head = hdr.compHead.load(std::memory_order_relaxed);
+        uint32_t tail = hdr.compTail.load(std::memory_order_acquire);
+        if (head == tail) {
+            shmring_wait(hdr.compTail, tail, hdr.compWaiters, timeout_ms);
+            if (head == hdr.compTail.load(std::memory_order_acquire)) return false;
+        }
+        job = compRing()[head & (ringSlots - 1)];
+        hdr.compHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    uint64_t top = 0;  // first unallocated arena byte
+};
+
+// Server side: maps a region received from a client, takes jobs, completes them.
+// Completions may come from any worker thread, so that end is serialised
+// locally; the rings themselves stay single-producer/single-consumer.
+class ShmRingServer : public ShmRegion {
+public:
+    explicit ShmRingServer(int memfd) {
+        fd = memfd;
+        // Unsealed, the client could shrink the file and fault us on access
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) return;
+        ShmRingHeader probe;
+        if (pread(fd, &probe, sizeof(probe), 0) != (ssize_t)sizeof(probe) || probe.magic != SHMRING_MAGIC) return;
+        off_t size = lseek(fd, 0, SEEK_END);
+        if (size < 0 || probe.bytes > (uint64_t)size || probe.slots == 0 || (probe.slots & (probe.slots - 1)) != 0) return;
+        if (probe.arena < tableEnd(probe.slots, probe.handles) || probe.arena > probe.bytes) return;
+        bytes = probe.bytes;
+        ringSlots = probe.slots;
+        handleSlots = probe.handles;
+        arenaOffset = probe.arena;
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) base = p;
+    }
+
+    bool closed() const { return header().closed.load() != 0; }
+
+    // Next submitted job, waiting up to timeout_ms; false on timeout
+    bool next(ShmJob& job, int timeout_ms) {
+        ShmRingHeader& hdr = header();
+        uint32_t head = hdr.subHead.load(std::memory_order_relaxed);
+        uint32_t tail = hdr.subTail.load(std::memory_order_acquire);
+        if (head == tail) {
+            shmring_wait(hdr.subTail, tail, hdr.subWaiters, timeout_ms);
+            if (head == hdr.subTail.load(std::memory_order_acquire)) return false;
+        }
+        job = subRing()[head & (ringSlots - 1)];
+        hdr.subHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Operand of a job, or NULL if the handle is out of range or too small.
+    // The range is read once, so the client cannot move it after the check
+    double* operand(uint32_t h, uint32_t n) const {
+        if (h >= handleCount()) return NULL;
+        const ShmHandle& e = handle(h);
+        uint64_t offset = *(const volatile uint64_t*)&e.offset;
+        uint64_t size = *(const volatile uint64_t*)&e.bytes;
+        uint64_t elems = (uint64_t)n * n;
+        if (offset < arenaOffset || offset > bytes || size > bytes - offset || elems > size / sizeof(double)) {
+            return NULL;
+        }
+        return (double*)((char*)base + offset);
+    }
+
+    // Post the result and drop the job's references
+    void finish(const ShmJob& job) {
+        {
+            std::lock_guard<std::mutex> guard(completeLock);
+            ShmRingHeader& hdr = header();
+            uint32_t tail = hdr.compTail.load(std::memory_order_relaxed);
+            compRing()[tail & (ringSlots - 1)] = job;
+            hdr.compTail.store(tail + 1);
+            shmring_wake(hdr.compTail, hdr.compWaiters);
+        }
+        for (uint32_t h : {job.a, job.b, job.c}) {
+            if (h < handleCount()) release(h);
+        }
+    }
+
+private:
+    std::mutex completeLock;
+};
+
+// Receive len bytes, plus a file descriptor if one was attached (else -1)
+inline bool shmring_recv_fd(int sock, void* buf, size_t len, int& passed) {
+    passed = -1;
+    char control[CMSG_SPACE(sizeof(int))];
+    iovec iov = {buf, len};
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    ssize_t r;
+    do {
+        r = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) return false;
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) memcpy(&passed, CMSG_DATA(cm), sizeof(int));
+    }
+    // The rest of the message, if the first read was short
+    char* p = (char*)buf + r;
+    size_t left = len - r;
+    while (left > 0) {
+        r = read(sock, p, left);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        left -= r;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,371 @@
+//compile with g++ -O2 -march=native summa.cpp -o summa
+//usage: summa [-n size] [-p procs | -g ROWSxCOLS] [-k panel] [-b block] [-c]
+//       summa -s [-n size] [-p max_procs] [-k panel] [-b block]
+//Multiplies row-major n x n matrices with SUMMA on a 2D grid of local
+//processes. Process (r, c) owns the (r, c) blocks of A, B and C. For each
+//k panel the owners copy their piece of A(:, k) and B(k, :) into shared
+//memory once and every process of the row (A) or column (B) reads it from
+//there: that copy is the broadcast. Panels are double buffered and the
+//next one is published before the current one is multiplied, so the
+//broadcast overlaps the local dgemm.
+//  -c  check C against a single-process multiply
+//  -s  strong and weak scaling over 1, 2, 4, ... max_procs processes
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "matalloc.h"
+#include "dgemm.h"
+
+// One double-buffered panel slot, shared by a process row (A) or column (B)
+struct alignas(64) PanelSlot {
+    std::atomic<int> ready;  // index of the panel it holds, -1 before the first
+    std::atomic<int> done;   // readers finished with it, over all panels so far
+};
+
+struct RankStats {
+    long long startNs;
+    long long endNs;
+    long long waitNs;  // spent waiting for panels or for a slot to free up
+};
+
+struct SummaRun {
+    int n;
+    int rows, cols;  // process grid
+    int kb;          // panel width
+    int bs;          // kernel block
+    bool check;
+    std::vector<int> panels;  // panel boundaries: 0, ..., n
+};
+
+struct SummaResult {
+    double seconds;
+    double waitFraction;  // mean over ranks of wait time / elapsed
+    double maxDiff;       // -1 when not checked
+};
+
+static long long nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// First index of part i when n items are split into parts nearly equal blocks
+static int partStart(int n, int parts, int i) {
+    return (int)((long long)n * i / parts);
+}
+
+static int partOwner(int n, int parts, int k) {
+    int p = 0;
+    while (partStart(n, parts, p + 1) <= k) ++p;
+    return p;
+}
+
+// Deterministic small multiples of 1/4: products and sums stay exact, so
+// the check can demand identical results whatever the summation order
+static double valueA(int i, int j) { return ((i * 7 + j * 13) % 11 - 5) * 0.25; }
+static double valueB(int i, int j) { return ((i * 5 + j * 3) % 9 - 4) * 0.25; }
+
+// Layout of the region shared by all ranks
+struct SharedLayout {
+    size_t aSlots, bSlots, aBuf, bBuf, stats, arrived, globalC, bytes;
+    size_t aPanel, bPanel;  // doubles per panel buffer
+};
+
+static SharedLayout sharedLayout(const SummaRun& run) {
+    SharedLayout l;
+    int maxRows = partStart(run.n, run.rows, 1) + 1, maxCols = partStart(run.n, run.cols, 1) + 1;
+    l.aPanel = (size_t)maxRows * run.kb;
+    l.bPanel = (size_t)run.kb * maxCols;
+    size_t off = 0;
+    l.arrived = off;  off += 64;
+    l.aSlots = off;   off += sizeof(PanelSlot) * 2 * run.rows;
+    l.bSlots = off;   off += sizeof(PanelSlot) * 2 * run.cols;
+    l.stats = off;    off += sizeof(RankStats) * run.rows * run.cols;
+    off = (off + 63) / 64 * 64;
+    l.aBuf = off;     off += sizeof(double) * l.aPanel * 2 * run.rows;
+    l.bBuf = off;     off += sizeof(double) * l.bPanel * 2 * run.cols;
+    l.globalC = off;  off += run.check ? sizeof(double) * run.n * run.n : 0;
+    l.bytes = off;
+    return l;
+}
+
+// Spin (yielding, as ranks may outnumber cores) until value >= target
+static void waitAtLeast(std::atomic<int>& value, int target, long long& waitNs) {
+    if (value.load(std::memory_order_acquire) >= target) return;
+    long long t0 = nowNs();
+    while (value.load(std::memory_order_acquire) < target) sched_yield();
+    waitNs += nowNs() - t0;
+}
+
+// Function to run one rank of the grid; returns through the shared region
+static void runRank(const SummaRun& run, const SharedLayout& layout, char* shared, int rank) {
+    const int r = rank / run.cols, c = rank % run.cols;
+    const int i0 = partStart(run.n, run.rows, r), rowsHere = partStart(run.n, run.rows, r + 1) - i0;
+    const int j0 = partStart(run.n, run.cols, c), colsHere = partStart(run.n, run.cols, c + 1) - j0;
+    PanelSlot* aSlots = (PanelSlot*)(shared + layout.aSlots) + 2 * r;
+    PanelSlot* bSlots = (PanelSlot*)(shared + layout.bSlots) + 2 * c;
+    double* aBuf = (double*)(shared + layout.aBuf) + 2 * r * layout.aPanel;
+    double* bBuf = (double*)(shared + layout.bBuf) + 2 * c * layout.bPanel;
+    RankStats& stats = ((RankStats*)(shared + layout.stats))[rank];
+    std::atomic<int>& arrived = *(std::atomic<int>*)(shared + layout.arrived);
+
+    // Local blocks (at least one element so empty ranks still get a pointer)
+    size_t localElems = std::max<size_t>(1, (size_t)rowsHere * colsHere);
+    double* A = alloc_matrix(localElems);
+    double* B = alloc_matrix(localElems);
+    double* C = alloc_matrix(localElems);
+    for (int i = 0; i < rowsHere; ++i) {
+        for (int j = 0; j < colsHere; ++j) {
+            A[(size_t)i * colsHere + j] = valueA(i0 + i, j0 + j);
+            B[(size_t)i * colsHere + j] = valueB(i0 + i, j0 + j);
+        }
+    }
+
+    const int panelCount = (int)run.panels.size() - 1;
+    stats.waitNs = 0;
+    long long waitNs = 0;
+
+    // Publish panel p if this rank owns a piece of it. A slot is reused every
+    // second panel, once all its readers are done with the panel before
+    auto publish = [&](int p) {
+        int k0 = run.panels[p], k1 = run.panels[p + 1], w = k1 - k0;
+        int uses = p / 2;  // earlier panels that went through this slot
+        if (partOwner(run.n, run.cols, k0) == c) {
+            PanelSlot& slot = aSlots[p % 2];
+            waitAtLeast(slot.done, uses * run.cols, waitNs);
+            double* dst = aBuf + (p % 2) * layout.aPanel;
+            for (int i = 0; i < rowsHere; ++i) {
+                std::copy(A + (size_t)i * colsHere + (k0 - j0), A + (size_t)i * colsHere + (k1 - j0), dst + (size_t)i * w);
+            }
+            slot.ready.store(p, std::memory_order_release);
+        }
+        if (partOwner(run.n, run.rows, k0) == r) {
+            PanelSlot& slot = bSlots[p % 2];
+            waitAtLeast(slot.done, uses * run.rows, waitNs);
+            double* dst = bBuf + (p % 2) * layout.bPanel;
+            std::copy(B + (size_t)(k0 - i0) * colsHere, B + (size_t)(k1 - i0) * colsHere, dst);
+            slot.ready.store(p, std::memory_order_release);
+        }
+    };
+
+    // Start together so the timing covers only the multiply
+    arrived.fetch_add(1);
+    waitAtLeast(arrived, run.rows * run.cols, waitNs);
+    waitNs = 0;
+    stats.startNs = nowNs();
+
+    publish(0);
+    for (int p = 0; p < panelCount; ++p) {
+        if (p + 1 < panelCount) publish(p + 1);
+        PanelSlot& aSlot = aSlots[p % 2];
+        PanelSlot& bSlot = bSlots[p % 2];
+        waitAtLeast(aSlot.ready, p, waitNs);
+        waitAtLeast(bSlot.ready, p, waitNs);
+        int w = run.panels[p + 1] - run.panels[p];
+        if (rowsHere > 0 && colsHere > 0) {
+            dgemm_rect(rowsHere, colsHere, w, aBuf + (p % 2) * layout.aPanel, w, bBuf + (p % 2) * layout.bPanel,
+                       colsHere, C, colsHere, run.bs);
+        }
+        aSlot.done.fetch_add(1, std::memory_order_acq_rel);
+        bSlot.done.fetch_add(1, std::memory_order_acq_rel);
+    }
+    stats.endNs = nowNs();
+    stats.waitNs = waitNs;
+
+    if (run.check) {
+        double* globalC = (double*)(shared + layout.globalC);
+        for (int i = 0; i < rowsHere; ++i) {
+            std::copy(C + (size_t)i * colsHere, C + (size_t)(i + 1) * colsHere, globalC + (size_t)(i0 + i) * run.n + j0);
+        }
+    }
+    free_matrix(A);
+    free_matrix(B);
+    free_matrix(C);
+}
+
+// Function to fork the grid, wait for it and collect timings
+static bool runSumma(SummaRun& run, SummaResult& result) {
+    // Panel boundaries: every kb columns, and wherever the owner of A's
+    // columns or B's rows changes, so each panel has a single owner
+    run.panels.clear();
+    for (int k = 0; k < run.n; k += run.kb) run.panels.push_back(k);
+    for (int c = 1; c < run.cols; ++c) run.panels.push_back(partStart(run.n, run.cols, c));
+    for (int r = 1; r < run.rows; ++r) run.panels.push_back(partStart(run.n, run.rows, r));
+    run.panels.push_back(run.n);
+    std::sort(run.panels.begin(), run.panels.end());
+    run.panels.erase(std::unique(run.panels.begin(), run.panels.end()), run.panels.end());
+
+    SharedLayout layout = sharedLayout(run);
+    char* shared = (char*)mmap(NULL, layout.bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("summa: mmap");
+        return false;
+    }
+    PanelSlot* slots = (PanelSlot*)(shared + layout.aSlots);
+    for (int s = 0; s < 2 * (run.rows + run.cols); ++s) {
+        slots[s].ready.store(-1);
+        slots[s].done.store(0);
+    }
+
+    const int procs = run.rows * run.cols;
+    std::vector<pid_t> children;
+    for (int rank = 0; rank < procs; ++rank) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            runRank(run, layout, shared, rank);
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("summa: fork");
+            for (pid_t child : children) kill(child, SIGKILL);
+            break;
+        }
+        children.push_back(pid);
+    }
+    bool ok = (int)children.size() == procs;
+    for (pid_t child : children) {
+        int status;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+
+    if (ok) {
+        RankStats* stats = (RankStats*)(shared + layout.stats);
+        long long start = stats[0].startNs, end = stats[0].endNs;
+        double wait = 0.0;
+        for (int rank = 0; rank < procs; ++rank) {
+            start = std::min(start, stats[rank].startNs);
+            end = std::max(end, stats[rank].endNs);
+        }
+        for (int rank = 0; rank < procs; ++rank) wait += (double)stats[rank].waitNs / (end - start);
+        result.seconds = (end - start) * 1e-9;
+        result.waitFraction = wait / procs;
+        result.maxDiff = -1.0;
+
+        if (run.check) {
+            double* A = alloc_matrix((size_t)run.n * run.n);
+            double* B = alloc_matrix((size_t)run.n * run.n);
+            double* C = alloc_matrix((size_t)run.n * run.n);
+            for (int i = 0; i < run.n; ++i) {
+                for (int j = 0; j < run.n; ++j) {
+                    A[(size_t)i * run.n + j] = valueA(i, j);
+                    B[(size_t)i * run.n + j] = valueB(i, j);
+                }
+            }
+            dgemm_tile(run.n, 0, run.n, 0, run.n, run.bs, A, B, C);
+            const double* globalC = (const double*)(shared + layout.globalC);
+            result.maxDiff = 0.0;
+            for (size_t i = 0; i < (size_t)run.n * run.n; ++i) {
+                result.maxDiff = std::max(result.maxDiff, std::fabs(globalC[i] - C[i]));
+            }
+            free_matrix(A);
+            free_matrix(B);
+            free_matrix(C);
+        }
+    }
+    munmap(shared, layout.bytes);
+    return ok;
+}
+
+// Most square ROWS x COLS grid with ROWS * COLS == procs
+static void squareGrid(int procs, int& rows, int& cols) {
+    rows = (int)std::sqrt((double)procs);
+    while (procs % rows != 0) --rows;
+    cols = procs / rows;
+}
+
+static void printRun(const SummaRun& run, const SummaResult& result) {
+    printf("%dx%d grid, n %d, %zu panels: %.4f s, %.2f GFLOP/s, %.1f%% waiting on panels", run.rows, run.cols, run.n,
+           run.panels.size() - 1, result.seconds, 2.0 * run.n * run.n * run.n / result.seconds * 1e-9,
+           100.0 * result.waitFraction);
+    if (result.maxDiff >= 0) printf(", max diff %g", result.maxDiff);
+    printf("\n");
+}
+
+// Strong scaling keeps n; weak scaling keeps the flops per process constant
+// (n grows with the cube root of the process count)
+static int runScaling(SummaRun base, int maxProcs) {
+    std::vector<int> counts;
+    for (int p = 1; p < maxProcs; p *= 2) counts.push_back(p);
+    counts.push_back(maxProcs);
+
+    for (int weak = 0; weak < 2; ++weak) {
+        printf("\n%s scaling\n%6s %6s %6s %10s %10s %10s %8s\n", weak ? "Weak" : "Strong", "procs", "grid", "n",
+               "seconds", "GFLOP/s", "efficiency", "wait");
+        double t1 = 0.0;
+        for (int procs : counts) {
+            SummaRun run = base;
+            squareGrid(procs, run.rows, run.cols);
+            if (weak) run.n = (int)std::lround(base.n * std::cbrt((double)procs));
+            SummaResult result;
+            if (!runSumma(run, result)) return 1;
+            if (procs == 1) t1 = result.seconds;
+            // Strong: T1 / (P * TP). Weak: T1 / TP, the work per process being fixed
+            double efficiency = weak ? t1 / result.seconds : t1 / (procs * result.seconds);
+            char grid[32];
+            snprintf(grid, sizeof(grid), "%dx%d", run.rows, run.cols);
+            printf("%6d %6s %6d %10.4f %10.2f %9.1f%% %7.1f%%\n", procs, grid, run.n, result.seconds,
+                   2.0 * run.n * run.n * run.n / result.seconds * 1e-9, 100.0 * efficiency, 100.0 * result.waitFraction);
+        }
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [-n size] [-p procs | -g ROWSxCOLS] [-k panel] [-b block] [-c]\n"
+              << "       " << prog << " -s [-n size] [-p max_procs] [-k panel] [-b block]\n";
+}
+
+int main(int argc, char** argv) {
+    SummaRun run;
+    run.n = 1024;
+    run.rows = run.cols = 0;
+    run.kb = 128;
+    run.bs = 64;
+    run.check = false;
+    int procs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool scaling = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:g:k:b:csh")) != -1) {
+        switch (opt) {
+        case 'n': run.n = atoi(optarg); break;
+        case 'p': procs = atoi(optarg); break;
+        case 'g':
+            if (sscanf(optarg, "%dx%d", &run.rows, &run.cols) != 2) run.rows = -1;
+            break;
+        case 'k': run.kb = atoi(optarg); break;
+        case 'b': run.bs = atoi(optarg); break;
+        case 'c': run.check = true; break;
+        case 's': scaling = true; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (run.n <= 0 || procs <= 0 || run.kb <= 0 || run.bs <= 0 || run.rows < 0 || run.cols < 0 ||
+        (run.rows == 0) != (run.cols == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (scaling) {
+        return runScaling(run, procs);
+    }
+    if (run.rows == 0) {
+        squareGrid(procs, run.rows, run.cols);
+    }
+    SummaResult result;
+    if (!runSumma(run, result)) return 1;
+    printRun(run, result);
+    return result.maxDiff > 0 ? 1 : 0;
+}
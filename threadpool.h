@@ -0,0 +1,175 @@
+// Fixed worker pool running jobs made of independent tasks (e.g. the tiles of
+// one multiply). Jobs take turns one task at a time, so several jobs in
+// flight share the cores fairly instead of running first-come first-served,
+// and submit() returns at once with a future for the job's completion.
+//
+// Submission goes through a lock-free sharded queue (mpmc_queue.h) of job
+// tokens: a job enqueues one token per worker it can use, and a worker that
+// pops a token claims the job's next task and puts the token back at the
+// tail before running it, which is what makes jobs take turns. Nobody waits
+// on a full queue: a worker that cannot put its token back keeps it and goes
+// on to the job's next task, and a submitter parks its tokens on an overflow
+// list the workers also take from. The mutex is only taken for that list, by
+// workers going to sleep on an empty queue and by submitters waking them.
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mpmc_queue.h"
+#include "trace.h"
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int thread_count) : tokens(1024) {
+        for (int i = 0; i < thread_count; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& w : workers) w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers.size(); }
+
+    // Run task(0) .. task(count - 1) on the pool; the future is ready when
+    // all of them have returned, and carries the first exception thrown
+    std::future<void> submit(int count, std::function<void(int)> task) {
+        auto job = std::make_shared<Job>();
+        job->task = std::move(task);
+        job->count = count;
+        job->remaining = count;
+        std::future<void> done = job->done.get_future();
+        if (count <= 0) {
+            job->done.set_value();
+            return done;
+        }
+        int wanted = std::min(count, std::max(1, size()));
+        for (int t = 0; t < wanted; ++t) push(job);
+        return done;
+    }
+
+private:
+    struct Job {
+        std::function<void(int)> task;
+        int count;
+        std::atomic<int> next{0};     // next task index to hand out
+        std::atomic<int> remaining;   // tasks not yet finished
+        std::exception_ptr error;
+        std::mutex error_lock;
+        std::promise<void> done;
+    };
+
+    // Submitter's token: into the queue, or the overflow list when it is full
+    void push(const std::shared_ptr<Job>& job) {
+        if (!tokens.try_push(job)) {
+            std::lock_guard<std::mutex> guard(lock);
+            overflow.push_back(job);
+            overflowed.fetch_add(1);
+        }
+        notify();
+    }
+
+    // Worker's token going back to the tail; false when the queue is full
+    bool requeue(const std::shared_ptr<Job>& job) {
+        if (!tokens.try_push(job)) return false;
+        notify();
+        return true;
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load() > 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            wake.notify_one();
+        }
+    }
+
+    // Pop a token, spinning a little before sleeping; false once stopping and drained
+    bool next_token(std::shared_ptr<Job>& job, int home) {
+        for (;;) {
+            for (int spin = 0; spin < 64; ++spin) {
+                if (tokens.try_pop(job, home)) return true;
+                if (overflowed.load() > 0) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (!overflow.empty()) {
+                        job = std::move(overflow.front());
+                        overflow.pop_front();
+                        overflowed.fetch_sub(1);
+                        return true;
+                    }
+                }
+                std::this_thread::yield();
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            sleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (tokens.empty() && overflow.empty()) {
+                if (stopping) {
+                    sleepers.fetch_sub(1);
+                    return false;
+                }
+                TRACE_SCOPE("idle");
+                wake.wait(guard);
+            }
+            sleepers.fetch_sub(1);
+        }
+    }
+
+    void work(int id) {
+        const int home = id % tokens.shard_count();
+        trace_thread_name("pool worker " + std::to_string(id));
+        std::shared_ptr<Job> job;
+        bool kept = false;  // queue was full: run the same job's next task without queueing
+        while (kept || next_token(job, home)) {
+            kept = false;
+            int index = job->next.fetch_add(1);
+            if (index >= job->count) {
+                job.reset();  // a spare token of a job whose tasks are all handed out
+                continue;
+            }
+            if (index + 1 < job->count) kept = !requeue(job);
+            try {
+                TRACE_SCOPE("task", index);
+                job->task(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(job->error_lock);
+                if (!job->error) job->error = std::current_exception();
+            }
+            if (--job->remaining == 0) {
+                if (job->error) job->done.set_exception(job->error);
+                else job->done.set_value();
+            }
+            if (!kept) job.reset();
+        }
+    }
+
+    ShardedQueue<std::shared_ptr<Job>> tokens;
+    std::deque<std::shared_ptr<Job>> overflow;  // submitters' tokens that found the queue full, under lock
+    std::atomic<int> overflowed{0};             // overflow.size(), readable without the lock
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::atomic<int> sleepers{0};
+    bool stopping = false;
+};
+
+#endif
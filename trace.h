@@ -0,0 +1,260 @@
+// Per-thread timeline tracer with Chrome trace JSON export, for looking at
+// stragglers and idle gaps in Perfetto (ui.perfetto.dev) or chrome://tracing.
+//
+// Every thread records into its own ring buffer of TSC-stamped begin/end
+// events; nothing is shared on the recording path, so there are no locks or
+// atomics there, and a disabled tracer costs one load and branch per event.
+// A ring only takes a mutex twice: when its thread records its first event,
+// and when the thread exits. When a ring wraps the oldest events are
+// overwritten.
+//
+// Tracing is off unless TRACE_FILE is set in the environment (or trace_start()
+// is called); the trace is then written to that file: the events of a thread
+// that exits are appended and its ring freed, so programs that keep starting
+// pools do not pile up a ring per thread ever started, and the rest at exit.
+// trace_write() writes whatever rings are still held to a file of its choice
+// while the traced threads are quiet; without a TRACE_FILE the rings of
+// exited threads wait for it, trimmed to their events. Timestamps are
+// the TSC, converted with a rate measured against steady_clock over the run,
+// so they assume an invariant TSC (any x86 of the last decade).
+//
+//   TRACE_SCOPE("pack A");           begin now, end at the end of the scope
+//   TRACE_BEGIN("rows", i); ... TRACE_END("rows");
+//   trace_thread_name("worker 3");   label the calling thread's track
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+inline uint64_t trace_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct TraceEvent {
+    uint64_t ticks;
+    const char* name;  // a string literal: only the pointer is kept
+    long long arg;     // shown as args.i unless negative
+    char phase;        // 'B' or 'E'
+};
+
+struct TraceRing {
+    explicit TraceRing(size_t capacity) : events(capacity) {}
+    std::vector<TraceEvent> events;
+    size_t head = 0;  // events recorded, including overwritten ones
+    long tid = 0;
+    std::string name;
+    bool exited = false;  // thread gone, events kept for write()
+};
+
+inline void tracer_retire(TraceRing* ring);
+
+class Tracer {
+public:
+    Tracer() {
+        const char* file = getenv("TRACE_FILE");
+        if (file && *file) start(file);
+    }
+
+    ~Tracer() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (enabled && !path.empty() && openStream()) {
+            double ticksPerUs = rate();
+            for (const auto& r : rings) emitRing(stream, *r, ticksPerUs, streamFirst);
+            fprintf(stream, "\n]}\n");
+            fclose(stream);
+            stream = NULL;
+        }
+    }
+
+    // Start recording; path is where the trace goes at exit (empty: only
+    // trace_write)
+    void start(const std::string& file, size_t events_per_thread = 1 << 16) {
+        path = file;
+        capacity = events_per_thread;
+        startTicks = trace_ticks();
+        startTime = std::chrono::steady_clock::now();
+        enabled = true;
+    }
+
+    bool on() const { return enabled; }
+
+    void record(char phase, const char* name, long long arg = -1) {
+        TraceRing* r = ring();
+        r->events[r->head % r->events.size()] = TraceEvent{trace_ticks(), name, arg, phase};
+        ++r->head;
+    }
+
+    void threadName(const std::string& name) { ring()->name = name; }
+
+    // Chrome trace JSON of every ring still held; the recording threads must
+    // be idle. Rings of exited threads are freed once written
+    bool write(const std::string& file) {
+        double ticksPerUs = rate();
+        FILE* out = fopen(file.c_str(), "w");
+        if (!out) {
+            perror(file.c_str());
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        for (const auto& r : rings) emitRing(out, *r, ticksPerUs, first);
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::unique_ptr<TraceRing>& r) { return r->exited; }),
+                    rings.end());
+        return true;
+    }
+
+private:
+    // Gives the calling thread's ring back to the tracer when the thread exits
+    struct RingOwner {
+        TraceRing* ring = NULL;
+        ~RingOwner() {
+            if (ring) tracer_retire(ring);
+        }
+    };
+    friend void tracer_retire(TraceRing* ring);
+
+    TraceRing* ring() {
+        thread_local RingOwner mine;
+        if (!mine.ring) {
+            std::lock_guard<std::mutex> guard(lock);
+            rings.emplace_back(new TraceRing(capacity));
+            mine.ring = rings.back().get();
+            mine.ring->tid = syscall(SYS_gettid);
+        }
+        return mine.ring;
+    }
+
+    // A thread is exiting: append its events to the trace file and free the
+    // ring, or with no file keep only its events until write()
+    void retire(TraceRing* ring) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = std::find_if(rings.begin(), rings.end(),
+                               [ring](const std::unique_ptr<TraceRing>& r) { return r.get() == ring; });
+        if (it == rings.end()) return;
+        if (!path.empty() && openStream()) {
+            emitRing(stream, *ring, rate(), streamFirst);
+            rings.erase(it);
+            return;
+        }
+        size_t size = ring->events.size();
+        if (ring->head > size) {
+            std::rotate(ring->events.begin(), ring->events.begin() + ring->head % size, ring->events.end());
+            ring->head = size;
+        } else {
+            ring->events.resize(ring->head);
+        }
+        ring->events.shrink_to_fit();
+        ring->exited = true;
+    }
+
+    // The file events are streamed to, opened with its header on first use
+    bool openStream() {
+        if (stream) return true;
+        stream = fopen(path.c_str(), "w");
+        if (!stream) {
+            perror(path.c_str());
+            path.clear();  // keep rings in memory for write() instead
+            return false;
+        }
+        fprintf(stream, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        return true;
+    }
+
+    void emitRing(FILE* out, const TraceRing& r, double ticksPerUs, bool& first) const {
+        long pid = getpid();
+        if (!r.name.empty()) {
+            fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", pid, r.tid, r.name.c_str());
+            first = false;
+        }
+        size_t size = r.events.size();
+        size_t begin = r.head > size ? r.head - size : 0;
+        int depth = 0;
+        for (size_t e = begin; e < r.head; ++e) {
+            const TraceEvent& ev = r.events[e % size];
+            if (ev.phase == 'E' && depth == 0) continue;  // its begin was overwritten
+            depth += ev.phase == 'B' ? 1 : -1;
+            double ts = (double)(int64_t)(ev.ticks - startTicks) / ticksPerUs;
+            fprintf(out, "%s{\"ph\":\"%c\",\"name\":\"%s\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f", first ? "" : ",\n",
+                    ev.phase, ev.name, pid, r.tid, ts);
+            if (ev.arg >= 0) fprintf(out, ",\"args\":{\"i\":%lld}", ev.arg);
+            fprintf(out, "}");
+            first = false;
+        }
+    }
+
+    // TSC ticks per microsecond since start()
+    double rate() const {
+#if defined(__x86_64__) || defined(__i386__)
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+        uint64_t ticks = trace_ticks() - startTicks;
+        return us > 0 && ticks > 0 ? ticks / us : 1.0;
+#else
+        return 1000.0;
+#endif
+    }
+
+    bool enabled = false;
+    std::string path;
+    size_t capacity = 1 << 16;
+    uint64_t startTicks = 0;
+    std::chrono::steady_clock::time_point startTime;
+    std::mutex lock;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    FILE* stream = NULL;       // path, once a thread has exited or at exit
+    bool streamFirst = true;   // no event in stream yet
+};
+
+inline Tracer& tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+inline void tracer_retire(TraceRing* ring) { tracer().retire(ring); }
+
+inline void trace_start(const std::string& file) { tracer().start(file); }
+inline bool trace_write(const std::string& file) { return tracer().write(file); }
+inline void trace_thread_name(const std::string& name) {
+    if (tracer().on()) tracer().threadName(name);
+}
+
+struct TraceScope {
+    const char* name;
+    explicit TraceScope(const char* name, long long arg = -1) : name(name) {
+        if (tracer().on()) tracer().record('B', name, arg);
+    }
+    ~TraceScope() {
+        if (tracer().on()) tracer().record('E', name, -1);
+    }
+};
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define TRACE_BEGIN(...) \
+    do { if (tracer().on()) tracer().record('B', __VA_ARGS__); } while (0)
+#define TRACE_END(name) \
+    do { if (tracer().on()) tracer().record('E', (name), -1); } while (0)
+
+#endif
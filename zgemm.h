@@ -0,0 +1,236 @@
+/* Complex GEMM on the packing scheme of do_block (dgemm.h).
+ *
+ * Interleaved layout (std::complex arrays): A and B are packed into
+ * micro-panels exactly as pack_a/pack_b do, and an SSE3 micro-kernel keeps
+ * the real-times-real and swapped-times-imaginary sums apart, combining them
+ * with one addsub per element of C at the end. ZGEMM tiles are 2x2 complex
+ * doubles, CGEMM tiles 4x2 complex floats (two per register).
+ *
+ * Split layout (separate real and imaginary matrices) runs on the real
+ * kernel instead: 4M is four real products, 3M three (Gauss' trick, trading
+ * one product for additions and a little accuracy). Double only, as the real
+ * kernel is.
+ *
+ * Like dgemm_rect, the _rect functions are row-major, computed column-major
+ * as C^T += B^T * A^T; the _pool versions tile C on a ThreadPool, the real
+ * ones with dgemm_rect_pool from dgemm_shape.h.
+ * compile with -msse3 or -march=native */
+#ifndef ZGEMM_H
+#define ZGEMM_H
+
+#include <complex>
+#include <vector>
+#include <pmmintrin.h>
+#include "dgemm.h"
+#include "dgemm_shape.h"
+#include "matalloc.h"
+#include "threadpool.h"
+
+/* pack R rows at a time of column-major A (M x K), k-major */
+template <class T, int R>
+static void cpack_a (int lda, int M, int K, const T* A, T* AA)
+{
+  for (int m = 0; m < M; m += R) {
+    T* dst = &AA[m*K];
+    for (int k = 0; k < K; ++k)
+      for (int r = 0; r < R; ++r)
+        *dst++ = A[k*lda + m + r];
+  }
+}
+
+/* pack R columns at a time of column-major B (K x N), k-major */
+template <class T, int R>
+static void cpack_b (int ldb, int N, int K, const T* B, T* BB)
+{
+  for (int n = 0; n < N; n += R) {
+    T* dst = &BB[n*K];
+    for (int k = 0; k < K; ++k)
+      for (int c = 0; c < R; ++c)
+        *dst++ = B[(n + c)*ldb + k];
+  }
+}
+
+template <class T> struct ComplexKernel;
+
+/* 2x2 complex doubles, one complex per register:
+ * a*b = addsub(a*re(b), swap(a)*im(b)) */
+template <> struct ComplexKernel<std::complex<double> > {
+  enum { MR = 2, NR = 2 };
+  static void run (int ldc, int K, const std::complex<double>* AA, const std::complex<double>* BB,
+                   std::complex<double>* Cc)
+  {
+    const double* A = reinterpret_cast<const double*>(AA);
+    const double* B = reinterpret_cast<const double*>(BB);
+    double* C = reinterpret_cast<double*>(Cc);
+    __m128d r00 = _mm_setzero_pd(), r10 = r00, r01 = r00, r11 = r00;
+    __m128d i00 = r00, i10 = r00, i01 = r00, i11 = r00;
+    for (int k = 0; k < K; ++k) {
+      __m128d a0 = _mm_loadu_pd(A), a1 = _mm_loadu_pd(A + 2);
+      __m128d s0 = _mm_shuffle_pd(a0, a0, 1), s1 = _mm_shuffle_pd(a1, a1, 1);
+      __m128d b0r = _mm_loaddup_pd(B), b0i = _mm_loaddup_pd(B + 1);
+      __m128d b1r = _mm_loaddup_pd(B + 2), b1i = _mm_loaddup_pd(B + 3);
+      A += 4;
+      B += 4;
+      r00 = _mm_add_pd(r00, _mm_mul_pd(a0, b0r));
+      i00 = _mm_add_pd(i00, _mm_mul_pd(s0, b0i));
+      r10 = _mm_add_pd(r10, _mm_mul_pd(a1, b0r));
+      i10 = _mm_add_pd(i10, _mm_mul_pd(s1, b0i));
+      r01 = _mm_add_pd(r01, _mm_mul_pd(a0, b1r));
+      i01 = _mm_add_pd(i01, _mm_mul_pd(s0, b1i));
+      r11 = _mm_add_pd(r11, _mm_mul_pd(a1, b1r));
+      i11 = _mm_add_pd(i11, _mm_mul_pd(s1, b1i));
+    }
+    double* c0 = C;
+    double* c1 = C + 2*ldc;
+    _mm_storeu_pd(c0    , _mm_add_pd(_mm_loadu_pd(c0    ), _mm_addsub_pd(r00, i00)));
+    _mm_storeu_pd(c0 + 2, _mm_add_pd(_mm_loadu_pd(c0 + 2), _mm_addsub_pd(r10, i10)));
+    _mm_storeu_pd(c1    , _mm_add_pd(_mm_loadu_pd(c1    ), _mm_addsub_pd(r01, i01)));
+    _mm_storeu_pd(c1 + 2, _mm_add_pd(_mm_loadu_pd(c1 + 2), _mm_addsub_pd(r11, i11)));
+  }
+};
+
+/* 4x2 complex floats, two complex per register */
+template <> struct ComplexKernel<std::complex<float> > {
+  enum { MR = 4, NR = 2 };
+  static void run (int ldc, int K, const std::complex<float>* AA, const std::complex<float>* BB,
+                   std::complex<float>* Cc)
+  {
+    const float* A = reinterpret_cast<const float*>(AA);
+    const float* B = reinterpret_cast<const float*>(BB);
+    float* C = reinterpret_cast<float*>(Cc);
+    __m128 r00 = _mm_setzero_ps(), r10 = r00, r01 = r00, r11 = r00;
+    __m128 i00 = r00, i10 = r00, i01 = r00, i11 = r00;
+    for (int k = 0; k < K; ++k) {
+      __m128 a0 = _mm_loadu_ps(A), a1 = _mm_loadu_ps(A + 4);
+      __m128 s0 = _mm_shuffle_ps(a0, a0, _MM_SHUFFLE(2, 3, 0, 1));
+      __m128 s1 = _mm_shuffle_ps(a1, a1, _MM_SHUFFLE(2, 3, 0, 1));
+      __m128 b0r = _mm_set1_ps(B[0]), b0i = _mm_set1_ps(B[1]);
+      __m128 b1r = _mm_set1_ps(B[2]), b1i = _mm_set1_ps(B[3]);
+      A += 8;
+      B += 4;
+      r00 = _mm_add_ps(r00, _mm_mul_ps(a0, b0r));
+      i00 = _mm_add_ps(i00, _mm_mul_ps(s0, b0i));
+      r10 = _mm_add_ps(r10, _mm_mul_ps(a1, b0r));
+      i10 = _mm_add_ps(i10, _mm_mul_ps(s1, b0i));
+      r01 = _mm_add_ps(r01, _mm_mul_ps(a0, b1r));
+      i01 = _mm_add_ps(i01, _mm_mul_ps(s0, b1i));
+      r11 = _mm_add_ps(r11, _mm_mul_ps(a1, b1r));
+      i11 = _mm_add_ps(i11, _mm_mul_ps(s1, b1i));
+    }
+    float* c0 = C;
+    float* c1 = C + 2*ldc;
+    _mm_storeu_ps(c0    , _mm_add_ps(_mm_loadu_ps(c0    ), _mm_addsub_ps(r00, i00)));
+    _mm_storeu_ps(c0 + 4, _mm_add_ps(_mm_loadu_ps(c0 + 4), _mm_addsub_ps(r10, i10)));
+    _mm_storeu_ps(c1    , _mm_add_ps(_mm_loadu_ps(c1    ), _mm_addsub_ps(r01, i01)));
+    _mm_storeu_ps(c1 + 4, _mm_add_ps(_mm_loadu_ps(c1 + 4), _mm_addsub_ps(r11, i11)));
+  }
+};
+
+/* Column-major C (M x N) += A (M x K) * B (K x N), the complex do_block_ld */
+template <class T>
+inline void cdo_block_ld (int lda, int ldb, int ldc, int M, int N, int K, const T* A, const T* B, T* C)
+{
+  typedef ComplexKernel<T> Kernel;
+  const int MR = Kernel::MR, NR = Kernel::NR;
+  int M_max = M / MR * MR;
+  int N_max = N / NR * NR;
+  thread_local std::vector<T> AA, BB;
+  AA.resize((size_t)M_max * K);
+  BB.resize((size_t)N_max * K);
+  cpack_a<T, MR>(lda, M_max, K, A, AA.data());
+  cpack_b<T, NR>(ldb, N_max, K, B, BB.data());
+
+  for (int i = 0; i < M_max; i += MR)
+    for (int j = 0; j < N_max; j += NR)
+      Kernel::run(ldc, K, &AA[i*K], &BB[j*K], &C[j*ldc + i]);
+  // horizontal sliver, then vertical sliver + bottom right corner
+  for (int j = 0; j < N; ++j)
+    for (int i = (j < N_max ? M_max : 0); i < M; ++i) {
+      T cij = C[j*ldc + i];
+      for (int k = 0; k < K; ++k)
+        cij += A[k*lda + i] * B[j*ldb + k];
+      C[j*ldc + i] = cij;
+    }
+}
+
+/* Row-major C (M x N) += A (M x K) * B (K x N), blocked like dgemm_rect */
+template <class T>
+inline void cgemm_rect (int M, int N, int K, const T* A, int lda, const T* B, int ldb, T* C, int ldc, int bs)
+{
+  for (int j = 0; j < N; j += bs)
+    for (int i = 0; i < M; i += bs)
+      for (int k = 0; k < K; k += bs) {
+        int bm = N - j < bs ? N - j : bs;
+        int bn = M - i < bs ? M - i : bs;
+        int bk = K - k < bs ? K - k : bs;
+        cdo_block_ld(ldb, lda, ldc, bm, bn, bk, B + k*ldb + j, A + i*lda + k, C + i*ldc + j);
+      }
+}
+
+/* cgemm_rect with tiles of C of bs * TILE_BLOCKS on the pool */
+template <class T>
+inline void cgemm_pool (ThreadPool& pool, int M, int N, int K, const T* A, int lda, const T* B, int ldb, T* C,
+                        int ldc, int bs)
+{
+  int tile = bs * TILE_BLOCKS;
+  int rows = (M + tile - 1) / tile, cols = (N + tile - 1) / tile;
+  pool.submit(rows * cols, [&](int t) {
+    int i0 = (t / cols) * tile, j0 = (t % cols) * tile;
+    int tm = M - i0 < tile ? M - i0 : tile, tn = N - j0 < tile ? N - j0 : tile;
+    cgemm_rect(tm, tn, K, A + (size_t)i0*lda, lda, B + j0, ldb, C + (size_t)i0*ldc + j0, ldc, bs);
+  }).get();
+}
+
+inline void zgemm_pool (ThreadPool& pool, int M, int N, int K, const std::complex<double>* A, int lda,
+                        const std::complex<double>* B, int ldb, std::complex<double>* C, int ldc, int bs)
+{
+  cgemm_pool(pool, M, N, K, A, lda, B, ldb, C, ldc, bs);
+}
+
+/* Split layout, 4M: Cr += Ar*Br - Ai*Bi, Ci += Ar*Bi + Ai*Br. The kernel
+ * only accumulates, so -Ai is made once (M x K) */
+inline void zgemm_split_4m (ThreadPool& pool, int M, int N, int K, double* Ar, double* Ai, int lda,
+                            double* Br, double* Bi, int ldb, double* Cr, double* Ci, int ldc, int bs)
+{
+  double* negAi = alloc_matrix((size_t)M * K);
+  for (int i = 0; i < M; ++i)
+    for (int k = 0; k < K; ++k)
+      negAi[(size_t)i*K + k] = -Ai[(size_t)i*lda + k];
+  dgemm_rect_pool(pool, M, N, K, Ar, lda, Br, ldb, Cr, ldc, bs);
+  dgemm_rect_pool(pool, M, N, K, negAi, K, Bi, ldb, Cr, ldc, bs);
+  dgemm_rect_pool(pool, M, N, K, Ar, lda, Bi, ldb, Ci, ldc, bs);
+  dgemm_rect_pool(pool, M, N, K, Ai, lda, Br, ldb, Ci, ldc, bs);
+  free_matrix(negAi);
+}
+
+/* Split layout, 3M: T1 = Ar*Br, T2 = Ai*Bi, T3 = (Ar+Ai)*(Br+Bi), then
+ * Cr += T1 - T2 and Ci += T3 - T1 - T2. A quarter fewer flops; the error of
+ * Ci grows with |A||B| rather than with the result */
+inline void zgemm_split_3m (ThreadPool& pool, int M, int N, int K, double* Ar, double* Ai, int lda,
+                            double* Br, double* Bi, int ldb, double* Cr, double* Ci, int ldc, int bs)
+{
+  double* SA = alloc_matrix((size_t)M * K);
+  double* SB = alloc_matrix((size_t)K * N);
+  double* T = alloc_matrix((size_t)3 * M * N);
+  double *T1 = T, *T2 = T + (size_t)M*N, *T3 = T + (size_t)2*M*N;
+  for (int i = 0; i < M; ++i)
+    for (int k = 0; k < K; ++k)
+      SA[(size_t)i*K + k] = Ar[(size_t)i*lda + k] + Ai[(size_t)i*lda + k];
+  for (int k = 0; k < K; ++k)
+    for (int j = 0; j < N; ++j)
+      SB[(size_t)k*N + j] = Br[(size_t)k*ldb + j] + Bi[(size_t)k*ldb + j];
+  dgemm_rect_pool(pool, M, N, K, Ar, lda, Br, ldb, T1, N, bs);
+  dgemm_rect_pool(pool, M, N, K, Ai, lda, Bi, ldb, T2, N, bs);
+  dgemm_rect_pool(pool, M, N, K, SA, K, SB, N, T3, N, bs);
+  for (int i = 0; i < M; ++i)
+    for (int j = 0; j < N; ++j) {
+      size_t t = (size_t)i*N + j;
+      Cr[(size_t)i*ldc + j] += T1[t] - T2[t];
+      Ci[(size_t)i*ldc + j] += T3[t] - T1[t] - T2[t];
+    }
+  free_matrix(SA);
+  free_matrix(SB);
+  free_matrix(T);
+}
+
+#endif